@@ -0,0 +1,3 @@
+-- the children of a random cell, delta resolutions finer
+\set id random(1, 100000)
+select count(*) from pgh3_bench.cells c, h3_to_children(h3_to_parent(c.cell, 9 - :delta), 9) k where c.id = :id;
@@ -0,0 +1,2 @@
+-- compacting one of the sets of pgh3_bench.compact_input
+select cardinality(h3_compact_array(cells)) from pgh3_bench.compact_input where id = :input;
@@ -0,0 +1,3 @@
+-- index 1000 points, one function call per point
+\set start random(1, 999000)
+select count(h3_geo_to_cell(p, :res)) from pgh3_bench.points where id between :start and :start + 999;
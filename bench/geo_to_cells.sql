@@ -0,0 +1,3 @@
+-- index 1000 points with a single call of the batch variant
+\set start random(1, 999000)
+select cardinality(h3_geo_to_cells(array_agg(p), :res)) from pgh3_bench.points where id between :start and :start + 999;
@@ -0,0 +1,3 @@
+-- the disk of distance k around a random cell
+\set id random(1, 100000)
+select count(*) from pgh3_bench.cells c, h3_kring(c.cell, :k) k where c.id = :id;
@@ -0,0 +1,328 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Micro benchmark of the H3 calls pgh3 wraps, outside of the executor.
+ *
+ * The difference between these timings and the ones of the pgbench scripts
+ * is the overhead of PostgreSQL and the conversions of pgh3. The data is
+ * generated the same way as in setup.sql.
+ *
+ * Prints one line "benchmark,parameter,metric,value" per result. With
+ * --h3-version only the version of the h3 library is printed.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <h3/h3api.h>
+
+#define NUM_POINTS      1000000
+#define NUM_CELLS       10000
+
+// each benchmark is repeated until it ran at least this long
+#define MIN_SECONDS     0.5
+
+static GeoCoord *points;
+static H3Index *cells;
+
+// keeps the compiler from removing the benchmarked calls
+static volatile uint64_t sink;
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *
+checked_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "out of memory allocating %zu bytes\n", size);
+        exit(1);
+    }
+    return ptr;
+}
+
+static void
+report(const char *benchmark, const char *parameter, double seconds, double num_ops)
+{
+    printf("%s,%s,ns_per_op,%.2f\n", benchmark, parameter, seconds * 1e9 / num_ops);
+    printf("%s,%s,ops_per_s,%.0f\n", benchmark, parameter, num_ops / seconds);
+}
+
+/*
+ * the points of pgh3_bench.points, in radians
+ */
+static void
+create_points(void)
+{
+    points = checked_malloc(NUM_POINTS * sizeof(GeoCoord));
+    for (int i = 1; i <= NUM_POINTS; i++) {
+        double x = i * 0.6180339887498949 - floor(i * 0.6180339887498949);
+        double y = i * 0.7548776662466927 - floor(i * 0.7548776662466927);
+        points[i - 1].lon = H3_EXPORT(degsToRads)(x * 360.0 - 180.0);
+        points[i - 1].lat = asin(2.0 * y - 1.0);
+    }
+
+    cells = checked_malloc(NUM_CELLS * sizeof(H3Index));
+    for (int i = 0; i < NUM_CELLS; i++) {
+        cells[i] = H3_EXPORT(geoToH3)(&points[i], 9);
+    }
+}
+
+static void
+bench_geo_to_h3(int res)
+{
+    char parameter[32];
+    snprintf(parameter, sizeof(parameter), "res=%d", res);
+
+    double start = now_seconds();
+    double elapsed;
+    double num_ops = 0;
+    do {
+        for (int i = 0; i < NUM_POINTS; i++) {
+            sink += H3_EXPORT(geoToH3)(&points[i], res);
+        }
+        num_ops += NUM_POINTS;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    report("geo_to_h3", parameter, elapsed, num_ops);
+}
+
+/*
+ * the conversions of the text input and output of the h3index type
+ */
+static void
+bench_text_conversion(void)
+{
+    char str[17];
+
+    double start = now_seconds();
+    double elapsed;
+    double num_ops = 0;
+    do {
+        for (int i = 0; i < NUM_CELLS; i++) {
+            H3_EXPORT(h3ToString)(cells[i], str, sizeof(str));
+            sink += H3_EXPORT(stringToH3)(str);
+        }
+        num_ops += NUM_CELLS;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    report("text_round_trip", "res=9", elapsed, num_ops);
+}
+
+static void
+bench_kring(int k)
+{
+    char parameter[32];
+    snprintf(parameter, sizeof(parameter), "k=%d", k);
+
+    H3Index *out = checked_malloc(H3_EXPORT(maxKringSize)(k) * sizeof(H3Index));
+
+    double start = now_seconds();
+    double elapsed;
+    double num_ops = 0;
+    int i = 0;
+    do {
+        // the buffer is expected to be zeroed
+        memset(out, 0, H3_EXPORT(maxKringSize)(k) * sizeof(H3Index));
+        H3_EXPORT(kRing)(cells[i], k, out);
+        sink += out[0];
+        i = (i + 1) % NUM_CELLS;
+        num_ops++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    report("kring", parameter, elapsed, num_ops);
+    free(out);
+}
+
+static void
+bench_children(int delta)
+{
+    char parameter[32];
+    snprintf(parameter, sizeof(parameter), "delta=%d", delta);
+
+    H3Index parent = H3_EXPORT(h3ToParent)(cells[0], 9 - delta);
+    int max_children = H3_EXPORT(maxH3ToChildrenSize)(parent, 9);
+    H3Index *out = checked_malloc(max_children * sizeof(H3Index));
+
+    double start = now_seconds();
+    double elapsed;
+    double num_ops = 0;
+    int i = 0;
+    do {
+        parent = H3_EXPORT(h3ToParent)(cells[i], 9 - delta);
+        H3_EXPORT(h3ToChildren)(parent, 9, out);
+        sink += out[0];
+        i = (i + 1) % NUM_CELLS;
+        num_ops++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    report("children", parameter, elapsed, num_ops);
+    free(out);
+}
+
+/*
+ * an axis aligned rectangle in degrees
+ */
+static void
+make_box(GeoPolygon *polygon, GeoCoord *verts, double west, double south, double east, double north)
+{
+    verts[0].lon = H3_EXPORT(degsToRads)(west);
+    verts[0].lat = H3_EXPORT(degsToRads)(south);
+    verts[1].lon = H3_EXPORT(degsToRads)(east);
+    verts[1].lat = H3_EXPORT(degsToRads)(south);
+    verts[2].lon = H3_EXPORT(degsToRads)(east);
+    verts[2].lat = H3_EXPORT(degsToRads)(north);
+    verts[3].lon = H3_EXPORT(degsToRads)(west);
+    verts[3].lat = H3_EXPORT(degsToRads)(north);
+
+    polygon->geofence.numVerts = 4;
+    polygon->geofence.verts = verts;
+    polygon->numHoles = 0;
+    polygon->holes = NULL;
+}
+
+/*
+ * Fills the polygon, returns the cells and their number. Empty slots
+ * of the output of polyfill are removed.
+ */
+static H3Index *
+fill_polygon(const GeoPolygon *polygon, int res, int *num_cells)
+{
+    int max_cells = H3_EXPORT(maxPolyfillSize)(polygon, res);
+    H3Index *out = calloc(max_cells, sizeof(H3Index));
+    if (out == NULL) {
+        fprintf(stderr, "out of memory filling a polygon at resolution %d\n", res);
+        exit(1);
+    }
+    H3_EXPORT(polyfill)(polygon, res, out);
+
+    int n = 0;
+    for (int i = 0; i < max_cells; i++) {
+        if (out[i] != 0) {
+            out[n++] = out[i];
+        }
+    }
+    *num_cells = n;
+    return out;
+}
+
+static void
+bench_polyfill(const char *name, const GeoPolygon *polygon, int res)
+{
+    double start = now_seconds();
+    double elapsed;
+    double num_ops = 0;
+    do {
+        int num_cells;
+        H3Index *out = fill_polygon(polygon, res, &num_cells);
+        sink += num_cells;
+        free(out);
+        num_ops++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    report("polyfill", name, elapsed, num_ops);
+}
+
+static void
+bench_compact(const GeoPolygon *polygon, int res)
+{
+    int num_cells;
+    H3Index *input = fill_polygon(polygon, res, &num_cells);
+    H3Index *out = checked_malloc(num_cells * sizeof(H3Index));
+
+    char parameter[32];
+    snprintf(parameter, sizeof(parameter), "cells=%d", num_cells);
+
+    double start = now_seconds();
+    double elapsed;
+    double num_ops = 0;
+    do {
+        if (H3_EXPORT(compact)(input, out, num_cells) != 0) {
+            fprintf(stderr, "compact failed for %d cells\n", num_cells);
+            exit(1);
+        }
+        sink += out[0];
+        num_ops++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    report("compact", parameter, elapsed, num_ops);
+    free(out);
+    free(input);
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--h3-version") == 0) {
+        printf("%d.%d.%d\n", H3_VERSION_MAJOR, H3_VERSION_MINOR, H3_VERSION_PATCH);
+        return 0;
+    }
+
+    create_points();
+
+    bench_geo_to_h3(5);
+    bench_geo_to_h3(9);
+    bench_geo_to_h3(15);
+
+    bench_text_conversion();
+
+    bench_kring(1);
+    bench_kring(5);
+    bench_kring(20);
+    bench_kring(100);
+
+    bench_children(1);
+    bench_children(3);
+    bench_children(5);
+
+    // the polygons of setup.sql, without the holes and parts
+    GeoPolygon small, large;
+    GeoCoord small_verts[4], large_verts[4];
+    make_box(&small, small_verts, 9.73, 52.37, 9.745, 52.379);
+    make_box(&large, large_verts, 6.0, 48.0, 14.0, 53.0);
+
+    bench_polyfill("small", &small, 10);
+    bench_polyfill("large", &large, 7);
+
+    for (int res = 6; res <= 9; res++) {
+        bench_compact(&large, res);
+    }
+
+    free(points);
+    free(cells);
+    return 0;
+}
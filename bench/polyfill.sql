@@ -0,0 +1,2 @@
+-- fill one of the polygons of pgh3_bench.polygons at its resolution
+select count(*) from pgh3_bench.polygons g, h3_polyfill_cells(g.geom, g.resolution) c where g.id = :polygon;
@@ -0,0 +1,99 @@
+#!/bin/sh
+#
+# Runs the benchmarks against the pgh3 installed in the database given by
+# the usual libpq environment variables (PGDATABASE, PGHOST, ...) and
+# appends the results to a CSV file.
+#
+# Usage: bench/run.sh [output.csv]
+#
+# Environment:
+#   BENCH_TIME      seconds each pgbench script runs, default 10
+#   BENCH_CLIENTS   number of pgbench clients, default 1
+#   BENCH_MICRO     path of the compiled micro benchmark, skipped when empty
+#   BENCH_SETUP     set to 1 to recreate the datasets even if they exist
+#
+# Columns of the CSV file:
+#   started, pg_version, pgh3_version, h3_version, suite, benchmark, parameter, metric, value
+
+set -e
+
+BENCH_DIR=$(dirname "$0")
+OUTPUT=${1:-$BENCH_DIR/results.csv}
+BENCH_TIME=${BENCH_TIME:-10}
+BENCH_CLIENTS=${BENCH_CLIENTS:-1}
+
+PSQL="psql -X -q -t -A -v ON_ERROR_STOP=1"
+
+if [ "$BENCH_SETUP" = "1" ] || [ "$($PSQL -c "select to_regclass('pgh3_bench.compact_input') is null")" = "t" ]; then
+    echo "creating the datasets in schema pgh3_bench" >&2
+    $PSQL -f "$BENCH_DIR/setup.sql"
+fi
+
+STARTED=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+PG_VERSION=$($PSQL -c "show server_version_num")
+PGH3_VERSION=$($PSQL -c "select extversion from pg_extension where extname = 'pgh3'")
+# the version of the h3 library is only known to the micro benchmark
+H3_VERSION=unknown
+if [ -n "$BENCH_MICRO" ]; then
+    H3_VERSION=$("$BENCH_MICRO" --h3-version)
+fi
+
+if [ ! -f "$OUTPUT" ]; then
+    echo "started,pg_version,pgh3_version,h3_version,suite,benchmark,parameter,metric,value" > "$OUTPUT"
+fi
+
+record() {
+    # suite benchmark parameter metric value
+    echo "$STARTED,$PG_VERSION,$PGH3_VERSION,$H3_VERSION,$1,$2,$3,$4,$5" >> "$OUTPUT"
+}
+
+# run_pgbench script parameter [pgbench options]
+run_pgbench() {
+    script=$1
+    parameter=$2
+    shift 2
+    echo "pgbench $script $parameter" >&2
+
+    result=$(pgbench -n -T "$BENCH_TIME" -c "$BENCH_CLIENTS" -f "$BENCH_DIR/$script.sql" "$@" 2>&1) || {
+        echo "$result" >&2
+        exit 1
+    }
+    tps=$(echo "$result" | sed -n 's/^tps = \([0-9.]*\).*/\1/p' | tail -n 1)
+    latency=$(echo "$result" | sed -n 's/^latency average = \([0-9.]*\) ms.*/\1/p')
+    record pgbench "$script" "$parameter" tps "$tps"
+    record pgbench "$script" "$parameter" latency_ms "$latency"
+}
+
+for res in 5 9 15; do
+    run_pgbench geo_to_cell "res=$res" -D res=$res
+    run_pgbench geo_to_cells "res=$res" -D res=$res
+done
+
+for polygon in 1 2 3 4; do
+    name=$($PSQL -c "select name from pgh3_bench.polygons where id = $polygon")
+    run_pgbench polyfill "$name" -D polygon=$polygon
+done
+
+for k in 1 5 20 100; do
+    run_pgbench kring "k=$k" -D k=$k
+done
+
+for delta in 1 3 5; do
+    run_pgbench children "delta=$delta" -D delta=$delta
+    run_pgbench uncompact "delta=$delta" -D delta=$delta
+done
+
+for input in 1 2 3 4 5; do
+    num_cells=$($PSQL -c "select num_cells from pgh3_bench.compact_input where id = $input")
+    run_pgbench compact "cells=$num_cells" -D input=$input
+done
+
+# the micro benchmark prints its results as "benchmark,parameter,metric,value"
+if [ -n "$BENCH_MICRO" ]; then
+    echo "micro benchmark" >&2
+    "$BENCH_MICRO" | while IFS= read -r line; do
+        echo "$STARTED,$PG_VERSION,$PGH3_VERSION,$H3_VERSION,micro,$line" >> "$OUTPUT"
+    done
+fi
+
+echo "results appended to $OUTPUT" >&2
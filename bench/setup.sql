@@ -0,0 +1,76 @@
+-- Synthetic datasets for the benchmarks.
+--
+-- All data is derived from generate_series without random(), so every run
+-- of the benchmarks works on the same rows.
+
+create extension if not exists postgis;
+create extension if not exists pgh3;
+
+drop schema if exists pgh3_bench cascade;
+create schema pgh3_bench;
+
+-- 10^6 points distributed evenly over the sphere. The coordinates are
+-- taken from low discrepancy sequences of the golden ratio and the
+-- plastic number.
+create table pgh3_bench.points as
+select i id,
+    point(x * 360.0 - 180.0, degrees(asin(2.0 * y - 1.0))) p
+from (
+    select i,
+        i * 0.6180339887498949 - floor(i * 0.6180339887498949) x,
+        i * 0.7548776662466927 - floor(i * 0.7548776662466927) y
+    from generate_series(1, 1000000) i
+) f;
+alter table pgh3_bench.points add primary key (id);
+
+-- cells at resolution 9 of the first 10^5 points
+create table pgh3_bench.cells as
+select id, h3_geo_to_cell(p, 9) cell
+from pgh3_bench.points
+where id <= 100000;
+alter table pgh3_bench.cells add primary key (id);
+
+-- polygons of different sizes and shapes, with the resolution
+-- used to fill them
+create table pgh3_bench.polygons (
+    id integer primary key,
+    name text not null,
+    resolution integer not null,
+    geom geometry not null
+);
+
+insert into pgh3_bench.polygons values
+    -- a square of about 1 km2
+    (1, 'small', 10, st_makeenvelope(9.73, 52.37, 9.745, 52.379, 4326)),
+    -- about 300,000 km2
+    (2, 'large', 7, st_makeenvelope(6.0, 48.0, 14.0, 53.0, 4326)),
+    -- the large polygon with 100 rectangular holes
+    (3, 'holes', 7, (
+        select st_difference(st_makeenvelope(6.0, 48.0, 14.0, 53.0, 4326),
+            st_union(st_makeenvelope(x, y, x + 0.3, y + 0.2, 4326)))
+        from generate_series(6.25, 13.0, 0.75) x, generate_series(48.2, 52.25, 0.45) y
+    )),
+    -- 1000 small parts spread over a continent
+    (4, 'multi', 9, (
+        select st_collect(st_makeenvelope(x, y, x + 0.05, y + 0.03, 4326))
+        from generate_series(-10.0, 29.5, 1.0) x, generate_series(36.0, 60.0, 1.0) y
+    ));
+
+-- cells to compact, from about 10^4 to 10^7. Filling the large polygon
+-- leaves cells along its boundary which can not be compacted.
+create table pgh3_bench.compact_input (
+    id integer primary key,
+    num_cells integer not null,
+    cells h3index[] not null
+);
+
+insert into pgh3_bench.compact_input
+select r - 5, cardinality(cells), cells
+from generate_series(6, 9) r,
+    h3_polyfill_cells_array(st_makeenvelope(6.0, 48.0, 14.0, 53.0, 4326), r) cells;
+
+insert into pgh3_bench.compact_input
+select 5, cardinality(cells), cells
+from h3_polyfill_cells_array(st_makeenvelope(2.0, 46.0, 18.0, 55.0, 4326), 9) cells;
+
+vacuum analyze pgh3_bench.points, pgh3_bench.cells, pgh3_bench.polygons, pgh3_bench.compact_input;
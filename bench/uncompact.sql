@@ -0,0 +1,4 @@
+-- uncompacting 100 cells, delta resolutions finer
+\set start random(1, 99900)
+select cardinality(h3_uncompact_array(array_agg(h3_to_parent(cell, 9 - :delta)), 9))
+from pgh3_bench.cells where id between :start and :start + 99;
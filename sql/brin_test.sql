@@ -0,0 +1,27 @@
+create extension if not exists postgis;
+create extension if not exists pgh3;
+
+
+/* the BRIN operator class */
+
+create table h3index_brin_test (i h3index) with (fillfactor = 10);
+insert into h3index_brin_test
+    select i from (
+        select h3_uncompact(array['89283470c27ffff'::h3index], 11) i
+        union all select '89283470c27ffff'
+        union all select '88283470c3fffff'
+        union all select h3_to_children('8928308280fffff'::h3index, 10)
+    ) c order by i;
+
+create index h3index_brin_test_idx on h3index_brin_test using brin (i) with (pages_per_range = 1);
+set enable_seqscan = off;
+
+select count(*) from h3index_brin_test where i = '8b283470c240fff';
+select count(*) from h3index_brin_test where i < '89283470c27ffff';
+select count(*) from h3index_brin_test where i > '88283470c3fffff';
+select count(*) from h3index_brin_test where i <@ '89283470c27ffff';
+select count(*) from h3index_brin_test where i <@ '88283470c3fffff';
+select count(*) from h3index_brin_test where i <@ '8928308280fffff';
+select count(*) from h3index_brin_test where i @> '8b283470c240fff';
+
+reset enable_seqscan;
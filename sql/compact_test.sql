@@ -61,3 +61,52 @@ select h3_uncompact(array[h3_compact(array(select h3index from sunnyvale))], 9);
 select h3_uncompact(array[h3_compact(array(select h3index from sunnyvale))], 9)
 except
 select h3index from sunnyvale;
+
+-- a pentagon and a hexagon, the pentagon has only 6 children
+select count(*) from h3_uncompact(array['8009fffffffffff', '8001fffffffffff']::h3index[], 1);
+
+/* the compact aggregate */
+
+select array_length(h3_compact_agg(h3index::h3index), 1) from sunnyvale;
+
+-- same as h3_compact. should return 0 rows.
+select unnest(h3_compact_agg(h3index::h3index)) from sunnyvale
+except
+select h3_compact(array(select h3index::h3index from sunnyvale));
+
+-- mixed resolutions, duplicates and contained indexes
+select h3_compact_agg(i) from (
+    select h3_uncompact(array['89283470c27ffff'::h3index], 11) i
+    union all select h3_to_children('89283470c27ffff'::h3index, 10)
+    union all select '8b283470c240fff'
+) f;
+
+select h3_compact_agg(i) from (select h3_to_children('89283470c27ffff'::h3index, 10) i limit 6) f;
+
+select h3_compact_agg(null::h3index);
+
+-- parallel aggregation
+create table sunnyvale_uncompacted as
+    select h3_uncompact(array(select h3index::h3index from sunnyvale), 11) i;
+set parallel_setup_cost = 0;
+set parallel_tuple_cost = 0;
+set min_parallel_table_scan_size = 0;
+set max_parallel_workers_per_gather = 2;
+
+select array_length(h3_compact_agg(i), 1) from sunnyvale_uncompacted;
+
+reset max_parallel_workers_per_gather;
+reset min_parallel_table_scan_size;
+reset parallel_tuple_cost;
+reset parallel_setup_cost;
+
+/* array variants */
+
+select h3_compact_array(array(select h3_to_children('89283470c27ffff'::h3index, 10)));
+
+select array_length(h3_uncompact_array(array['8009fffffffffff', '8001fffffffffff']::h3index[], 1), 1);
+
+-- same as the set-returning function. should return 0 rows.
+select unnest(h3_uncompact_array(array['89283470c27ffff'::h3index], 11))
+except all
+select h3_uncompact(array['89283470c27ffff'::h3index], 11);
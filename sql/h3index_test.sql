@@ -0,0 +1,115 @@
+create extension if not exists postgis;
+create extension if not exists pgh3;
+
+
+/* the h3index type */
+
+select '85639c63fffffff'::h3index;
+
+select '85639c63fffffff'::h3index::bigint;
+
+select 600731123940589567::h3index;
+
+select pg_column_size('85639c63fffffff'::h3index);
+
+-- binary representation used by COPY BINARY and the binary protocol
+select h3index_send('85639c63fffffff');
+
+select 'zz'::h3index; -- invalid
+
+-- the reserved highest bit is rejected by all inputs
+select 'ffffffffffffffff'::h3index; -- invalid
+
+select 'ffffffffffffffff'::text::h3index; -- invalid
+
+select (-1)::bigint::h3index; -- invalid
+
+select 0::bigint::h3index; -- invalid
+
+/* native variants of the text functions */
+
+select pg_typeof(h3_geo_to_cell('(9.40691761982618,52.1233617183044)'::point, 5)), 
+    h3_geo_to_cell('(9.40691761982618,52.1233617183044)'::point, 5);
+
+select h3_get_resolution('85639c63fffffff'::h3index);
+
+select h3_to_parent('85639c63fffffff'::h3index, 4);
+
+select h3_to_children('82639ffffffffff'::h3index, 3);
+
+select count(*) from h3_kring('89283470c27ffff'::h3index, 2);
+
+select h3_compact(array(select h3_to_children('89283470c27ffff'::h3index, 10)));
+
+select count(*) from h3_uncompact(array['89283470c27ffff'::h3index], 10);
+
+/* operators, ordering and hashing */
+
+select '85639c63fffffff'::h3index = '85639c63fffffff'::h3index, 
+    '85639c63fffffff'::h3index < '84639c7ffffffff'::h3index;
+
+-- descendants are sorted before their ancestors
+select i from (values ('84639c7ffffffff'::h3index), ('85639c63fffffff'), ('8263a7fffffffff'), 
+    ('83639cfffffffff'), ('85639c67fffffff')) v(i)
+order by i;
+
+create table h3index_ops_test as 
+    select h3_uncompact(array['89283470c27ffff'::h3index], 11) i;
+insert into h3index_ops_test select i from h3index_ops_test;
+
+set enable_sort = off;
+select count(*) from (select i from h3index_ops_test group by i) g;
+reset enable_sort;
+
+set enable_hashagg = off;
+select count(*) from (select i from h3index_ops_test group by i) g;
+reset enable_hashagg;
+
+create index h3index_ops_test_idx on h3index_ops_test (i);
+select count(*) from h3index_ops_test where i = '8b283470c240fff';
+
+select h3_uncompact(array['89283470c27ffff'::h3index], 10) 
+except 
+select h3_to_children('89283470c27ffff'::h3index, 10);
+
+/* containment as btree range scans */
+
+create function pg_temp.index_cond(query text) returns text as $$
+declare
+    plan jsonb;
+begin
+    execute 'explain (costs off, format json) ' || query into plan;
+    return jsonb_path_query_first(plan, '$.**."Index Cond"') #>> '{}';
+end $$ language plpgsql;
+
+set enable_seqscan = off;
+set enable_bitmapscan = off;
+
+select pg_temp.index_cond($$select * from h3index_ops_test where i <@ '8a283470c247fff'$$);
+
+select (select count(*) from h3index_ops_test where i <@ '89283470c27ffff') res9,
+    (select count(*) from h3index_ops_test where i <@ '8a283470c247fff') res10,
+    (select count(*) from h3index_ops_test where '8b283470c240fff' @> i) res11,
+    (select count(*) from h3index_ops_test where i <@ '89283470c23ffff') other;
+
+-- with a parent bound at execution
+create temporary table h3index_ops_parents as select '8a283470c247fff'::h3index c;
+
+set enable_hashjoin = off;
+set enable_mergejoin = off;
+
+select pg_temp.index_cond($$select * from h3index_ops_parents p join h3index_ops_test t on t.i <@ p.c$$);
+
+select count(*) from h3index_ops_parents p join h3index_ops_test t on t.i <@ p.c;
+
+-- the function form of the operator
+select pg_temp.index_cond($$select * from h3index_ops_parents p join h3index_ops_test t
+    on h3index_contained_by(t.i, p.c)$$);
+
+-- a parent computed from the indexed column is no index condition
+select pg_temp.index_cond($$select * from h3index_ops_test t where h3index_contained_by(t.i, h3_to_parent(t.i, 5))$$);
+
+reset enable_hashjoin;
+reset enable_mergejoin;
+reset enable_bitmapscan;
+reset enable_seqscan;
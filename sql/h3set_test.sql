@@ -0,0 +1,77 @@
+create extension if not exists postgis;
+create extension if not exists pgh3;
+
+
+/* the h3set type */
+
+select '{85283473fffffff, 85283473fffffff}'::h3set;
+
+select '{}'::h3set, h3set_num_cells('{}');
+
+select h3_to_children_array('85283473fffffff'::h3index, 6)::h3set; -- compacted
+
+select '{85283473fffffff,872834713ffffff}'::h3set::h3index[]; -- contained cells are removed
+
+select '{85283473fffffff,'::h3set;
+
+/* set operations */
+
+select '{862834707ffffff,86283470fffffff,862834717ffffff}'::h3set
+    | '{86283471fffffff,862834727ffffff,86283472fffffff,862834737ffffff,8528340bfffffff}';
+
+select '{85283473fffffff}'::h3set & '{872834713ffffff,8528340bfffffff}';
+
+select '{85283473fffffff,8528340bfffffff}'::h3set & '{872834713ffffff,862834737ffffff,8428347ffffffff}';
+
+select '{85283473fffffff}'::h3set - '{872834713ffffff}';
+
+select '{85283473fffffff}'::h3set - '{8428347ffffffff}';
+
+select ('{85283473fffffff}'::h3set - '{872834713ffffff}') | '{872834713ffffff}' = '{85283473fffffff}'::h3set;
+
+/* containment */
+
+select '{85283473fffffff}'::h3set @> '872834713ffffff'::h3index,
+    '872834713ffffff'::h3index <@ '{8528340bfffffff}'::h3set,
+    '{872834713ffffff}'::h3set @> '85283473fffffff'::h3index;
+
+select '{85283473fffffff}'::h3set @> '{872834713ffffff,86283472fffffff}'::h3set,
+    '{85283473fffffff}'::h3set <@ '{872834713ffffff}'::h3set,
+    '{85283473fffffff}'::h3set && '{872834713ffffff}'::h3set,
+    '{85283473fffffff}'::h3set && '{8528340bfffffff}'::h3set;
+
+/* aggregate */
+
+select h3set_agg(c) from h3_to_children('85283473fffffff'::h3index, 8) c;
+
+/* storage */
+
+select h3set_num_cells(s), pg_column_size(s) < h3set_num_cells(s) * 2 compressed
+from (
+    select h3set_agg(c) s
+    from h3_to_children('85283473fffffff'::h3index, 9) with ordinality f(c, i)
+    where i % 2 = 0
+) f;
+
+create temporary table h3set_storage as
+select h3set_agg(c) s
+from h3_to_children('85283473fffffff'::h3index, 10) with ordinality f(c, i)
+where i % 2 = 0;
+
+select h3set_num_cells(s), (select count(*) from h3set_cells(s)) num_decoded,
+    (select count(*) from h3_uncompact(s, 11)) num_uncompacted
+from h3set_storage;
+
+select count(*) filter (where i % 2 = 0 and s @> c) contained,
+    count(*) filter (where i % 2 = 1 and s @> c) not_contained
+from h3set_storage, h3_to_children('85283473fffffff'::h3index, 10) with ordinality f(c, i);
+
+select s @> '85283473fffffff'::h3index, s @> '8528340bfffffff'::h3index
+from h3set_storage;
+
+select s = (select h3set_agg(c) from h3set_cells(s) c), s = s::h3index[]::h3set
+from h3set_storage;
+
+select h3_uncompact('{85283473fffffff}'::h3set, 4);
+
+select array['85283473ffffffe'::h3index]::h3set; -- not a cell
@@ -8,4 +8,28 @@ select h3_to_parent('85639c63fffffff', 4);
 
 select h3_to_parent('85639c63fffffff', 1);
 
+-- finer than the index
+select h3_to_parent('85639c63fffffff'::h3index, 6);
+
+select h3_to_parent('85639c63fffffff'::h3index, -1);
+
 select h3_to_children('82639ffffffffff', 3);
+
+-- children of a pentagon: the deleted subsequence is skipped
+select h3_to_children('8009fffffffffff', 1);
+
+select count(*) from h3_to_children('8009fffffffffff', 4);
+
+-- the children are generated lazily, so this does not allocate 7^15 indexes
+select h3_to_children('8001fffffffffff', 15) limit 3;
+
+-- no children at a coarser resolution
+select count(*) from h3_to_children('85639c63fffffff', 4);
+
+/* array variants */
+
+select h3_to_children_array('82639ffffffffff', 3);
+
+select array_length(h3_to_children_array('8009fffffffffff', 4), 1);
+
+select h3_to_children_array('85639c63fffffff', 4);
@@ -23,3 +23,63 @@ select h3_h3index_is_valid('85639cdddddddd'); -- is invalid
 select h3_get_resolution('85639c63fffffff'); -- = 5
 
 select h3_get_basecell('85639c63fffffff'); -- = 5
+
+/* batch indexing */
+
+select h3_geo_to_cells(array[9.40691761982618, null, 9.40691761982618],
+    array[52.1233617183044, 1.0, 52.1233617183044], 5);
+
+select h3_geo_to_cells(array['(9.40691761982618,52.1233617183044)'::point, null,
+    _h3_h3index_to_geo('85639c63fffffff'::h3index)], 5);
+
+select h3_geo_to_cells('MULTIPOINT((9.40691761982618 52.1233617183044),(9.40691761982618 52.1233617183044))'::geometry, 5);
+
+select h3_geo_to_cells('MULTIPOINT EMPTY'::geometry, 5);
+
+select h3_geo_to_cell('POINT(9.40691761982618 52.1233617183044)'::geometry, 5);
+
+select h3_geo_to_cells(array[1.0], array[1.0, 2.0], 5); -- different lengths
+
+select array_length(h3_get_res0_cells_array(), 1);
+
+/* geometries */
+
+select st_srid(h3_h3index_to_geo('85639c63fffffff')) point_srid,
+    st_srid(h3_h3index_to_geoboundary('85639c63fffffff')) polygon_srid;
+
+select st_equals(h3_h3index_to_geoboundary('85639c63fffffff'),
+    st_setsrid(_h3_h3index_to_geoboundary('85639c63fffffff')::geometry, 4326)); -- same as the native polygon
+
+select geometrytype(g), st_numgeometries(g), st_srid(g)
+from (
+    select h3_h3indexes_to_multipolygon(h3_to_children_array(h3_to_parent('85639c63fffffff'::h3index, 4), 5)) g
+) f;
+
+select bool_and(st_equals(st_geometryn(g, i::integer), h3_h3index_to_geoboundary(c)))
+from h3_h3indexes_to_multipolygon(h3_to_children_array(h3_to_parent('85639c63fffffff'::h3index, 4), 5)) g,
+    unnest(h3_to_children_array(h3_to_parent('85639c63fffffff'::h3index, 4), 5)) with ordinality u(c, i);
+
+select st_astext(h3_h3indexes_to_multipolygon('{}'::h3index[]));
+
+/* binning */
+
+select h3_bin(p, 5, v)
+from (values ('(9.40691761982618,52.1233617183044)'::point, 1.0::float8),
+    ('(9.40691761982618,52.1233617183044)'::point, 3.0),
+    (null, 2.0)) f(p, v);
+
+create temporary table bin_points as
+select point(8 + (i % 100) * 0.013, 50 + (i / 100) * 0.011) p, (i % 7)::float8 v
+from generate_series(0, 9999) i;
+
+-- the same bins as grouping by the cells. should return 0.
+select count(*) from (
+    (select (b).* from unnest((select h3_bin(p, 6, v) from bin_points)) b
+        except all select h3_geo_to_cell(p, 6), count(*), sum(v), min(v), max(v) from bin_points group by 1)
+    union all
+    (select h3_geo_to_cell(p, 6), count(*), sum(v), min(v), max(v) from bin_points group by 1
+        except all select (b).* from unnest((select h3_bin(p, 6, v) from bin_points)) b)
+) d;
+
+select sum((b).count), bool_and((b).sum is null) no_values
+from unnest((select h3_bin(p, 6) from bin_points)) b;
@@ -10,3 +10,86 @@ select h3_hexagon_area_m2(4);
 select h3_edge_length_km(4);
 
 select h3_edge_length_m(4);
+
+/* the geometry cache */
+
+select h3_geometry_cache_reset();
+
+-- the second lookup is answered by the last value of the function,
+-- the fourth by the cache
+select count(_h3_h3index_to_geoboundary(c)) from (values ('89283470c27ffff'::h3index), ('89283470c27ffff'), ('89283470c23ffff'), ('89283470c27ffff')) v(c);
+
+select entries, hits, misses from h3_geometry_cache_stats();
+
+-- the centroids are cached in the same entries
+select count(_h3_h3index_to_geo(c)) from (values ('89283470c27ffff'::h3index), ('89283470c27ffff'), ('89283470c23ffff'), ('89283470c27ffff')) v(c);
+
+select entries, hits, misses from h3_geometry_cache_stats();
+
+-- reducing the size evicts the least recently used cells at once
+set pgh3.geometry_cache_size = 1;
+
+select entries, capacity from h3_geometry_cache_stats();
+
+select count(_h3_h3index_to_geoboundary(c)) from (values ('89283470c27ffff'::h3index), ('89283470c27ffff'), ('89283470c23ffff'), ('89283470c27ffff')) v(c);
+
+select entries, capacity from h3_geometry_cache_stats();
+
+reset pgh3.geometry_cache_size;
+
+-- the geometry functions keep their last value also when the cache is disabled
+select h3_geometry_cache_reset();
+
+set pgh3.geometry_cache_size = -1;
+
+set pgh3.geometry_cache_size = 0;
+
+select count(h3_h3index_to_geoboundary(c)), count(h3_h3index_to_geo(c)) from (values ('89283470c27ffff'::h3index), ('89283470c27ffff')) v(c);
+
+select entries, hits, misses from h3_geometry_cache_stats();
+
+reset pgh3.geometry_cache_size;
+
+/* planner estimates */
+
+create function pg_temp.plan_rows(query text) returns bigint as $$
+declare
+    plan json;
+begin
+    execute 'explain (format json) ' || query into plan;
+    return (plan->0->'Plan'->>'Plan Rows')::bigint;
+end $$ language plpgsql;
+
+select pg_temp.plan_rows($$select * from h3_to_children('85639c63fffffff'::h3index, 7)$$) hexagon,
+    pg_temp.plan_rows($$select * from h3_to_children('8009fffffffffff'::h3index, 2)$$) pentagon,
+    pg_temp.plan_rows($$select * from h3_to_children('85639c63fffffff', 7)$$) text;
+
+select pg_temp.plan_rows($$select * from h3_kring('85639c63fffffff'::h3index, 0)$$) kring_0,
+    pg_temp.plan_rows($$select * from h3_kring('85639c63fffffff'::h3index, 2)$$) kring_2,
+    pg_temp.plan_rows($$select * from h3_kring_distances('85639c63fffffff', 2)$$) distances_2,
+    pg_temp.plan_rows($$select * from h3_kring_distances('{85639c63fffffff,8009fffffffffff}'::h3index[], 1)$$) multi_1,
+    pg_temp.plan_rows($$select * from h3_hex_ring('85639c63fffffff'::h3index, 3)$$) ring_3;
+
+-- from the area of the bounding box, also across the antimeridian
+select pg_temp.plan_rows($$select * from h3_polyfill_cells('POLYGON((0 0,1 0,1 1,0 1,0 0))'::geometry, 5)$$) polyfill,
+    pg_temp.plan_rows($$select * from h3_polyfill('POLYGON((179.5 0,-179.5 0,-179.5 1,179.5 1,179.5 0))'::geometry, 5)$$) transmeridian;
+
+/* function statistics */
+
+-- only collected when pgh3 is loaded by shared_preload_libraries
+select * from pg_stat_pgh3 where false;
+
+select pg_stat_pgh3_reset();
+
+show pgh3.track;
+
+/* parallel safety */
+
+-- immutable C and SQL functions of the extension which can not run in parallel workers
+select p.proname
+from pg_proc p
+    join pg_language l on l.oid = p.prolang
+    join pg_depend d on d.classid = 'pg_proc'::regclass and d.objid = p.oid and d.deptype = 'e'
+    join pg_extension e on e.oid = d.refobjid and e.extname = 'pgh3'
+where l.lanname in ('c', 'sql') and p.provolatile = 'i' and p.proparallel <> 's'
+order by 1;
\ No newline at end of file
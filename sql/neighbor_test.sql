@@ -0,0 +1,64 @@
+create extension if not exists postgis;
+create extension if not exists pgh3;
+
+
+/* neighbor functions */
+
+select distance, count(*) from h3_kring_distances('89283470c27ffff'::h3index, 2) group by distance order by distance;
+
+-- a pentagon has five neighbors in the first ring
+select distance, count(*) from h3_kring_distances('85080003fffffff'::h3index, 2) group by distance order by distance;
+
+-- same cells as h3_kring. should return 0 rows.
+select h3index from h3_kring_distances('89283470c27ffff'::h3index, 3)
+except all
+select h3_kring('89283470c27ffff'::h3index, 3);
+
+-- the rings are generated lazily, the center comes first
+select * from h3_kring_distances('89283470c27ffff'::h3index, 200) limit 1;
+
+select count(*) from h3_hex_ring('89283470c27ffff'::h3index, 3);
+
+select count(*) from h3_hex_ring('85080003fffffff'::h3index, 2);
+
+-- the outermost ring of the disk. should return 0 rows.
+select h3_hex_ring('89283470c27ffff'::h3index, 3)
+except all
+select h3index from h3_kring_distances('89283470c27ffff'::h3index, 3) where distance = 3;
+
+select h3_hex_ring('89283470c27ffff'::h3index, 0);
+
+select count(*) from h3_kring('89283470c27ffff'::h3index, -1);
+
+/* neighborhood of a set of indexes */
+
+-- the disk around the first ring. should return 0 rows.
+select h3index, distance from h3_kring_distances(array(select h3_kring('89283470c27ffff'::h3index, 1)), 2)
+except all
+select h3index, greatest(distance - 1, 0) from h3_kring_distances('89283470c27ffff'::h3index, 3);
+
+select count(*) from h3_kring_distances(array(select h3_kring('89283470c27ffff'::h3index, 1)), 2);
+
+-- the minimum distance to any of the indexes. should return 0 rows.
+select h3index, min(distance) from (
+        select (h3_kring_distances(i, 4)).*
+        from unnest(array['89283470c27ffff', '89283470c67ffff', '89283470c23ffff']::h3index[]) i
+    ) d group by h3index
+except all
+select h3index, distance from h3_kring_distances(array['89283470c27ffff', '89283470c67ffff', '89283470c23ffff']::h3index[], 4);
+
+-- duplicates are ignored
+select distance, count(*) from h3_kring_distances(array['89283470c27ffff', '89283470c27ffff']::h3index[], 1) group by distance order by distance;
+
+select count(*) from h3_kring_distances(array[]::h3index[], 2);
+
+select count(*) from h3_kring_distances(array['89283470c27ffff', '85080003fffffff']::h3index[], 2);
+
+/* array variants */
+
+select array_length(h3_kring_array('89283470c27ffff'::h3index, 2), 1);
+
+-- same order as the set-returning function
+select h3_kring_array('89283470c27ffff'::h3index, 2) = array(select h3_kring('89283470c27ffff'::h3index, 2));
+
+select array_length(h3_hex_ring_array('85080003fffffff'::h3index, 2), 1);
@@ -2,98 +2,645 @@
 
 CREATE FUNCTION h3_ext_version() RETURNS text
 AS 'pgh3', 'h3_ext_version'
-IMMUTABLE LANGUAGE C STRICT;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
 comment on function h3_ext_version() is 'Returns the version number of the H3 extension. This is not the version number of the h3 library itself.';
 
 
+/******* the h3index type *********************************/
+
+create type h3index;
+
+create function h3index_in(cstring) returns h3index
+as 'pgh3', 'h3index_in'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_out(h3index) returns cstring
+as 'pgh3', 'h3index_out'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_recv(internal) returns h3index
+as 'pgh3', 'h3index_recv'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_send(h3index) returns bytea
+as 'pgh3', 'h3index_send'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create type h3index (
+    input = h3index_in,
+    output = h3index_out,
+    receive = h3index_recv,
+    send = h3index_send,
+    internallength = 8,
+    passedbyvalue,
+    alignment = double
+);
+comment on type h3index is 'A H3 index stored in its native 64bit form. The text representation is the hexadecimal string used by H3.';
+
+create function h3index_to_text(h3index) returns text
+as 'pgh3', 'h3index_to_text'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_from_text(text) returns h3index
+as 'pgh3', 'h3index_from_text'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_from_bigint(bigint) returns h3index
+as 'pgh3', 'h3index_from_bigint'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create cast (h3index as text) with function h3index_to_text(h3index) as assignment;
+create cast (text as h3index) with function h3index_from_text(text) as assignment;
+create cast (h3index as bigint) without function;
+create cast (bigint as h3index) with function h3index_from_bigint(bigint);
+
+
+/******* operators and operator classes *********************************/
+
+create function h3index_eq(h3index, h3index) returns boolean
+as 'pgh3', 'h3index_eq'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_ne(h3index, h3index) returns boolean
+as 'pgh3', 'h3index_ne'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_lt(h3index, h3index) returns boolean
+as 'pgh3', 'h3index_lt'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_le(h3index, h3index) returns boolean
+as 'pgh3', 'h3index_le'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_gt(h3index, h3index) returns boolean
+as 'pgh3', 'h3index_gt'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_ge(h3index, h3index) returns boolean
+as 'pgh3', 'h3index_ge'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_cmp(h3index, h3index) returns integer
+as 'pgh3', 'h3index_cmp'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_sortsupport(internal) returns void
+as 'pgh3', 'h3index_sortsupport'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_hash(h3index) returns integer
+as 'pgh3', 'h3index_hash'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_hash_extended(h3index, bigint) returns bigint
+as 'pgh3', 'h3index_hash_extended'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create operator = (
+    leftarg = h3index, rightarg = h3index, procedure = h3index_eq,
+    commutator = =, negator = <>,
+    restrict = eqsel, join = eqjoinsel,
+    hashes, merges
+);
+
+create operator <> (
+    leftarg = h3index, rightarg = h3index, procedure = h3index_ne,
+    commutator = <>, negator = =,
+    restrict = neqsel, join = neqjoinsel
+);
+
+create operator < (
+    leftarg = h3index, rightarg = h3index, procedure = h3index_lt,
+    commutator = >, negator = >=,
+    restrict = scalarltsel, join = scalarltjoinsel
+);
+
+create operator <= (
+    leftarg = h3index, rightarg = h3index, procedure = h3index_le,
+    commutator = >=, negator = >,
+    restrict = scalarlesel, join = scalarlejoinsel
+);
+
+create operator > (
+    leftarg = h3index, rightarg = h3index, procedure = h3index_gt,
+    commutator = <, negator = <=,
+    restrict = scalargtsel, join = scalargtjoinsel
+);
+
+create operator >= (
+    leftarg = h3index, rightarg = h3index, procedure = h3index_ge,
+    commutator = <=, negator = <,
+    restrict = scalargesel, join = scalargejoinsel
+);
+
+-- The sort order ignores the resolution of the indexes, so the descendants
+-- of a cell are sorted directly before the cell itself.
+create operator class h3index_ops
+default for type h3index using btree as
+    operator 1 <,
+    operator 2 <=,
+    operator 3 =,
+    operator 4 >=,
+    operator 5 >,
+    function 1 h3index_cmp(h3index, h3index),
+    function 2 h3index_sortsupport(internal);
+
+create operator class h3index_ops
+default for type h3index using hash as
+    operator 1 =,
+    function 1 h3index_hash(h3index),
+    function 2 h3index_hash_extended(h3index, bigint);
+
+
+create function h3index_contains(h3index, h3index) returns boolean
+as 'pgh3', 'h3index_contains'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3index_contains(h3index, h3index) is 'Check if the second index is the first index or one of its descendants.';
+
+create function h3index_contained_by(h3index, h3index) returns boolean
+as 'pgh3', 'h3index_contained_by'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3index_contained_by(h3index, h3index) is 'Check if the first index is the second index or one of its descendants.';
+
+create function h3index_descendants_lower_bound(h3index) returns h3index
+as 'pgh3', 'h3index_descendants_lower_bound'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3index_descendants_lower_bound(h3index) is
+    'The smallest value in the btree order which may be a descendant of the index. The index and its descendants are sorted between this value and the index itself.';
+
+create function h3index_overlaps_box(h3index, box) returns boolean
+as 'pgh3', 'h3index_overlaps_box'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3index_overlaps_box(h3index, box) is 'Check if the boundary of the index overlaps the box. The coordinates of the box are in degrees.';
+
+create function box_overlaps_h3index(box, h3index) returns boolean
+as 'pgh3', 'box_overlaps_h3index'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function box_overlaps_h3index(box, h3index) is 'Check if the boundary of the index overlaps the box. The coordinates of the box are in degrees.';
+
+create operator @> (
+    leftarg = h3index, rightarg = h3index, procedure = h3index_contains,
+    commutator = <@,
+    restrict = contsel, join = contjoinsel
+);
+
+create operator <@ (
+    leftarg = h3index, rightarg = h3index, procedure = h3index_contained_by,
+    commutator = @>,
+    restrict = contsel, join = contjoinsel
+);
+
+create operator && (
+    leftarg = h3index, rightarg = box, procedure = h3index_overlaps_box,
+    commutator = &&,
+    restrict = areasel, join = areajoinsel
+);
+
+create operator && (
+    leftarg = box, rightarg = h3index, procedure = box_overlaps_h3index,
+    commutator = &&,
+    restrict = areasel, join = areajoinsel
+);
+
+create function h3index_spgist_config(internal, internal) returns void
+as 'pgh3', 'h3index_spgist_config'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_spgist_choose(internal, internal) returns void
+as 'pgh3', 'h3index_spgist_choose'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_spgist_picksplit(internal, internal) returns void
+as 'pgh3', 'h3index_spgist_picksplit'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_spgist_inner_consistent(internal, internal) returns void
+as 'pgh3', 'h3index_spgist_inner_consistent'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_spgist_leaf_consistent(internal, internal) returns boolean
+as 'pgh3', 'h3index_spgist_leaf_consistent'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+-- A trie following the H3 hierarchy: base cell, then one level per resolution.
+-- Supports equality, containment in both directions and overlaps with boxes.
+create operator class h3index_spgist_ops
+default for type h3index using spgist as
+    operator 3 && (h3index, box),
+    operator 6 = (h3index, h3index),
+    operator 7 @> (h3index, h3index),
+    operator 8 <@ (h3index, h3index),
+    function 1 h3index_spgist_config(internal, internal),
+    function 2 h3index_spgist_choose(internal, internal),
+    function 3 h3index_spgist_picksplit(internal, internal),
+    function 4 h3index_spgist_inner_consistent(internal, internal),
+    function 5 h3index_spgist_leaf_consistent(internal, internal);
+
+
+create function h3index_brin_opcinfo(internal) returns internal
+as 'pgh3', 'h3index_brin_opcinfo'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_brin_add_value(internal, internal, internal, internal) returns boolean
+as 'pgh3', 'h3index_brin_add_value'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_brin_consistent(internal, internal, internal) returns boolean
+as 'pgh3', 'h3index_brin_consistent'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3index_brin_union(internal, internal, internal) returns boolean
+as 'pgh3', 'h3index_brin_union'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+-- Summarizes block ranges by their minimum and maximum in the order of the btree
+-- operator class. As descendants are sorted directly before their ancestors, this
+-- also supports the containment operators.
+create operator class h3index_minmax_ops
+default for type h3index using brin as
+    operator 1 < (h3index, h3index),
+    operator 2 <= (h3index, h3index),
+    operator 3 = (h3index, h3index),
+    operator 4 >= (h3index, h3index),
+    operator 5 > (h3index, h3index),
+    operator 7 @> (h3index, h3index),
+    operator 8 <@ (h3index, h3index),
+    function 1 h3index_brin_opcinfo(internal),
+    function 2 h3index_brin_add_value(internal, internal, internal, internal),
+    function 3 h3index_brin_consistent(internal, internal, internal),
+    function 4 h3index_brin_union(internal, internal, internal);
+
+
+
+/******* the h3set type *********************************/
+
+create type h3set;
+
+create function h3set_in(cstring) returns h3set
+as 'pgh3', 'h3set_in'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3set_out(h3set) returns cstring
+as 'pgh3', 'h3set_out'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3set_recv(internal) returns h3set
+as 'pgh3', 'h3set_recv'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3set_send(h3set) returns bytea
+as 'pgh3', 'h3set_send'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create type h3set (
+    input = h3set_in,
+    output = h3set_out,
+    receive = h3set_recv,
+    send = h3set_send,
+    internallength = variable,
+    alignment = double,
+    -- the cells are stored delta encoded already. without compression
+    -- parts of values stored out of line can be read without detoasting
+    -- the complete value.
+    storage = external
+);
+comment on type h3set is 'A set of H3 cells stored in its compacted and delta encoded form. A set containing a cell contains all of its descendants.';
+
+create function h3set_from_array(h3index[]) returns h3set
+as 'pgh3', 'h3set_from_array'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_from_array(h3index[]) is 'Create a set of the given indexes. The indexes may have different resolutions.';
+
+create function h3set_to_array(h3set) returns h3index[]
+as 'pgh3', 'h3set_to_array'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_to_array(h3set) is 'The compacted cells of the set.';
+
+create cast (h3index[] as h3set) with function h3set_from_array(h3index[]);
+create cast (h3set as h3index[]) with function h3set_to_array(h3set);
+
+create function h3set_num_cells(h3set) returns bigint
+as 'pgh3', 'h3set_num_cells'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_num_cells(h3set) is 'The number of compacted cells stored in the set.';
+
+create function h3set_cells(h3set) returns setof h3index
+as 'pgh3', 'h3set_cells'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_cells(h3set) is 'The compacted cells of the set, decoded as they are returned.';
+
+create function h3set_union(h3set, h3set) returns h3set
+as 'pgh3', 'h3set_union'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_union(h3set, h3set) is 'The cells contained in any of the two sets.';
+
+create function h3set_intersection(h3set, h3set) returns h3set
+as 'pgh3', 'h3set_intersection'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_intersection(h3set, h3set) is 'The cells contained in both sets.';
+
+create function h3set_difference(h3set, h3set) returns h3set
+as 'pgh3', 'h3set_difference'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_difference(h3set, h3set) is 'The cells of the first set not contained in the second set. Cells are split into their descendants where only parts of them are removed.';
+
+create function h3set_contains_index(h3set, h3index) returns boolean
+as 'pgh3', 'h3set_contains_index'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_contains_index(h3set, h3index) is 'Check if the index is a cell of the set or a descendant of one.';
+
+create function h3index_contained_by_set(h3index, h3set) returns boolean
+as 'pgh3', 'h3index_contained_by_set'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3index_contained_by_set(h3index, h3set) is 'Check if the index is a cell of the set or a descendant of one.';
+
+create function h3set_contains(h3set, h3set) returns boolean
+as 'pgh3', 'h3set_contains'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_contains(h3set, h3set) is 'Check if the first set contains all cells of the second set.';
+
+create function h3set_contained_by(h3set, h3set) returns boolean
+as 'pgh3', 'h3set_contained_by'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_contained_by(h3set, h3set) is 'Check if the second set contains all cells of the first set.';
+
+create function h3set_overlaps(h3set, h3set) returns boolean
+as 'pgh3', 'h3set_overlaps'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3set_overlaps(h3set, h3set) is 'Check if the sets have cells in common.';
+
+create function h3set_eq(h3set, h3set) returns boolean
+as 'pgh3', 'h3set_eq'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3set_ne(h3set, h3set) returns boolean
+as 'pgh3', 'h3set_ne'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create operator | (
+    leftarg = h3set, rightarg = h3set, procedure = h3set_union,
+    commutator = |
+);
+
+create operator & (
+    leftarg = h3set, rightarg = h3set, procedure = h3set_intersection,
+    commutator = &
+);
+
+create operator - (
+    leftarg = h3set, rightarg = h3set, procedure = h3set_difference
+);
+
+create operator @> (
+    leftarg = h3set, rightarg = h3index, procedure = h3set_contains_index,
+    commutator = <@,
+    restrict = contsel, join = contjoinsel
+);
+
+create operator <@ (
+    leftarg = h3index, rightarg = h3set, procedure = h3index_contained_by_set,
+    commutator = @>,
+    restrict = contsel, join = contjoinsel
+);
+
+create operator @> (
+    leftarg = h3set, rightarg = h3set, procedure = h3set_contains,
+    commutator = <@,
+    restrict = contsel, join = contjoinsel
+);
+
+create operator <@ (
+    leftarg = h3set, rightarg = h3set, procedure = h3set_contained_by,
+    commutator = @>,
+    restrict = contsel, join = contjoinsel
+);
+
+create operator && (
+    leftarg = h3set, rightarg = h3set, procedure = h3set_overlaps,
+    commutator = &&,
+    restrict = areasel, join = areajoinsel
+);
+
+create operator = (
+    leftarg = h3set, rightarg = h3set, procedure = h3set_eq,
+    commutator = =, negator = <>,
+    restrict = eqsel, join = eqjoinsel
+);
+
+create operator <> (
+    leftarg = h3set, rightarg = h3set, procedure = h3set_ne,
+    commutator = <>, negator = =,
+    restrict = neqsel, join = neqjoinsel
+);
+
+
 /******* Indexing functions *********************************/
 
+CREATE FUNCTION h3_geo_to_cell(p point, resolution integer) RETURNS h3index
+AS 'pgh3', 'h3_geo_to_cell'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3_geo_to_cell(p point, integer) is 'Get the H3 index for the point at the given resolution.';
+
+CREATE FUNCTION _h3_geo_to_cell_wkb(wkb bytea, resolution integer) RETURNS h3index
+AS 'pgh3', '_h3_geo_to_cell_wkb'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function _h3_geo_to_cell_wkb(wkb bytea, integer) is 'Get the H3 index for the point given as WKB or EWKB at the given resolution.';
+
+create function h3_geo_to_cell(g geometry, resolution integer) returns h3index
+as $$ select _h3_geo_to_cell_wkb(st_asbinary(g), resolution) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT;
+comment on function h3_geo_to_cell(g geometry, integer) is 'Get the H3 index for the PostGIS point geometry at the given resolution.';
+
 CREATE FUNCTION h3_geo_to_h3index(p point, resolution integer) RETURNS text
-AS 'pgh3', 'h3_geo_to_h3index'
-IMMUTABLE LANGUAGE C STRICT;
-comment on function h3_geo_to_h3index(p point, integer) is 'Get the H3 index for the point at the given resolution.';
+AS $$ select h3_geo_to_cell(p, resolution)::text $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT;
+comment on function h3_geo_to_h3index(p point, integer) is 'Get the H3 index for the point at the given resolution. Returned in its text representation.';
 
-/*
-comment on function byteamagic_mime(bytea) is
-    'return the mimetype of the bytea data as text';
+create function h3_geo_to_h3index(g geometry, resolution integer) returns text
+as $$ select h3_geo_to_cell(g, resolution)::text $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT;
+comment on function h3_geo_to_h3index(g geometry, integer) is 'Get the H3 index for the PostGIS point geometry at the given resolution. Returned in its text representation.';
 
-*/
+CREATE FUNCTION h3_geo_to_cells(lon double precision[], lat double precision[], resolution integer) RETURNS h3index[]
+AS 'pgh3', 'h3_geo_to_cells_lonlat'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3_geo_to_cells(lon double precision[], lat double precision[], integer) is 'Get the H3 indexes for the coordinates given as arrays of longitudes and latitudes at the given resolution. NULL coordinates result in NULL indexes.';
 
-create function h3_geo_to_h3index(g geometry, resolution integer) returns text as $$
-begin
-    if st_geometrytype(g) != 'ST_Point' then
-        raise exception 'h3 only supports point geometries';
-    end if;
-    return h3_geo_to_h3index(g::point, resolution);
-end;
-$$ language plpgsql immutable strict;
-comment on function h3_geo_to_h3index(g geometry, integer) is 'Get the H3 index for the PostGIS point geometry at the given resolution.';
+CREATE FUNCTION h3_geo_to_cells(p point[], resolution integer) RETURNS h3index[]
+AS 'pgh3', 'h3_geo_to_cells_points'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3_geo_to_cells(p point[], integer) is 'Get the H3 indexes for the array of points at the given resolution. NULL points result in NULL indexes.';
 
+CREATE FUNCTION _h3_geo_to_cells_wkb(wkb bytea, resolution integer) RETURNS h3index[]
+AS 'pgh3', '_h3_geo_to_cells_wkb'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function _h3_geo_to_cells_wkb(wkb bytea, integer) is 'Get the H3 indexes for the points of the point or multipoint given as WKB or EWKB at the given resolution.';
 
-create function _h3_h3index_to_geo(h3index text) returns point
+create function h3_geo_to_cells(g geometry, resolution integer) returns h3index[]
+as $$ select _h3_geo_to_cells_wkb(st_asbinary(g), resolution) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT;
+comment on function h3_geo_to_cells(g geometry, integer) is 'Get the H3 indexes for the points of the PostGIS point or multipoint geometry at the given resolution. Empty points result in NULL indexes.';
+
+
+create function _h3_h3index_to_geo(h3index h3index) returns point
 as 'pgh3', '_h3_h3index_to_geo'
-IMMUTABLE LANGUAGE C STRICT ;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function _h3_h3index_to_geo(h3index h3index) is 'Convert a H3 index to coordinates. Returned as a postgresql point type.';
+
+create function _h3_h3index_to_geo(h3index text) returns point
+as $$ select _h3_h3index_to_geo(h3index::h3index) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
 comment on function _h3_h3index_to_geo(h3index text) is 'Convert a H3 index to coordinates. Returned as a postgresql point type.';
 
+create function _h3_h3index_to_geo_ewkb(h3index h3index) returns bytea
+as 'pgh3', '_h3_h3index_to_geo_ewkb'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function _h3_h3index_to_geo_ewkb(h3index h3index) is 'Convert a H3 index to coordinates. Returned as an EWKB point with the SRID 4326.';
+
+create function h3_h3index_to_geo(h3index h3index) returns geometry
+as $$ select st_geomfromewkb(_h3_h3index_to_geo_ewkb(h3index)) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
+comment on function h3_h3index_to_geo(h3index h3index) is 'Convert a H3 index to coordinates. Returned as a PostGIS point geometry with the SRID 4326.';
+
 create function h3_h3index_to_geo(h3index text) returns geometry
-as $$
-declare
-    g geometry;
-begin
-    select st_makepoint(p[0], p[1]) into g
-    from (
-        select _h3_h3index_to_geo(h3index) p
-    ) foo;
+as $$ select h3_h3index_to_geo(h3index::h3index) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
+comment on function h3_h3index_to_geo(h3index text) is 'Convert a H3 index to coordinates. Returned as a PostGIS point geometry with the SRID 4326.';
 
-    return g;
-end;
-$$ language plpgsql immutable strict;
-comment on function h3_h3index_to_geo(h3index text) is 'Convert a H3 index to coordinates. Returned as a PostGIS point geometry.';
 
 
+create function _h3_h3index_to_geoboundary(h3index h3index) returns polygon
+as 'pgh3', '_h3_h3index_to_geoboundary'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function _h3_h3index_to_geoboundary(h3index h3index) is 'Convert the boundary of H3 index to polygon coordinates. Returned as a postgresql native polygon type.';
 
 create function _h3_h3index_to_geoboundary(h3index text) returns polygon
-as 'pgh3', '_h3_h3index_to_geoboundary'
-IMMUTABLE LANGUAGE C STRICT ;
+as $$ select _h3_h3index_to_geoboundary(h3index::h3index) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
 comment on function _h3_h3index_to_geoboundary(h3index text) is 'Convert the boundary of H3 index to polygon coordinates. Returned as a postgresql native polygon type.';
 
+create function _h3_h3index_to_geoboundary_ewkb(h3index h3index) returns bytea
+as 'pgh3', '_h3_h3index_to_geoboundary_ewkb'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function _h3_h3index_to_geoboundary_ewkb(h3index h3index) is 'Convert the boundary of H3 index to polygon coordinates. Returned as an EWKB polygon with the SRID 4326.';
+
+create function h3_h3index_to_geoboundary(h3index h3index) returns geometry
+as $$ select st_geomfromewkb(_h3_h3index_to_geoboundary_ewkb(h3index)) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
+comment on function h3_h3index_to_geoboundary(h3index h3index) is 'Convert the boundary of H3 index to polygon coordinates. Returned as a PostGIS polygon geometry with the SRID 4326.';
+
 create function h3_h3index_to_geoboundary(h3index text) returns geometry
-as $$
-declare
-    g geometry;
-    point_geoms geometry[];
-begin
-    select _h3_h3index_to_geoboundary(h3index)::geometry into g;
+as $$ select h3_h3index_to_geoboundary(h3index::h3index) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
+comment on function h3_h3index_to_geoboundary(h3index text) is 'Convert the boundary of H3 index to polygon coordinates. Returned as a PostGIS polygon geometry with the SRID 4326.';
 
-    return g;
-end;
-$$ language plpgsql immutable strict;
-comment on function h3_h3index_to_geoboundary(h3index text) is 'Convert the boundary of H3 index to polygon coordinates. Returned as a PostGIS polygon geometry.';
+create function _h3_h3indexes_to_multipolygon_ewkb(h3indexes h3index[]) returns bytea
+as 'pgh3', '_h3_h3indexes_to_multipolygon_ewkb'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function _h3_h3indexes_to_multipolygon_ewkb(h3indexes h3index[]) is 'Convert the boundaries of an array of H3 indexes to a multipolygon with one polygon per index. Returned as EWKB with the SRID 4326.';
 
+create function h3_h3indexes_to_multipolygon(h3indexes h3index[]) returns geometry
+as $$ select st_geomfromewkb(_h3_h3indexes_to_multipolygon_ewkb(h3indexes)) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
+comment on function h3_h3indexes_to_multipolygon(h3indexes h3index[]) is 'Convert the boundaries of an array of H3 indexes to a PostGIS multipolygon geometry with the SRID 4326. Every index becomes one polygon, the cells are not merged.';
 
-create function h3_h3index_is_valid(h3index text) returns boolean
+create function h3_h3indexes_to_multipolygon(h3indexes text[]) returns geometry
+as $$ select h3_h3indexes_to_multipolygon(h3indexes::h3index[]) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
+comment on function h3_h3indexes_to_multipolygon(h3indexes text[]) is 'Convert the boundaries of an array of H3 indexes to a PostGIS multipolygon geometry with the SRID 4326. Every index becomes one polygon, the cells are not merged.';
+
+create function h3_geometry_cache_stats(out entries bigint, out capacity integer, out hits bigint, out misses bigint)
+as 'pgh3', 'h3_geometry_cache_stats'
+VOLATILE LANGUAGE C STRICT ;
+comment on function h3_geometry_cache_stats() is
+    'Statistics of the cache of the centroids and boundaries of indexes of the current session.';
+
+create function h3_geometry_cache_reset() returns void
+as 'pgh3', 'h3_geometry_cache_reset'
+VOLATILE LANGUAGE C STRICT ;
+comment on function h3_geometry_cache_reset() is
+    'Empty the cache of the centroids and boundaries of indexes of the current session and reset its statistics.';
+
+create function pg_stat_pgh3(out funcname text, out calls bigint, out rows bigint, out total_time double precision,
+        out peak_alloc_bytes bigint, out estimated_cells bigint, out generated_cells bigint, out stats_reset timestamptz)
+returns setof record
+as 'pgh3', 'pg_stat_pgh3'
+VOLATILE LANGUAGE C STRICT rows 8 ;
+comment on function pg_stat_pgh3() is
+    'Statistics of the calls of the functions of pgh3 in all sessions. Empty unless pgh3 is loaded by shared_preload_libraries.';
+
+create function pg_stat_pgh3_reset() returns void
+as 'pgh3', 'pg_stat_pgh3_reset'
+VOLATILE LANGUAGE C STRICT ;
+comment on function pg_stat_pgh3_reset() is
+    'Reset the statistics shown by pg_stat_pgh3 for all sessions.';
+revoke all on function pg_stat_pgh3_reset() from public;
+
+create view pg_stat_pgh3 as
+select funcname, calls, rows, total_time,
+    total_time / nullif(calls, 0) mean_time,
+    peak_alloc_bytes, estimated_cells, generated_cells,
+    generated_cells::double precision / nullif(estimated_cells, 0) estimate_ratio,
+    stats_reset
+from pg_stat_pgh3();
+comment on view pg_stat_pgh3 is
+    'Calls, returned rows and execution time in milliseconds of the functions of pgh3, the largest polyfill allocation and the accuracy of the polyfill estimates of H3.';
+
+
+create function h3_h3index_is_valid(h3index h3index) returns boolean
 as 'pgh3', 'h3_h3index_is_valid'
-IMMUTABLE LANGUAGE C STRICT ;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function h3_h3index_is_valid(h3index h3index) is 'Check if a H3 index is valid.';
+
+create function h3_h3index_is_valid(h3index text) returns boolean
+as $$ select h3_h3index_is_valid(h3index::h3index) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
 comment on function h3_h3index_is_valid(h3index text) is 'Check if a H3 index is valid.';
 
-create function h3_get_resolution(h3index text) returns integer
+create function h3_get_resolution(h3index h3index) returns integer
 as 'pgh3', 'h3_get_resolution'
-IMMUTABLE LANGUAGE C STRICT ;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function h3_get_resolution(h3index h3index) is 'Get the resolution for a H3 index.';
+
+create function h3_get_resolution(h3index text) returns integer
+as $$ select h3_get_resolution(h3index::h3index) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
 comment on function h3_get_resolution(h3index text) is 'Get the resolution for a H3 index.';
 
-create function h3_get_basecell(h3index text) returns integer
+create function h3_get_basecell(h3index h3index) returns integer
 as 'pgh3', 'h3_get_basecell'
-IMMUTABLE LANGUAGE C STRICT ;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function h3_get_basecell(h3index h3index) is 'Get the base cell for a H3 index.';
+
+create function h3_get_basecell(h3index text) returns integer
+as $$ select h3_get_basecell(h3index::h3index) $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
 comment on function h3_get_basecell(h3index text) is 'Get the base cell for a H3 index.';
 
 -- this syntax requires postgresql >= 9. To support earlier versions a
 -- temporary function instead of the block would be needed
 do $$
 begin
+    create function h3_get_res0_cells() returns setof h3index
+    as 'pgh3', 'h3_get_res0_cells'
+    immutable parallel safe language c strict rows 122 ;
+    comment on function h3_get_res0_cells() is 'Returns all base cells.';
+
     create function h3_get_basecells() returns setof text
-    as 'pgh3', 'h3_get_basecells'
-    immutable language c strict ;
-    comment on function h3_get_basecells() is 'Returns all base cells.';
+    as $f$ select h3_get_res0_cells()::text $f$
+    immutable parallel safe language sql ;
+    comment on function h3_get_basecells() is 'Returns all base cells. Returned in their text representation.';
+
+    create function h3_get_res0_cells_array() returns h3index[]
+    as 'pgh3', 'h3_get_res0_cells_array'
+    immutable parallel safe language c strict ;
+    comment on function h3_get_res0_cells_array() is 'Returns all base cells as an array.';
+
+    create function h3_get_basecells_array() returns text[]
+    as $f$ select h3_get_res0_cells_array()::text[] $f$
+    immutable parallel safe language sql strict ;
+    comment on function h3_get_basecells_array() is 'Returns all base cells as an array. Returned in their text representation.';
 exception when undefined_function then
     -- ignore. pgh3 is compiled without this function.
     raise notice 'h3_get_basecells is not supported';
@@ -103,157 +650,466 @@ end $$;
 /******* hierarchy functions *********************************/
 
 
-create function h3_to_parent(h3index text, resolution integer) returns text
+create function h3_to_parent(h3index h3index, resolution integer) returns h3index
 as 'pgh3', 'h3_to_parent'
-IMMUTABLE LANGUAGE C STRICT ;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function h3_to_parent(h3index h3index, resolution integer) is 'Returns the parent (coarser) index containing the given index.';
+
+create function h3_to_parent(h3index text, resolution integer) returns text
+as $$ select h3_to_parent(h3index::h3index, resolution)::text $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
 comment on function h3_to_parent(h3index text, resolution integer) is 'Returns the parent (coarser) index containing the given index.';
 
-create function h3_to_children(h3index text, resolution integer) returns setof text
+create function h3_to_children(h3index h3index, resolution integer) returns setof h3index
 as 'pgh3', 'h3_to_children'
-immutable language c strict ;
+immutable parallel safe language c strict ;
+comment on function h3_to_children(h3index h3index, resolution integer) is 'Returns the children (finer) indexes contained the given index.';
+
+create function h3_to_children(h3index text, resolution integer) returns setof text
+as $$ select h3_to_children(h3index::h3index, resolution)::text $$
+immutable parallel safe language sql ;
 comment on function h3_to_children(h3index text, resolution integer) is 'Returns the children (finer) indexes contained the given index.';
 
+create function h3_to_children_array(h3index h3index, resolution integer) returns h3index[]
+as 'pgh3', 'h3_to_children_array'
+immutable parallel safe language c strict ;
+comment on function h3_to_children_array(h3index h3index, resolution integer) is 'Returns the children (finer) indexes contained the given index as an array.';
+
+create function h3_to_children_array(h3index text, resolution integer) returns text[]
+as $$ select h3_to_children_array(h3index::h3index, resolution)::text[] $$
+immutable parallel safe language sql strict ;
+comment on function h3_to_children_array(h3index text, resolution integer) is 'Returns the children (finer) indexes contained the given index as an array.';
+
 /******* neighbor functions *********************************/
 
-create function h3_kring(h3index text, distance integer) returns setof text
+create function h3_kring(h3index h3index, distance integer) returns setof h3index
 as 'pgh3', 'h3_kring'
-IMMUTABLE LANGUAGE C STRICT ;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function h3_kring(h3index h3index, distance integer) is 'Returns the neighbor indices within the given distance.';
+
+create function h3_kring(h3index text, distance integer) returns setof text
+as $$ select h3_kring(h3index::h3index, distance)::text $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL ;
 comment on function h3_kring(h3index text, distance integer) is 'Returns the neighbor indices within the given distance.';
 
+create function h3_kring_array(h3index h3index, distance integer) returns h3index[]
+as 'pgh3', 'h3_kring_array'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function h3_kring_array(h3index h3index, distance integer) is 'Returns the neighbor indices within the given distance as an array.';
+
+create function h3_kring_array(h3index text, distance integer) returns text[]
+as $$ select h3_kring_array(h3index::h3index, distance)::text[] $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
+comment on function h3_kring_array(h3index text, distance integer) is 'Returns the neighbor indices within the given distance as an array.';
+
+create function h3_kring_distances(h3index h3index, distance integer) returns table (h3index h3index, distance integer)
+as 'pgh3', 'h3_kring_distances'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function h3_kring_distances(h3index h3index, distance integer) is
+    'Returns the neighbor indices within the given distance together with their distance, ring by ring.';
+
+create function h3_kring_distances(h3index text, distance integer) returns table (h3index text, distance integer)
+as $$ select k.h3index::text, k.distance from h3_kring_distances(h3index::h3index, distance) k $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL ;
+comment on function h3_kring_distances(h3index text, distance integer) is
+    'Returns the neighbor indices within the given distance together with their distance, ring by ring.';
+
+create function h3_kring_distances(h3indexes h3index[], distance integer) returns table (h3index h3index, distance integer)
+as 'pgh3', 'h3_kring_distances_multi'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function h3_kring_distances(h3indexes h3index[], distance integer) is
+    'Returns the union of the neighbor indices within the given distance of all given indexes together with their minimum distance to these, ring by ring.';
+
+create function h3_kring_distances(h3indexes text[], distance integer) returns table (h3index text, distance integer)
+as $$ select k.h3index::text, k.distance from h3_kring_distances(h3indexes::h3index[], distance) k $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL ;
+comment on function h3_kring_distances(h3indexes text[], distance integer) is
+    'Returns the union of the neighbor indices within the given distance of all given indexes together with their minimum distance to these, ring by ring.';
+
+create function h3_hex_ring(h3index h3index, distance integer) returns setof h3index
+as 'pgh3', 'h3_hex_ring'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function h3_hex_ring(h3index h3index, distance integer) is 'Returns the neighbor indices at exactly the given distance.';
+
+create function h3_hex_ring(h3index text, distance integer) returns setof text
+as $$ select h3_hex_ring(h3index::h3index, distance)::text $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL ;
+comment on function h3_hex_ring(h3index text, distance integer) is 'Returns the neighbor indices at exactly the given distance.';
+
+create function h3_hex_ring_array(h3index h3index, distance integer) returns h3index[]
+as 'pgh3', 'h3_hex_ring_array'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
+comment on function h3_hex_ring_array(h3index h3index, distance integer) is 'Returns the neighbor indices at exactly the given distance as an array.';
+
+create function h3_hex_ring_array(h3index text, distance integer) returns text[]
+as $$ select h3_hex_ring_array(h3index::h3index, distance)::text[] $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT ;
+comment on function h3_hex_ring_array(h3index text, distance integer) is 'Returns the neighbor indices at exactly the given distance as an array.';
+
 /******* misc functions *********************************/
 
 create function h3_hexagon_area_km2(resolution integer) returns double precision
 as 'pgh3', 'h3_hexagon_area_km2'
-IMMUTABLE LANGUAGE C STRICT ;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
 comment on function h3_hexagon_area_km2(resolution integer) is 'Average hexagon area in square kilometers at the given resolution.';
 
 create function h3_hexagon_area_m2(resolution integer) returns double precision
 as 'pgh3', 'h3_hexagon_area_m2'
-IMMUTABLE LANGUAGE C STRICT ;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
 comment on function h3_hexagon_area_m2(resolution integer) is 'Average hexagon area in square meters at the given resolution.';
 
 create function h3_edge_length_km(resolution integer) returns double precision
 as 'pgh3', 'h3_edge_length_km'
-IMMUTABLE LANGUAGE C STRICT ;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
 comment on function h3_edge_length_km(resolution integer) is 'Average hexagon edge length in kilometers at the given resolution.';
 
 create function h3_edge_length_m(resolution integer) returns double precision
 as 'pgh3', 'h3_edge_length_m'
-IMMUTABLE LANGUAGE C STRICT ;
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT ;
 comment on function h3_edge_length_m(resolution integer) is 'Average hexagon edge length in meters at the given resolution.';
 
 /******* region functions *********************************/
 
+CREATE FUNCTION _h3_polyfill_polygon_cells_c(exterior_ring polygon, interior_rings polygon[],
+                            resolution integer) RETURNS SETOF h3index
+AS 'pgh3', '_h3_polyfill_polygon'
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+comment on function _h3_polyfill_polygon_cells_c(exterior_ring polygon, interior_rings polygon[], resolution integer) is
+    'Fills the given exterior ring with hexagons at the given resolution. The interior_ring polygons are understood as holes and will be omitted.';
+
 CREATE FUNCTION _h3_polyfill_polygon_c(exterior_ring polygon, interior_rings polygon[],  
                             resolution integer) RETURNS SETOF text
-AS 'pgh3', '_h3_polyfill_polygon'
-IMMUTABLE LANGUAGE C;
+AS $$ select _h3_polyfill_polygon_cells_c(exterior_ring, interior_rings, resolution)::text $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL;
 comment on function _h3_polyfill_polygon_c(exterior_ring polygon, interior_rings polygon[], resolution integer) is
     'Fills the given exterior ring with hexagons at the given resolution. The interior_ring polygons are understood as holes and will be omitted.';
 
 
-create function h3_polyfill(geom geometry, resolution integer) returns setof text as $$
-begin
+CREATE FUNCTION _h3_polyfill_wkb_cells_c(wkb bytea, resolution integer) RETURNS SETOF h3index
+AS 'pgh3', '_h3_polyfill_wkb'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function _h3_polyfill_wkb_cells_c(wkb bytea, resolution integer) is
+    'Fills the polygon or multipolygon given as WKB or EWKB with hexagons at the given resolution. Holes in the polygons will be omitted.';
 
-    return query select _h3_polyfill_polygon_c(exterior_ring, interior_rings, resolution)
-    from (
-        select 
-            st_makepolygon(st_exteriorring(g))::polygon exterior_ring,
-            (select array_agg(st_makepolygon(st_interiorringn(g, i))::polygon) rings
-                from (
-                    select generate_series(0, st_numinteriorrings(g)) i
-                ) gs
-                where gs.i > 0 -- index starts with 1 
-            ) interior_rings
-        from (
-            select geom g
-                where st_geometrytype(geom) = 'ST_Polygon'
-            union select g
-                from (
-                    select (st_dump(geom)).geom as g 
-                    where st_geometrytype(geom) = 'ST_MultiPolygon'
-                ) d
-        ) polys
-        group by g
-    ) pg_polys;
-
-    return;
-end;
-$$ language plpgsql immutable strict;
+create function h3_polyfill_cells(geom geometry, resolution integer) returns setof h3index
+as $$ select _h3_polyfill_wkb_cells_c(st_asbinary(geom), resolution) $$
+language sql immutable parallel safe;
+comment on function h3_polyfill_cells(polygong geometry, resolution integer) is
+    'Fills the given PostGIS polygon or multipolygon with hexagons at the given resolution. Holes in the polygon will be omitted.
+
+See `h3_polyfill` for the memory requirements of this function.
+';
+
+create function h3_polyfill(geom geometry, resolution integer) returns setof text
+as $$ select _h3_polyfill_wkb_cells_c(st_asbinary(geom), resolution)::text $$
+language sql immutable parallel safe;
 comment on function h3_polyfill(polygong geometry, resolution integer) is 
     'Fills the given PostGIS polygon or multipolygon with hexagons at the given resolution. Holes in the polygon will be omitted.
 
-The H3 `polyfill` function requires a preallocation of the memory for the generates indexes. Depending on the size of the
-given polygon, its shape and resolution this may exhaust the memory given to this extension. In this case
-this function will be terminated by the database server and a corresponding notice will be given.
+Polygons for which more hexagons than `pgh3.polyfill_tile_threshold` (default 1048576) are estimated are filled
+tile by tile: the polygon is clipped to the cells four resolutions coarser than the requested resolution and the
+hexagons of each tile are returned as soon as the tile is done. The memory required is bounded by the size of a tile,
+so polygons of the size of countries can be filled at fine resolutions. Only the order of the hexagons differs from
+filling the whole polygon at once.
 
-The memory limit can be increased using the `pgh3.polyfill_mem` configuration parameter in the `postgresql.conf` file. The 
-default value for this setting 1024MB (PostgreSQL internal `MaxAllocSize`). Syntax for the setting is
+Smaller polygons and polygons crossing the antimeridian are filled at once, which requires a preallocation of the
+memory for the estimated number of hexagons. This allocation is limited by the `pgh3.polyfill_mem` configuration
+parameter, 1024MB by default.
+';
 
-    pgh3.polyfill_mem = 1024MB
+CREATE FUNCTION _h3_polyfill_wkb_cells_array_c(wkb bytea, resolution integer) RETURNS h3index[]
+AS 'pgh3', '_h3_polyfill_wkb_array'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function _h3_polyfill_wkb_cells_array_c(wkb bytea, resolution integer) is
+    'Fills the polygon or multipolygon given as WKB or EWKB with hexagons at the given resolution, returning an array.';
 
-For values larger than `MaxAllocSize`, the PostgreSQL `MemoryContextAllocHuge` allocator will be used.
+create function h3_polyfill_cells_array(geom geometry, resolution integer) returns h3index[]
+as $$ select _h3_polyfill_wkb_cells_array_c(st_asbinary(geom), resolution) $$
+language sql immutable parallel safe strict;
+comment on function h3_polyfill_cells_array(geom geometry, resolution integer) is
+    'Fills the given PostGIS polygon or multipolygon with hexagons at the given resolution, returning an array. Holes in the polygon will be omitted.';
 
-_This setting is only available when using a PostgreSQL version >= 10_. On earlier versions the memory limit is set to 1024MB.
+create function h3_polyfill_array(geom geometry, resolution integer) returns text[]
+as $$ select h3_polyfill_cells_array(geom, resolution)::text[] $$
+language sql immutable parallel safe strict;
+comment on function h3_polyfill_array(geom geometry, resolution integer) is
+    'Fills the given PostGIS polygon or multipolygon with hexagons at the given resolution, returning an array. Holes in the polygon will be omitted.';
 
-If this does not resolve the issue, there is essentially one way to work around this issue: Cut the polygon into segments and run this function to each of them seperately. The PostGIS functions `ST_Subdivide`, `ST_Split` and `ST_Segmentize` may be helpful.
-';
+
+CREATE FUNCTION _h3_polyfill_compact_wkb_cells_c(wkb bytea, resolution integer) RETURNS SETOF h3index
+AS 'pgh3', '_h3_polyfill_compact_wkb'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function _h3_polyfill_compact_wkb_cells_c(wkb bytea, resolution integer) is
+    'Fills the polygon or multipolygon given as WKB or EWKB with hexagons at the given resolution and returns them compacted.';
+
+CREATE FUNCTION _h3_polyfill_compact_wkb_cells_array_c(wkb bytea, resolution integer) RETURNS h3index[]
+AS 'pgh3', '_h3_polyfill_compact_wkb_array'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function _h3_polyfill_compact_wkb_cells_array_c(wkb bytea, resolution integer) is
+    'Fills the polygon or multipolygon given as WKB or EWKB with hexagons at the given resolution and returns them compacted as an array.';
+
+create function h3_polyfill_compact(geom geometry, resolution integer) returns setof h3index
+as $$ select _h3_polyfill_compact_wkb_cells_c(st_asbinary(geom), resolution) $$
+language sql immutable parallel safe strict;
+comment on function h3_polyfill_compact(geom geometry, resolution integer) is
+    'Fills the given PostGIS polygon or multipolygon with hexagons at the given resolution and returns them compacted,
+the same cells as h3_compact(array(select h3_polyfill_cells(geom, resolution))).
+
+Cells covered completely by the polygon are found at their own resolution, only the cells on the boundary of the polygon
+are refined to the given resolution. The memory and time required grow with the perimeter of the polygon instead of its area.';
+
+create function h3_polyfill_compact_array(geom geometry, resolution integer) returns h3index[]
+as $$ select _h3_polyfill_compact_wkb_cells_array_c(st_asbinary(geom), resolution) $$
+language sql immutable parallel safe strict;
+comment on function h3_polyfill_compact_array(geom geometry, resolution integer) is
+    'Fills the given PostGIS polygon or multipolygon with hexagons at the given resolution and returns them compacted as an array.';
+
+create function h3_mvt_tile(z integer, x integer, y integer, resolution integer,
+            cells h3index[] default null, vals double precision[] default null,
+            layer_name text default 'h3', extent integer default 4096) returns bytea
+as 'pgh3', 'h3_mvt_tile'
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+comment on function h3_mvt_tile(integer, integer, integer, integer, h3index[], double precision[], text, integer) is
+    'Encodes the hexagons at the given resolution covering the web mercator tile z/x/y as a Mapbox Vector Tile with a single layer. When cells and vals are given, only these cells are encoded, with their value as the property "value".';
 
 
 CREATE FUNCTION _h3_polyfill_polygon_estimate_c(exterior_ring polygon, interior_rings polygon[],  
             resolution integer) RETURNS integer
 AS 'pgh3', '_h3_polyfill_polygon_estimate'
-IMMUTABLE LANGUAGE C;
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
 comment on function _h3_polyfill_polygon_estimate_c(exterior_ring polygon, interior_rings polygon[], resolution integer) is
     'Estimate the number of indexes required to fill the given exterior ring with hexagons at the given resolution. The interior_ring polygons are understood as holes and will be omitted.';
 
 
-create function h3_polyfill_estimate(geom geometry, resolution integer) returns integer as $$
-declare
-    result integer;
-begin
+CREATE FUNCTION _h3_polyfill_wkb_estimate_c(wkb bytea, resolution integer) RETURNS integer
+AS 'pgh3', '_h3_polyfill_wkb_estimate'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function _h3_polyfill_wkb_estimate_c(wkb bytea, resolution integer) is
+    'Estimate the number of indexes required to fill the polygon or multipolygon given as WKB or EWKB with hexagons at the given resolution.';
 
-    select sum(_h3_polyfill_polygon_estimate_c(exterior_ring, interior_rings, resolution)) into result
-    from (
-        select 
-            st_makepolygon(st_exteriorring(g))::polygon exterior_ring,
-            (select array_agg(st_makepolygon(st_interiorringn(g, i))::polygon) rings
-                from (
-                    select generate_series(0, st_numinteriorrings(g)) i
-                ) gs
-                where gs.i > 0 -- index starts with 1 
-            ) interior_rings
-        from (
-            select geom g
-                where st_geometrytype(geom) = 'ST_Polygon'
-            union select g
-                from (
-                    select (st_dump(geom)).geom as g 
-                    where st_geometrytype(geom) = 'ST_MultiPolygon'
-                ) d
-        ) polys
-        group by g
-    ) pg_polys;
-
-    return result;
-end;
-$$ language plpgsql immutable strict;
+create function h3_polyfill_estimate(geom geometry, resolution integer) returns integer
+as $$ select _h3_polyfill_wkb_estimate_c(st_asbinary(geom), resolution) $$
+language sql immutable parallel safe strict;
 comment on function h3_polyfill_estimate(polygong geometry, resolution integer) is 
     'Estimate the number of indexes required to fill the given PostGIS polygon or multipolygon with hexagons at the given resolution. Holes in the polygon will be omitted.';
 
 
+/******* planner support *********************************/
+
+-- the set returning sql functions above are not strict, so the planner
+-- can inline them and estimate the c functions they call.
+--
+-- support functions require postgresql >= 12. On earlier versions pgh3
+-- is compiled without them and the default estimates are used.
+do $$
+begin
+    create function h3_to_children_support(internal) returns internal
+    as 'pgh3', 'h3_to_children_support'
+    language c strict ;
+
+    create function h3_kring_support(internal) returns internal
+    as 'pgh3', 'h3_kring_support'
+    language c strict ;
+
+    create function h3_hex_ring_support(internal) returns internal
+    as 'pgh3', 'h3_hex_ring_support'
+    language c strict ;
+
+    create function h3_kring_distances_multi_support(internal) returns internal
+    as 'pgh3', 'h3_kring_distances_multi_support'
+    language c strict ;
+
+    create function h3_polyfill_support(internal) returns internal
+    as 'pgh3', 'h3_polyfill_support'
+    language c strict ;
+
+    create function h3index_contains_support(internal) returns internal
+    as 'pgh3', 'h3index_contains_support'
+    language c strict ;
+
+    create function h3index_contained_by_support(internal) returns internal
+    as 'pgh3', 'h3index_contained_by_support'
+    language c strict ;
+
+    alter function h3_to_children(h3index, integer) support h3_to_children_support;
+    alter function h3_kring(h3index, integer) support h3_kring_support;
+    alter function h3_kring_distances(h3index, integer) support h3_kring_support;
+    alter function h3_kring_distances(h3index[], integer) support h3_kring_distances_multi_support;
+    alter function h3_hex_ring(h3index, integer) support h3_hex_ring_support;
+    alter function _h3_polyfill_wkb_cells_c(bytea, integer) support h3_polyfill_support;
+
+    -- scan the containment operators as ranges of btree indexes
+    alter function h3index_contains(h3index, h3index) support h3index_contains_support;
+    alter function h3index_contained_by(h3index, h3index) support h3index_contained_by_support;
+exception when undefined_function then
+    -- ignore. pgh3 is compiled without planner support.
+    raise notice 'planner support functions are not supported';
+end $$;
+
+
 /******* compacting functions *********************************/
 
-CREATE FUNCTION h3_compact(h3indexes text[]) RETURNS SETOF text
+CREATE FUNCTION h3_compact(h3indexes h3index[]) RETURNS SETOF h3index
 AS 'pgh3', 'h3_compact'
-IMMUTABLE LANGUAGE C;
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+comment on function h3_compact(h3indexes h3index[]) is
+    'Compacts the array of given H3 indexes as best as possible';
+
+CREATE FUNCTION h3_compact(h3indexes text[]) RETURNS SETOF text
+AS $$ select h3_compact(h3indexes::h3index[])::text $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL;
 comment on function h3_compact(h3indexes text[]) is
     'Compacts the array of given H3 indexes as best as possible';
 
+CREATE FUNCTION h3_compact_array(h3indexes h3index[]) RETURNS h3index[]
+AS 'pgh3', 'h3_compact_array'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3_compact_array(h3indexes h3index[]) is
+    'Compacts the array of given H3 indexes as best as possible, returning an array';
 
-CREATE FUNCTION h3_uncompact(h3indexes text[], resolution integer) RETURNS SETOF text
+CREATE FUNCTION h3_compact_array(h3indexes text[]) RETURNS text[]
+AS $$ select h3_compact_array(h3indexes::h3index[])::text[] $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT;
+comment on function h3_compact_array(h3indexes text[]) is
+    'Compacts the array of given H3 indexes as best as possible, returning an array';
+
+
+CREATE FUNCTION h3_uncompact(h3indexes h3index[], resolution integer) RETURNS SETOF h3index
 AS 'pgh3', 'h3_uncompact'
-IMMUTABLE LANGUAGE C;
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+comment on function h3_uncompact(h3indexes h3index[], resolution integer) is
+    'Uncompacts the array of given H3 indexes';
+
+CREATE FUNCTION h3_uncompact(h3indexes text[], resolution integer) RETURNS SETOF text
+AS $$ select h3_uncompact(h3indexes::h3index[], resolution)::text $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL;
 comment on function h3_uncompact(h3indexes text[], resolution integer) is
     'Uncompacts the array of given H3 indexes';
 
+CREATE FUNCTION h3_uncompact_array(h3indexes h3index[], resolution integer) RETURNS h3index[]
+AS 'pgh3', 'h3_uncompact_array'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3_uncompact_array(h3indexes h3index[], resolution integer) is
+    'Uncompacts the array of given H3 indexes, returning an array';
+
+CREATE FUNCTION h3_uncompact_array(h3indexes text[], resolution integer) RETURNS text[]
+AS $$ select h3_uncompact_array(h3indexes::h3index[], resolution)::text[] $$
+IMMUTABLE PARALLEL SAFE LANGUAGE SQL STRICT;
+comment on function h3_uncompact_array(h3indexes text[], resolution integer) is
+    'Uncompacts the array of given H3 indexes, returning an array';
+
+CREATE FUNCTION h3_uncompact(cells h3set, resolution integer) RETURNS SETOF h3index
+AS 'pgh3', 'h3set_uncompact'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+comment on function h3_uncompact(cells h3set, resolution integer) is
+    'Uncompacts the cells of the set, decoding the set as the cells are returned';
+
+
+
+create function h3_compact_agg_transfn(internal, h3index) returns internal
+as 'pgh3', 'h3_compact_agg_transfn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+
+create function h3_compact_agg_combinefn(internal, internal) returns internal
+as 'pgh3', 'h3_compact_agg_combinefn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+
+create function h3_compact_agg_serialfn(internal) returns bytea
+as 'pgh3', 'h3_compact_agg_serialfn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3_compact_agg_deserialfn(bytea, internal) returns internal
+as 'pgh3', 'h3_compact_agg_deserialfn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3_compact_agg_finalfn(internal) returns h3index[]
+as 'pgh3', 'h3_compact_agg_finalfn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+
+create aggregate h3_compact_agg(h3index) (
+    sfunc = h3_compact_agg_transfn,
+    stype = internal,
+    finalfunc = h3_compact_agg_finalfn,
+    combinefunc = h3_compact_agg_combinefn,
+    serialfunc = h3_compact_agg_serialfn,
+    deserialfunc = h3_compact_agg_deserialfn,
+    parallel = safe
+);
+comment on aggregate h3_compact_agg(h3index) is
+    'Compacts the aggregated H3 indexes as best as possible. The indexes may have different resolutions, duplicates and indexes contained in other indexes are removed. Supports parallel aggregation.';
+
+create function h3set_agg_finalfn(internal) returns h3set
+as 'pgh3', 'h3set_agg_finalfn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+
+create aggregate h3set_agg(h3index) (
+    sfunc = h3_compact_agg_transfn,
+    stype = internal,
+    finalfunc = h3set_agg_finalfn,
+    combinefunc = h3_compact_agg_combinefn,
+    serialfunc = h3_compact_agg_serialfn,
+    deserialfunc = h3_compact_agg_deserialfn,
+    parallel = safe
+);
+comment on aggregate h3set_agg(h3index) is
+    'The set of the aggregated H3 indexes. The indexes may have different resolutions. Supports parallel aggregation.';
+
+
+/******* binning points *********************************/
+
+create type h3_bin as (
+    cell h3index,
+    count bigint,
+    sum double precision,
+    min double precision,
+    max double precision
+);
+comment on type h3_bin is 'A cell with the number of points binned into it and the sum, minimum and maximum of their values.';
+
+create function h3_bin_transfn(internal, point, integer, double precision) returns internal
+as 'pgh3', 'h3_bin_transfn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+
+create function h3_bin_transfn(internal, point, integer) returns internal
+as 'pgh3', 'h3_bin_transfn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+
+create function h3_bin_combinefn(internal, internal) returns internal
+as 'pgh3', 'h3_bin_combinefn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+
+create function h3_bin_serialfn(internal) returns bytea
+as 'pgh3', 'h3_bin_serialfn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3_bin_deserialfn(bytea, internal) returns internal
+as 'pgh3', 'h3_bin_deserialfn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C STRICT;
+
+create function h3_bin_finalfn(internal) returns h3_bin[]
+as 'pgh3', 'h3_bin_finalfn'
+IMMUTABLE PARALLEL SAFE LANGUAGE C;
+
+create aggregate h3_bin(p point, resolution integer, value double precision) (
+    sfunc = h3_bin_transfn,
+    stype = internal,
+    finalfunc = h3_bin_finalfn,
+    combinefunc = h3_bin_combinefn,
+    serialfunc = h3_bin_serialfn,
+    deserialfunc = h3_bin_deserialfn,
+    parallel = safe
+);
+comment on aggregate h3_bin(point, integer, double precision) is
+    'Bins the points into the cells of the given resolution, returning the number of points and the sum, minimum and maximum of the values per cell. Rows with a NULL argument are skipped. Supports parallel aggregation.';
+
+create aggregate h3_bin(p point, resolution integer) (
+    sfunc = h3_bin_transfn,
+    stype = internal,
+    finalfunc = h3_bin_finalfn,
+    combinefunc = h3_bin_combinefn,
+    serialfunc = h3_bin_serialfn,
+    deserialfunc = h3_bin_deserialfn,
+    parallel = safe
+);
+comment on aggregate h3_bin(point, integer) is
+    'Bins the points into the cells of the given resolution, returning the number of points per cell. Supports parallel aggregation.';
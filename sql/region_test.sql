@@ -33,3 +33,110 @@ select i
         from test_geometries where name = 'multipolygon with hole'
 ) f
 order by i;
+
+/* tiled polyfill returns the same hexagons */
+
+create temporary table polyfill_untiled as
+    select name, h3_polyfill(geom, 5) i from test_geometries;
+
+set pgh3.polyfill_tile_threshold = 0;
+
+select count(*) from (
+    (select name, h3_polyfill(geom, 5) i from test_geometries
+        except all select name, i from polyfill_untiled)
+    union all
+    (select name, i from polyfill_untiled
+        except all select name, h3_polyfill(geom, 5) i from test_geometries)
+) d;
+
+-- using threads
+set pgh3.polyfill_threads = 4;
+
+select count(*) from (
+    (select name, h3_polyfill(geom, 5) i from test_geometries
+        except all select name, i from polyfill_untiled)
+    union all
+    (select name, i from polyfill_untiled
+        except all select name, h3_polyfill(geom, 5) i from test_geometries)
+) d;
+
+reset pgh3.polyfill_threads;
+reset pgh3.polyfill_tile_threshold;
+
+-- the estimate of H3 overflows for a polygon of the size of a large country
+-- at resolution 12. It is filled tile by tile and returns its first cells
+-- without filling the whole polygon.
+select count(*), min(h3_get_resolution(i)), max(h3_get_resolution(i)),
+    bool_and(st_contains(st_makeenvelope(6.0, 45.0, 24.0, 55.0, 4326), h3_h3index_to_geo(i)))
+from (
+    select h3_polyfill_cells(st_makeenvelope(6.0, 45.0, 24.0, 55.0, 4326), 12) i limit 1000
+) f;
+
+/* compacted polyfill */
+
+-- the same cells as the compacted polyfill. should return 0.
+select count(*) from (
+    (select name, h3_polyfill_compact(geom, 5) i from test_geometries
+        except all select name, h3_compact(array_agg(i::h3index)) from polyfill_untiled group by name)
+    union all
+    (select name, h3_compact(array_agg(i::h3index)) from polyfill_untiled group by name
+        except all select name, h3_polyfill_compact(geom, 5) i from test_geometries)
+) d;
+
+select bool_and(cardinality(h3_polyfill_compact_array(geom, 7)) < cardinality(h3_polyfill_cells_array(geom, 7)))
+from test_geometries;
+
+/* array variants */
+
+-- same as the set-returning function. should return 0.
+select count(*) from (
+    (select name, unnest(h3_polyfill_array(geom, 5)) i from test_geometries
+        except all select name, i from polyfill_untiled)
+    union all
+    (select name, i from polyfill_untiled
+        except all select name, unnest(h3_polyfill_array(geom, 5)) i from test_geometries)
+) d;
+
+select h3_polyfill_cells_array('POINT(1 2)'::geometry, 3);
+
+/* geometries are read from their WKB */
+
+select count(*) from (
+    (select _h3_polyfill_wkb_cells_c(st_asewkb(st_setsrid(st_force3d(geom), 4326)), 3) i
+        from test_geometries where name = 'polygon with hole'
+        except all select _h3_polyfill_polygon_cells_c(st_makepolygon(st_exteriorring(geom))::polygon,
+            array[st_makepolygon(st_interiorringn(geom, 1))::polygon], 3)
+        from test_geometries where name = 'polygon with hole')
+    union all
+    (select _h3_polyfill_polygon_cells_c(st_makepolygon(st_exteriorring(geom))::polygon,
+            array[st_makepolygon(st_interiorringn(geom, 1))::polygon], 3)
+        from test_geometries where name = 'polygon with hole'
+        except all select _h3_polyfill_wkb_cells_c(st_asewkb(st_setsrid(st_force3d(geom), 4326)), 3)
+        from test_geometries where name = 'polygon with hole')
+) d;
+
+select h3_polyfill_estimate('POINT(1 2)'::geometry, 3);
+
+select count(*) from h3_polyfill_cells('POINT(1 2)'::geometry, 3);
+
+select _h3_polyfill_wkb_estimate_c('\x0103000000'::bytea, 3); -- truncated
+
+/* vector tiles */
+
+select substring(h3_mvt_tile(0, 0, 0, 0) from 1 for 1) = '\x1a'::bytea; -- a layer
+
+select position('851f1383fffffff'::bytea in h3_mvt_tile(10, 538, 337, 5)) > 0;
+
+select position('851f1383fffffff'::bytea in h3_mvt_tile(10, 538, 337, 5,
+    array['851f1383fffffff'::h3index], array[1.0::double precision])) > 0;
+
+select length(h3_mvt_tile(10, 538, 337, 5, array['85639c63fffffff'::h3index], array[1.0::double precision])); -- cell outside of the tile
+
+-- only the given cells are tested, the tile is not filled at the fine resolution
+select position(convert_to(c::text, 'UTF8') in h3_mvt_tile(6, 33, 21, 12, array[c], array[1.0::double precision],
+    'h3', 1048576)) > 0
+from (select h3_to_children('851f1383fffffff'::h3index, 12) c limit 1) s;
+
+select h3_mvt_tile(1, 2, 0, 5);
+
+select h3_mvt_tile(0, 0, 0, 0, array['851f1383fffffff'::h3index], '{}'::double precision[]);
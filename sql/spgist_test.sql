@@ -0,0 +1,37 @@
+create extension if not exists postgis;
+create extension if not exists pgh3;
+
+
+/* containment operators */
+
+select '89283470c27ffff'::h3index @> '8b283470c240fff'::h3index,
+    '8b283470c240fff'::h3index <@ '89283470c27ffff'::h3index,
+    '89283470c27ffff'::h3index @> '89283470c27ffff'::h3index,
+    '8b283470c240fff'::h3index @> '89283470c27ffff'::h3index;
+
+
+/* the SP-GiST operator class */
+
+create table h3index_spgist_test as
+    select h3_uncompact(array['89283470c27ffff'::h3index], 11) i;
+insert into h3index_spgist_test
+    select h3_to_children('89283470c27ffff'::h3index, 10);
+insert into h3index_spgist_test values
+    ('89283470c27ffff'), ('88283470c3fffff'), ('87283470cffffff');
+
+create index h3index_spgist_test_idx on h3index_spgist_test using spgist (i);
+set enable_seqscan = off;
+
+select count(*) from h3index_spgist_test where i = '8b283470c240fff';
+select count(*) from h3index_spgist_test where i <@ '89283470c27ffff';
+select count(*) from h3index_spgist_test where i <@ '8a283470c247fff';
+select count(*) from h3index_spgist_test where i @> '8b283470c240fff';
+select count(*) from h3index_spgist_test where i @> '8b283470c240fff' and i <@ '88283470c3fffff';
+select count(*) from h3index_spgist_test where i && box(point(-122.5, 37.0), point(-121.5, 37.8));
+select count(*) from h3index_spgist_test where i && box(point(10.0, 45.0), point(12.0, 48.0));
+
+-- the index returns the same rows as the operator itself
+select (select count(*) from h3index_spgist_test where i && box(point(-122.05, 37.35), point(-122.04, 37.36)))
+    = (select count(*) from h3index_spgist_test where h3index_overlaps_box(i, box(point(-122.05, 37.35), point(-122.04, 37.36))));
+
+reset enable_seqscan;
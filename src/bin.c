@@ -0,0 +1,413 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "access/htup_details.h"
+#include "utils/array.h"
+#include "utils/geo_decls.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/typcache.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <h3/h3api.h>
+
+/*
+ * Binning of points into cells
+ *
+ * The h3_bin aggregate keeps the number of points and the sum, minimum
+ * and maximum of their values per cell in an open addressing hash table
+ * with linear probing, keyed by the native index. Binning a point
+ * neither forms a tuple nor hashes a text. 0 is not a valid index and
+ * marks the empty slots.
+ */
+
+typedef struct {
+    H3Index cell;               // 0 for empty slots
+    int64 count;
+    double sum;
+    double min;
+    double max;
+} H3BinEntry;
+
+typedef struct {
+    H3BinEntry *entries;
+    int64 size;                 // number of slots, a power of 2
+    int64 num_entries;
+    bool has_values;            // false for the variant without values
+    MemoryContext context;
+} H3BinState;
+
+// the serialized state: the header followed by the used entries
+typedef struct {
+    int64 num_entries;
+    int32 has_values;
+    int32 reserved;
+} H3BinSerialHeader;
+
+#define BIN_MIN_SIZE            1024
+
+// grow the table when it is filled to 3/4
+#define BIN_MAX_ENTRIES(size)   (((size) >> 1) + ((size) >> 2))
+
+/*
+ * the finalizer of MurmurHash3, the bits of neighbouring cells differ
+ * in the low digits only
+ */
+static inline uint64
+bin_hash(H3Index cell)
+{
+    uint64 h = (uint64) cell;
+    h ^= h >> 33;
+    h *= UINT64CONST(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64CONST(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+static H3BinEntry *
+bin_entries_create(MemoryContext context, int64 size)
+{
+    if ((Size) size > MaxAllocHugeSize / sizeof(H3BinEntry)) {
+        fail_and_report_with_code(ERRCODE_PROGRAM_LIMIT_EXCEEDED,
+                "The number of bins exceeds the maximum size of the hash table");
+    }
+    return MemoryContextAllocHuge(context, size * sizeof(H3BinEntry));
+}
+
+static H3BinState *
+bin_state_create(MemoryContext context, int64 num_entries, bool has_values)
+{
+    H3BinState *state = MemoryContextAlloc(context, sizeof(H3BinState));
+
+    state->size = BIN_MIN_SIZE;
+    while (BIN_MAX_ENTRIES(state->size) < num_entries) {
+        state->size *= 2;
+    }
+    state->entries = bin_entries_create(context, state->size);
+    memset(state->entries, 0, state->size * sizeof(H3BinEntry));
+    state->num_entries = 0;
+    state->has_values = has_values;
+    state->context = context;
+    return state;
+}
+
+/*
+ * the slot of the cell, either holding the cell or empty
+ */
+static inline H3BinEntry *
+bin_state_slot(H3BinEntry *entries, int64 size, H3Index cell)
+{
+    uint64 mask = (uint64) size - 1;
+    uint64 pos = bin_hash(cell) & mask;
+    while (entries[pos].cell != 0 && entries[pos].cell != cell) {
+        pos = (pos + 1) & mask;
+    }
+    return &entries[pos];
+}
+
+static void
+bin_state_grow(H3BinState *state)
+{
+    int64 size = state->size * 2;
+    H3BinEntry *entries = bin_entries_create(state->context, size);
+    memset(entries, 0, size * sizeof(H3BinEntry));
+
+    for (int64 i = 0; i < state->size; i++) {
+        if (state->entries[i].cell != 0) {
+            *bin_state_slot(entries, size, state->entries[i].cell) = state->entries[i];
+        }
+    }
+
+    pfree(state->entries);
+    state->entries = entries;
+    state->size = size;
+}
+
+/*
+ * the entry of the cell, a new entry without points when the cell
+ * has not been binned before
+ */
+static inline H3BinEntry *
+bin_state_lookup(H3BinState *state, H3Index cell)
+{
+    H3BinEntry *entry = bin_state_slot(state->entries, state->size, cell);
+    if (entry->cell != 0) {
+        return entry;
+    }
+
+    if (state->num_entries + 1 > BIN_MAX_ENTRIES(state->size)) {
+        bin_state_grow(state);
+        entry = bin_state_slot(state->entries, state->size, cell);
+    }
+    entry->cell = cell;
+    entry->count = 0;
+    entry->sum = 0.0;
+    entry->min = INFINITY;
+    entry->max = -INFINITY;
+    state->num_entries++;
+    return entry;
+}
+
+static void
+bin_state_merge(H3BinState *state, const H3BinEntry *other)
+{
+    H3BinEntry *entry = bin_state_lookup(state, other->cell);
+    entry->count += other->count;
+    entry->sum += other->sum;
+    entry->min = Min(entry->min, other->min);
+    entry->max = Max(entry->max, other->max);
+}
+
+
+PG_FUNCTION_INFO_V1(h3_bin_transfn);
+
+/*
+ * transition function of h3_bin(point, resolution, value) and
+ * h3_bin(point, resolution). Rows with a NULL argument are skipped.
+ */
+Datum
+h3_bin_transfn(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggcontext;
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "h3_bin_transfn called in non-aggregate context");
+    }
+
+    H3BinState *state = PG_ARGISNULL(0) ? NULL : (H3BinState *) PG_GETARG_POINTER(0);
+    bool has_values = (PG_NARGS() > 3);
+
+    if (PG_ARGISNULL(1) || PG_ARGISNULL(2) || (has_values && PG_ARGISNULL(3))) {
+        if (state == NULL) {
+            PG_RETURN_NULL();
+        }
+        PG_RETURN_POINTER(state);
+    }
+
+    Point *p = PG_GETARG_POINT_P(1);
+    int resolution = PG_GETARG_INT32(2);
+    if (resolution < 0 || resolution > PGH3_MAX_RES) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "Invalid resolution %d", resolution);
+    }
+
+    GeoCoord location;
+    location.lat = degsToRads(p->y);
+    location.lon = degsToRads(p->x);
+    H3Index cell = H3_EXPORT(geoToH3)(&location, resolution);
+    if (cell == 0) {
+        fail_and_report("Could not convert the coordinates (%f %f) to a H3 index", p->x, p->y);
+    }
+
+    if (state == NULL) {
+        state = bin_state_create(aggcontext, 0, has_values);
+    }
+
+    H3BinEntry *entry = bin_state_lookup(state, cell);
+    entry->count++;
+    if (has_values) {
+        double value = PG_GETARG_FLOAT8(3);
+        entry->sum += value;
+        entry->min = Min(entry->min, value);
+        entry->max = Max(entry->max, value);
+    }
+
+    PG_RETURN_POINTER(state);
+}
+
+
+PG_FUNCTION_INFO_V1(h3_bin_combinefn);
+
+Datum
+h3_bin_combinefn(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggcontext;
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "h3_bin_combinefn called in non-aggregate context");
+    }
+
+    H3BinState *state1 = PG_ARGISNULL(0) ? NULL : (H3BinState *) PG_GETARG_POINTER(0);
+    H3BinState *state2 = PG_ARGISNULL(1) ? NULL : (H3BinState *) PG_GETARG_POINTER(1);
+
+    if (state2 == NULL) {
+        if (state1 == NULL) {
+            PG_RETURN_NULL();
+        }
+        PG_RETURN_POINTER(state1);
+    }
+
+    // the state must be allocated in the aggregate context
+    if (state1 == NULL) {
+        state1 = bin_state_create(aggcontext, state2->num_entries, state2->has_values);
+    }
+
+    for (int64 i = 0; i < state2->size; i++) {
+        if (state2->entries[i].cell != 0) {
+            bin_state_merge(state1, &state2->entries[i]);
+        }
+    }
+
+    PG_RETURN_POINTER(state1);
+}
+
+
+PG_FUNCTION_INFO_V1(h3_bin_serialfn);
+
+/*
+ * the serialized state is the header followed by the used entries
+ */
+Datum
+h3_bin_serialfn(PG_FUNCTION_ARGS)
+{
+    H3BinState *state = (H3BinState *) PG_GETARG_POINTER(0);
+
+    Size size = VARHDRSZ + sizeof(H3BinSerialHeader) + state->num_entries * sizeof(H3BinEntry);
+    if (!AllocSizeIsValid(size)) {
+        fail_and_report_with_code(ERRCODE_PROGRAM_LIMIT_EXCEEDED,
+                "The %ld bins are too many to be serialized", (long) state->num_entries);
+    }
+
+    bytea *result = palloc(size);
+    SET_VARSIZE(result, size);
+
+    H3BinSerialHeader header;
+    memset(&header, 0, sizeof(header));
+    header.num_entries = state->num_entries;
+    header.has_values = state->has_values;
+    memcpy(VARDATA(result), &header, sizeof(header));
+
+    H3BinEntry *out = (H3BinEntry *) (VARDATA(result) + sizeof(H3BinSerialHeader));
+    for (int64 i = 0; i < state->size; i++) {
+        if (state->entries[i].cell != 0) {
+            *out++ = state->entries[i];
+        }
+    }
+
+    PG_RETURN_BYTEA_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(h3_bin_deserialfn);
+
+Datum
+h3_bin_deserialfn(PG_FUNCTION_ARGS)
+{
+    bytea *serialized = PG_GETARG_BYTEA_PP(0);
+    const char *data = VARDATA_ANY(serialized);
+
+    H3BinSerialHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (VARSIZE_ANY_EXHDR(serialized) != sizeof(header) + header.num_entries * sizeof(H3BinEntry)) {
+        elog(ERROR, "invalid serialized state of h3_bin");
+    }
+
+    H3BinState *state = bin_state_create(CurrentMemoryContext, header.num_entries, header.has_values);
+
+    // the entries may not be aligned within the bytea
+    for (int64 i = 0; i < header.num_entries; i++) {
+        H3BinEntry entry;
+        memcpy(&entry, data + sizeof(header) + i * sizeof(H3BinEntry), sizeof(entry));
+        *bin_state_slot(state->entries, state->size, entry.cell) = entry;
+    }
+    state->num_entries = header.num_entries;
+
+    PG_RETURN_POINTER(state);
+}
+
+
+static int
+bin_entry_cmp(const void *a, const void *b)
+{
+    return __h3_index_cmp(((const H3BinEntry *) a)->cell, ((const H3BinEntry *) b)->cell);
+}
+
+PG_FUNCTION_INFO_V1(h3_bin_finalfn);
+
+/*
+ * The bins as an array of the composite type h3_bin, sorted by their
+ * cells. Without values the sum, minimum and maximum are NULL.
+ */
+Datum
+h3_bin_finalfn(PG_FUNCTION_ARGS)
+{
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_NULL();
+    }
+
+    H3BinState *state = (H3BinState *) PG_GETARG_POINTER(0);
+
+    if (state->num_entries > INT_MAX) {
+        fail_and_report_with_code(ERRCODE_PROGRAM_LIMIT_EXCEEDED,
+                "The %ld bins are too many for an array", (long) state->num_entries);
+    }
+
+    Oid bin_type = get_element_type(get_fn_expr_rettype(fcinfo->flinfo));
+    if (!OidIsValid(bin_type)) {
+        elog(ERROR, "could not determine the result type of h3_bin");
+    }
+    TupleDesc tupdesc = lookup_rowtype_tupdesc(bin_type, -1);
+    if (tupdesc->natts != 5) {
+        elog(ERROR, "unexpected definition of the type h3_bin");
+    }
+
+    // the state may be passed to the final function again, so the
+    // entries are sorted in a copy
+    H3BinEntry *entries = MemoryContextAllocHuge(CurrentMemoryContext,
+                Max(state->num_entries, 1) * sizeof(H3BinEntry));
+    int64 num_entries = 0;
+    for (int64 i = 0; i < state->size; i++) {
+        if (state->entries[i].cell != 0) {
+            entries[num_entries++] = state->entries[i];
+        }
+    }
+    qsort(entries, num_entries, sizeof(H3BinEntry), bin_entry_cmp);
+
+    Datum *elems = palloc(Max(num_entries, 1) * sizeof(Datum));
+    for (int64 i = 0; i < num_entries; i++) {
+        Datum values[5];
+        bool nulls[5] = {false, false, !state->has_values, !state->has_values, !state->has_values};
+
+        values[0] = H3IndexGetDatum(entries[i].cell);
+        values[1] = Int64GetDatum(entries[i].count);
+        values[2] = Float8GetDatum(entries[i].sum);
+        values[3] = Float8GetDatum(entries[i].min);
+        values[4] = Float8GetDatum(entries[i].max);
+
+        elems[i] = HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls));
+    }
+    ReleaseTupleDesc(tupdesc);
+
+    int16 typlen;
+    bool typbyval;
+    char typalign;
+    get_typlenbyvalalign(bin_type, &typlen, &typbyval, &typalign);
+
+    ArrayType *result = construct_array(elems, (int) num_entries, bin_type, typlen, typbyval, typalign);
+    pfree(elems);
+    pfree(entries);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
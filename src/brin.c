@@ -0,0 +1,213 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/brin_internal.h"
+#include "access/brin_tuple.h"
+#include "access/skey.h"
+#include "access/stratnum.h"
+#include "utils/typcache.h"
+
+#include <h3/h3api.h>
+
+/*
+ * BRIN operator class for h3index
+ *
+ * The summary of a block range is the minimum and the maximum of its
+ * values in the sort order of the btree operator class. As the
+ * descendants of a cell are sorted contiguously directly before the
+ * cell itself, the summary can answer the containment operators as
+ * well as the comparison operators.
+ *
+ * Works like the minmax operator classes of PostgreSQL, but compares
+ * the integers directly instead of calling the comparison functions.
+ */
+
+#define BRIN_MIN    0
+#define BRIN_MAX    1
+
+PG_FUNCTION_INFO_V1(h3index_brin_opcinfo);
+
+Datum
+h3index_brin_opcinfo(PG_FUNCTION_ARGS)
+{
+    Oid typoid = PG_GETARG_OID(0);
+
+    BrinOpcInfo *result = palloc0(SizeofBrinOpcInfo(2));
+    result->oi_nstored = 2;
+#if PG_VERSION_NUM >= 140000
+    result->oi_regular_nulls = true;
+#endif
+    result->oi_typcache[BRIN_MIN] = result->oi_typcache[BRIN_MAX] =
+        lookup_type_cache(typoid, 0);
+
+    PG_RETURN_POINTER(result);
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_brin_add_value);
+
+Datum
+h3index_brin_add_value(PG_FUNCTION_ARGS)
+{
+    BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+    Datum newval = PG_GETARG_DATUM(2);
+    bool isnull = PG_GETARG_BOOL(3);
+
+    // only called with nulls before PostgreSQL 14
+    if (isnull) {
+        if (column->bv_hasnulls) {
+            PG_RETURN_BOOL(false);
+        }
+        column->bv_hasnulls = true;
+        PG_RETURN_BOOL(true);
+    }
+
+    H3Index index = DatumGetH3Index(newval);
+
+    if (column->bv_allnulls) {
+        column->bv_values[BRIN_MIN] = H3IndexGetDatum(index);
+        column->bv_values[BRIN_MAX] = H3IndexGetDatum(index);
+        column->bv_allnulls = false;
+        PG_RETURN_BOOL(true);
+    }
+
+    bool updated = false;
+    if (__h3_index_cmp(index, DatumGetH3Index(column->bv_values[BRIN_MIN])) < 0) {
+        column->bv_values[BRIN_MIN] = H3IndexGetDatum(index);
+        updated = true;
+    }
+    if (__h3_index_cmp(index, DatumGetH3Index(column->bv_values[BRIN_MAX])) > 0) {
+        column->bv_values[BRIN_MAX] = H3IndexGetDatum(index);
+        updated = true;
+    }
+
+    PG_RETURN_BOOL(updated);
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_brin_consistent);
+
+Datum
+h3index_brin_consistent(PG_FUNCTION_ARGS)
+{
+    BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+    ScanKey key = (ScanKey) PG_GETARG_POINTER(2);
+
+    // IS NULL and IS NOT NULL are handled by the core since PostgreSQL 14
+    if (key->sk_flags & SK_ISNULL) {
+        if (key->sk_flags & SK_SEARCHNULL) {
+            PG_RETURN_BOOL(column->bv_allnulls || column->bv_hasnulls);
+        }
+        if (key->sk_flags & SK_SEARCHNOTNULL) {
+            PG_RETURN_BOOL(!column->bv_allnulls);
+        }
+        PG_RETURN_BOOL(false);
+    }
+
+    if (column->bv_allnulls) {
+        PG_RETURN_BOOL(false);
+    }
+
+    H3Index min = DatumGetH3Index(column->bv_values[BRIN_MIN]);
+    H3Index max = DatumGetH3Index(column->bv_values[BRIN_MAX]);
+    H3Index query = DatumGetH3Index(key->sk_argument);
+
+    switch (key->sk_strategy) {
+        case BTLessStrategyNumber:
+            PG_RETURN_BOOL(__h3_index_cmp(min, query) < 0);
+
+        case BTLessEqualStrategyNumber:
+            PG_RETURN_BOOL(__h3_index_cmp(min, query) <= 0);
+
+        case BTEqualStrategyNumber:
+            PG_RETURN_BOOL(__h3_index_cmp(min, query) <= 0 && __h3_index_cmp(max, query) >= 0);
+
+        case BTGreaterEqualStrategyNumber:
+            PG_RETURN_BOOL(__h3_index_cmp(max, query) >= 0);
+
+        case BTGreaterStrategyNumber:
+            PG_RETURN_BOOL(__h3_index_cmp(max, query) > 0);
+
+        case RTContainedByStrategyNumber:
+            // the descendants of the query are sorted between the
+            // lower bound and the query itself
+            PG_RETURN_BOOL(__h3_index_cmp(min, query) <= 0
+                    && __h3_index_cmp(max, __h3_index_descendants_lower_bound(query)) >= 0);
+
+        case RTContainsStrategyNumber:
+            // the ancestors of the query are sorted after it, the
+            // coarsest one last
+            if (__h3_index_cmp(max, query) < 0) {
+                PG_RETURN_BOOL(false);
+            }
+            for (int res = H3_EXPORT(h3GetResolution)(query); res >= 0; res--) {
+                H3Index parent = H3_EXPORT(h3ToParent)(query, res);
+                if (__h3_index_cmp(parent, max) > 0) {
+                    break;
+                }
+                if (__h3_index_cmp(parent, min) >= 0) {
+                    PG_RETURN_BOOL(true);
+                }
+            }
+            PG_RETURN_BOOL(false);
+
+        default:
+            elog(ERROR, "unrecognized strategy number: %d", key->sk_strategy);
+    }
+    PG_RETURN_BOOL(false);
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_brin_union);
+
+Datum
+h3index_brin_union(PG_FUNCTION_ARGS)
+{
+    BrinValues *col_a = (BrinValues *) PG_GETARG_POINTER(1);
+    BrinValues *col_b = (BrinValues *) PG_GETARG_POINTER(2);
+
+    // nulls are handled by the core since PostgreSQL 14
+    if (col_b->bv_hasnulls) {
+        col_a->bv_hasnulls = true;
+    }
+    if (col_b->bv_allnulls) {
+        PG_RETURN_VOID();
+    }
+    if (col_a->bv_allnulls) {
+        col_a->bv_allnulls = false;
+        col_a->bv_values[BRIN_MIN] = col_b->bv_values[BRIN_MIN];
+        col_a->bv_values[BRIN_MAX] = col_b->bv_values[BRIN_MAX];
+        PG_RETURN_VOID();
+    }
+
+    if (__h3_index_cmp(DatumGetH3Index(col_b->bv_values[BRIN_MIN]),
+                DatumGetH3Index(col_a->bv_values[BRIN_MIN])) < 0) {
+        col_a->bv_values[BRIN_MIN] = col_b->bv_values[BRIN_MIN];
+    }
+    if (__h3_index_cmp(DatumGetH3Index(col_b->bv_values[BRIN_MAX]),
+                DatumGetH3Index(col_a->bv_values[BRIN_MAX])) > 0) {
+        col_a->bv_values[BRIN_MAX] = col_b->bv_values[BRIN_MAX];
+    }
+
+    PG_RETURN_VOID();
+}
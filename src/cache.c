@@ -0,0 +1,293 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "access/htup_details.h"
+#include "lib/ilist.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include <h3/h3api.h>
+
+/*
+ * Cache of the centroids and boundaries of cells
+ *
+ * Computing the geometry of a cell requires a lot of trigonometry, while
+ * many queries ask for the geometries of the same cells again and again.
+ * The cache keeps the geometries of the most recently used cells of
+ * the backend. It is bounded by the pgh3.geometry_cache_size setting
+ * and evicts the least recently used cell when it is full.
+ *
+ * The coordinates are in degrees.
+ */
+
+typedef struct {
+    H3Index index;              // hash key, must be the first member
+    dlist_node lru_node;
+    bool has_centroid;
+    bool has_boundary;
+    Point centroid;
+    int num_verts;
+    Point verts[MAX_CELL_BNDRY_VERTS];
+} GeometryCacheEntry;
+
+static HTAB *geometry_cache = NULL;
+
+// the most recently used entry is at the head
+static dlist_head geometry_cache_lru;
+
+static int64 geometry_cache_hits = 0;
+static int64 geometry_cache_misses = 0;
+
+// the maximum number of cells in the cache, 0 disables the cache
+static int geometry_cache_size = PGH3_GEOMETRY_CACHE_SIZE_DEFAULT;
+
+
+static void
+geometry_cache_evict(long max_entries)
+{
+    while (hash_get_num_entries(geometry_cache) > max_entries) {
+        GeometryCacheEntry *lru = dlist_container(GeometryCacheEntry, lru_node,
+                    dlist_tail_node(&geometry_cache_lru));
+        dlist_delete(&lru->lru_node);
+        hash_search(geometry_cache, &lru->index, HASH_REMOVE, NULL);
+    }
+}
+
+/*
+ * shrinks the cache when the setting is reduced
+ */
+static void
+geometry_cache_assign_size(int newval, void *extra)
+{
+    if (geometry_cache == NULL) {
+        return;
+    }
+    if (newval == 0) {
+        hash_destroy(geometry_cache);
+        geometry_cache = NULL;
+    }
+    else {
+        geometry_cache_evict(newval);
+    }
+}
+
+/*
+ * Registers the pgh3.geometry_cache_size setting, called when the
+ * library is loaded.
+ */
+void
+__h3_geometry_cache_init(void)
+{
+    DefineCustomIntVariable(PGH3_GEOMETRY_CACHE_SIZE_SETTING_NAME,
+            "The maximum number of cells in the geometry cache of a session.",
+            "0 disables the cache.",
+            &geometry_cache_size,
+            PGH3_GEOMETRY_CACHE_SIZE_DEFAULT,
+            0, INT_MAX,
+            PGC_USERSET, 0,
+            NULL, geometry_cache_assign_size, NULL);
+}
+
+/*
+ * the maximum number of cells in the cache, 0 disables the cache
+ */
+int
+__h3_geometry_cache_size(void)
+{
+    return geometry_cache_size;
+}
+
+/*
+ * Get the cache entry of the index, creating an empty one when the index
+ * is not cached. Returns NULL when the cache is disabled.
+ */
+static GeometryCacheEntry *
+geometry_cache_lookup(H3Index index)
+{
+    int size = geometry_cache_size;
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (geometry_cache == NULL) {
+        HASHCTL ctl;
+        memset(&ctl, 0, sizeof(ctl));
+        ctl.keysize = sizeof(H3Index);
+        ctl.entrysize = sizeof(GeometryCacheEntry);
+
+        // allocated below TopMemoryContext, lives as long as the backend
+        geometry_cache = hash_create("pgh3 geometry cache", Min(size, 1024), &ctl,
+                    HASH_ELEM | HASH_BLOBS);
+        dlist_init(&geometry_cache_lru);
+    }
+
+    bool found;
+    GeometryCacheEntry *entry = hash_search(geometry_cache, &index, HASH_FIND, NULL);
+    if (entry != NULL) {
+        dlist_move_head(&geometry_cache_lru, &entry->lru_node);
+        return entry;
+    }
+
+    // make room for the new entry
+    geometry_cache_evict(size - 1);
+
+    entry = hash_search(geometry_cache, &index, HASH_ENTER, &found);
+    entry->has_centroid = false;
+    entry->has_boundary = false;
+    dlist_push_head(&geometry_cache_lru, &entry->lru_node);
+    return entry;
+}
+
+static void
+geometry_compute_centroid(H3Index index, Point *centroid)
+{
+    GeoCoord coord;
+    H3_EXPORT(h3ToGeo)(index, &coord);
+
+    centroid->x = radsToDegs(coord.lon);
+    centroid->y = radsToDegs(coord.lat);
+}
+
+static int
+geometry_compute_boundary(H3Index index, Point *verts)
+{
+    GeoBoundary gp;
+    H3_EXPORT(h3ToGeoBoundary)(index, &gp);
+
+    for (int i = 0; i < gp.numVerts; i++) {
+        verts[i].x = radsToDegs(gp.verts[i].lon);
+        verts[i].y = radsToDegs(gp.verts[i].lat);
+    }
+    return gp.numVerts;
+}
+
+/*
+ * count a lookup answered without the cache, e.g. by the cache of
+ * the last value of a function
+ */
+void
+__h3_geometry_cache_count_hit(void)
+{
+    geometry_cache_hits++;
+}
+
+/*
+ * the centroid of the index in degrees
+ */
+void
+__h3_cached_centroid(H3Index index, Point *centroid)
+{
+    GeometryCacheEntry *entry = geometry_cache_lookup(index);
+
+    if (entry == NULL) {
+        geometry_cache_misses++;
+        geometry_compute_centroid(index, centroid);
+        return;
+    }
+
+    if (entry->has_centroid) {
+        geometry_cache_hits++;
+    }
+    else {
+        geometry_cache_misses++;
+        geometry_compute_centroid(index, &entry->centroid);
+        entry->has_centroid = true;
+    }
+    *centroid = entry->centroid;
+}
+
+/*
+ * the vertices of the boundary of the index in degrees. verts must have
+ * room for MAX_CELL_BNDRY_VERTS points, returns the number of vertices.
+ */
+int
+__h3_cached_boundary(H3Index index, Point *verts)
+{
+    GeometryCacheEntry *entry = geometry_cache_lookup(index);
+
+    if (entry == NULL) {
+        geometry_cache_misses++;
+        return geometry_compute_boundary(index, verts);
+    }
+
+    if (entry->has_boundary) {
+        geometry_cache_hits++;
+    }
+    else {
+        geometry_cache_misses++;
+        entry->num_verts = geometry_compute_boundary(index, entry->verts);
+        entry->has_boundary = true;
+    }
+    memcpy(verts, entry->verts, entry->num_verts * sizeof(Point));
+    return entry->num_verts;
+}
+
+
+PG_FUNCTION_INFO_V1(h3_geometry_cache_stats);
+
+/*
+ * The number of cells in the cache of the backend and the numbers of
+ * lookups answered from the cache and computed.
+ */
+Datum
+h3_geometry_cache_stats(PG_FUNCTION_ARGS)
+{
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        fail_and_report_with_code(ERRCODE_FEATURE_NOT_SUPPORTED,
+                "function returning record called in context that cannot accept type record");
+    }
+    tupdesc = BlessTupleDesc(tupdesc);
+
+    Datum values[4];
+    bool nulls[4] = {false, false, false, false};
+    values[0] = Int64GetDatum(geometry_cache != NULL ? hash_get_num_entries(geometry_cache) : 0);
+    values[1] = Int32GetDatum(__h3_geometry_cache_size());
+    values[2] = Int64GetDatum(geometry_cache_hits);
+    values[3] = Int64GetDatum(geometry_cache_misses);
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+
+PG_FUNCTION_INFO_V1(h3_geometry_cache_reset);
+
+/*
+ * Empty the cache of the backend and reset its counters.
+ */
+Datum
+h3_geometry_cache_reset(PG_FUNCTION_ARGS)
+{
+    if (geometry_cache != NULL) {
+        hash_destroy(geometry_cache);
+        geometry_cache = NULL;
+    }
+    geometry_cache_hits = 0;
+    geometry_cache_misses = 0;
+
+    PG_RETURN_VOID();
+}
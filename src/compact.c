@@ -25,261 +25,569 @@
 #include "utils/builtins.h"
 #include "fmgr.h"
 #include "utils/array.h"
-#include "utils/lsyscache.h"
 #include "funcapi.h"
+#include "utils/memutils.h"
+
+#include <stdlib.h>
+#include <string.h>
 
 #include <h3/h3api.h>
 
-/**
- * returns an allocated array of H3Indexes
+/*
+ * compact the indexes of the array using the compact function of H3.
+ * Returns the compacted indexes without holes, NULL when the array
+ * is empty.
  */
 static H3Index *
-pg_array_to_h3index_array(ArrayType *indexarray, int * num_indexes) 
+h3_compact_pg_array(ArrayType *uncompacted_indexes_array, int *num_compacted_indexes)
 {
-    *num_indexes = 0;
-    if (indexarray != NULL) {
-        int ndim = ARR_NDIM(indexarray);
+    *num_compacted_indexes = 0;
 
-        if (ndim != 1) {
-            fail_and_report("The array if h3indexes must be an 1-dimensional array");
-        }
+    // convert the indexes to their native format
+    int num_uncompacted_indexes = 0;
+    H3Index * uncompacted_indexes = __h3_index_array_from_pg(uncompacted_indexes_array, &num_uncompacted_indexes);
 
-        Oid elemtype = ARR_ELEMTYPE(indexarray);
-        if (elemtype != TEXTOID) {
-            fail_and_report("The type of the h3index array must be text");
+    if (num_uncompacted_indexes == 0) {
+        return NULL;
+    }
+
+    // allocate memory for the results
+    H3Index *compacted_indexes = __h3_polyfill_palloc0(num_uncompacted_indexes * sizeof(H3Index));
+
+    if (H3_EXPORT(compact)(uncompacted_indexes, compacted_indexes, num_uncompacted_indexes) != 0) {
+        pfree(uncompacted_indexes);
+        pfree(compacted_indexes);
+        fail_and_report("Error while compacting the h3 indexes");
+    }
+    pfree(uncompacted_indexes);
+
+    int num_compacted = 0;
+    for (int i = 0; i < num_uncompacted_indexes; i++) {
+        if (compacted_indexes[i] != 0) {
+            // fill the NULL "holes" in the list of hexagons with the
+            // hexagons located after them
+            compacted_indexes[num_compacted++] = compacted_indexes[i];
         }
+    }
 
-        int16       typlen;
-        bool        typbyval;
-        char        typalign;
-        get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+    report_debug1("Compacted %d H3 hexagons to %d",
+                num_uncompacted_indexes, num_compacted);
 
-        int *dim = ARR_DIMS(indexarray);
-        H3Index * h3indexes = palloc0(dim[0] * sizeof(H3Index));
+    *num_compacted_indexes = num_compacted;
+    return compacted_indexes;
+}
 
-        bool isnull;
-        Datum indexarray_datum = PointerGetDatum(indexarray);
-        for (int i = 1; i <= dim[0]; i++) {
 
-            Datum index_datum = array_get_element(indexarray_datum, ndim, &i,
-                        -1, typlen, typbyval, typalign, &isnull);
-            if (isnull) {
-                fail_and_report("h3 index at array position %d is null", i);
-            }
+PG_FUNCTION_INFO_V1(h3_compact);
+
+/*
+ * The compaction requires all indexes anyway, so the result is returned
+ * in materialize mode instead of one row per call.
+ */
+Datum
+h3_compact(PG_FUNCTION_ARGS)
+{
+    // early exit when no idexes are given
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_NULL();
+    }
 
-            text *index_text = DatumGetTextP(index_datum);
-            char * index_cstr = text_to_cstring(index_text);
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_COMPACT);
 
-            if (__h3_index_from_cstring(index_cstr, &(h3indexes[i-1])) == false) {
-                pfree(h3indexes);
-                fail_and_report("could not parse the h3 index at array position %d", i);
-                return NULL;
-            }
-        }
-        
-        (*num_indexes) = dim[0];
+    int num_compacted_indexes = 0;
+    H3Index *compacted_indexes = h3_compact_pg_array(PG_GETARG_ARRAYTYPE_P(0), &num_compacted_indexes);
+
+    __h3_index_srf_materialize(fcinfo, compacted_indexes, num_compacted_indexes);
 
-        return h3indexes;
+    if (compacted_indexes != NULL) {
+        pfree(compacted_indexes);
     }
 
-    return NULL;
+    __h3_stats_stop(&timer, 1, num_compacted_indexes);
+    return (Datum) 0;
 }
 
 
-PG_FUNCTION_INFO_V1(h3_compact);
+PG_FUNCTION_INFO_V1(h3_compact_array);
 
+/*
+ * Compact the indexes, returning an array.
+ */
 Datum
-h3_compact(PG_FUNCTION_ARGS)
+h3_compact_array(PG_FUNCTION_ARGS)
+{
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_COMPACT);
+
+    int num_compacted_indexes = 0;
+    H3Index *compacted_indexes = h3_compact_pg_array(PG_GETARG_ARRAYTYPE_P(0), &num_compacted_indexes);
+
+    ArrayType *result = __h3_index_array_to_pg(fcinfo, compacted_indexes, NULL, num_compacted_indexes);
+
+    if (compacted_indexes != NULL) {
+        pfree(compacted_indexes);
+    }
+
+    __h3_stats_stop(&timer, 1, num_compacted_indexes);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+/*
+ * state of h3_uncompact: the position in the array of compacted
+ * indexes and the iteration over the children of the current one
+ */
+typedef struct {
+    H3Index *compacted_indexes;
+    int num_compacted_indexes;
+    int position;
+    int resolution;
+    H3ChildIterator children;
+} H3UncompactState;
+
+/*
+ * indexes finer than the target resolution can not be uncompacted
+ */
+static void
+h3_uncompact_check_resolution(const H3Index *compacted_indexes, int num_compacted_indexes, int resolution)
+{
+    for (int i = 0; i < num_compacted_indexes; i++) {
+        if (compacted_indexes[i] != 0
+                && H3_EXPORT(h3GetResolution)(compacted_indexes[i]) > resolution) {
+            fail_and_report("Error while estimating the number of uncompacted indexes"
+                    " for %d compacted indexes and the target resolution %d", num_compacted_indexes, resolution);
+        }
+    }
+}
+
+PG_FUNCTION_INFO_V1(h3_uncompact);
+
+/*
+ * Uncompact the indexes one child per call instead of materializing the
+ * complete set, which grows by a factor of 7 per resolution.
+ */
+Datum
+h3_uncompact(PG_FUNCTION_ARGS)
 {
     FuncCallContext *funcctx;
-    int call_cntr = 0;
-    int max_calls = 0;
     MemoryContext oldcontext;
-    H3Index *compacted_indexes = NULL;
+    H3UncompactState *state = NULL;
 
     if (SRF_IS_FIRSTCALL()) {
         // early exit when no idexes are given
         if (PG_ARGISNULL(0)) {
             PG_RETURN_NULL();
         }
+        int resolution = PG_GETARG_INT32(1);
 
         funcctx = SRF_FIRSTCALL_INIT();
         oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
 
-        ArrayType * uncompacted_indexes_array = PG_GETARG_ARRAYTYPE_P(0);
+        ArrayType * compacted_indexes_array = PG_GETARG_ARRAYTYPE_P(0);
 
         // convert the indexes to their native format
-        int num_uncompacted_indexes = 0;
-        H3Index * uncompacted_indexes = pg_array_to_h3index_array(uncompacted_indexes_array, &num_uncompacted_indexes);
+        int num_compacted_indexes = 0;
+        H3Index * compacted_indexes = __h3_index_array_from_pg(compacted_indexes_array, &num_compacted_indexes);
 
-        if (num_uncompacted_indexes == 0) {
+        if (num_compacted_indexes == 0) {
             PG_RETURN_NULL(); // early exit - nothing to do
         }
 
-        // allocate memory for the results
-        compacted_indexes = __h3_polyfill_palloc0(num_uncompacted_indexes * sizeof(H3Index));
-
-        if (H3_EXPORT(compact)(uncompacted_indexes, compacted_indexes, num_uncompacted_indexes) != 0) {
-            pfree(uncompacted_indexes);
-            pfree(compacted_indexes);
-            fail_and_report("Error while compacting the h3 indexes");
-        }
-        pfree(uncompacted_indexes);
-
-        for (int i = 0; i < num_uncompacted_indexes; i++) {
-            if (compacted_indexes[i] != 0) {
-                if (i > max_calls) {
-                    // fill NULL "holes" in list of hexagons with the hexagons located
-                    // after the NULL value. This allows us to use call_cntr and max_calls
-                    // for iteration during SRF calls.
-                    compacted_indexes[max_calls] = compacted_indexes[i];
-                    compacted_indexes[i] = 0;
-                }
-                max_calls++;
-            }
-        }
+        // check all indexes before returning the first row
+        h3_uncompact_check_resolution(compacted_indexes, num_compacted_indexes, resolution);
 
-        report_debug1("Compacted %d H3 hexagons to %d",
-                    num_uncompacted_indexes, max_calls);
+        report_debug1("Uncompacting %d H3 hexagons to resolution %d",
+                    num_compacted_indexes, resolution);
 
-        if (max_calls > 0) {
-            // keep track of the results
-            funcctx->max_calls = max_calls;
-            funcctx->user_fctx = compacted_indexes;
-        }
-        else {
-            // fast track when no results
-            pfree(compacted_indexes);
-            compacted_indexes = NULL;
+        state = palloc0(sizeof(H3UncompactState));
+        state->compacted_indexes = compacted_indexes;
+        state->num_compacted_indexes = num_compacted_indexes;
+        state->position = -1;
+        state->resolution = resolution;
+        funcctx->user_fctx = state;
 
-            MemoryContextSwitchTo(oldcontext);
-            SRF_RETURN_DONE(funcctx);
-        }
         MemoryContextSwitchTo(oldcontext);
     }
 
     // stuff done on every call of the function
     funcctx = SRF_PERCALL_SETUP();
+    state = funcctx->user_fctx;
 
-    // Initialize per-call variables
-    call_cntr = funcctx->call_cntr;
-    max_calls = funcctx->max_calls;
-    compacted_indexes = funcctx->user_fctx;
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_UNCOMPACT);
 
-    if (call_cntr < max_calls) {
-        text * index_text = __h3_index_to_text(compacted_indexes[call_cntr]);
-        SRF_RETURN_NEXT(funcctx, PointerGetDatum(index_text));
+    H3Index child = __h3_child_iterator_next(&state->children);
+    while (child == 0 && state->position + 1 < state->num_compacted_indexes) {
+        state->position++;
+        H3Index compacted_index = state->compacted_indexes[state->position];
+        if (compacted_index == 0) {
+            continue;
+        }
+        __h3_child_iterator_init(&state->children, compacted_index, state->resolution);
+        child = __h3_child_iterator_next(&state->children);
     }
-    else {
-        pfree(compacted_indexes);
-        compacted_indexes = NULL;
+    __h3_stats_stop(&timer, funcctx->call_cntr == 0 ? 1 : 0, child != 0 ? 1 : 0);
 
+    if (child != 0) {
+        SRF_RETURN_NEXT(funcctx, H3IndexGetDatum(child));
+    }
+    else {
         SRF_RETURN_DONE(funcctx);
     }
-
 }
 
 
-PG_FUNCTION_INFO_V1(h3_uncompact);
+PG_FUNCTION_INFO_V1(h3_uncompact_array);
 
+/*
+ * Uncompact the indexes, returning an array.
+ */
 Datum
-h3_uncompact(PG_FUNCTION_ARGS)
+h3_uncompact_array(PG_FUNCTION_ARGS)
 {
-    FuncCallContext *funcctx;
-    int call_cntr = 0;
-    int max_calls = 0;
-    MemoryContext oldcontext;
-    H3Index *uncompacted_indexes = NULL;
+    ArrayType *compacted_indexes_array = PG_GETARG_ARRAYTYPE_P(0);
+    int resolution = PG_GETARG_INT32(1);
 
-    if (SRF_IS_FIRSTCALL()) {
-        // early exit when no idexes are given
-        if (PG_ARGISNULL(0)) {
-            PG_RETURN_NULL();
-        }
-        int resolution = PG_GETARG_INT32(1);
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_UNCOMPACT);
 
-        funcctx = SRF_FIRSTCALL_INIT();
-        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+    int num_compacted_indexes = 0;
+    H3Index *compacted_indexes = __h3_index_array_from_pg(compacted_indexes_array, &num_compacted_indexes);
 
-        ArrayType * compacted_indexes_array = PG_GETARG_ARRAYTYPE_P(0);
+    h3_uncompact_check_resolution(compacted_indexes, num_compacted_indexes, resolution);
 
-        // convert the indexes to their native format
-        int num_compacted_indexes = 0;
-        H3Index * compacted_indexes = pg_array_to_h3index_array(compacted_indexes_array, &num_compacted_indexes);
+    int64 num_uncompacted_indexes = 0;
+    for (int i = 0; i < num_compacted_indexes; i++) {
+        if (compacted_indexes[i] != 0) {
+            num_uncompacted_indexes += __h3_child_count(compacted_indexes[i], resolution);
+        }
+    }
+    H3Index *uncompacted_indexes = __h3_index_array_buffer(num_uncompacted_indexes);
 
-        if (num_compacted_indexes == 0) {
-            PG_RETURN_NULL(); // early exit - nothing to do
+    int64 pos = 0;
+    for (int i = 0; i < num_compacted_indexes; i++) {
+        if (compacted_indexes[i] == 0) {
+            continue;
         }
+        H3ChildIterator iter;
+        __h3_child_iterator_init(&iter, compacted_indexes[i], resolution);
 
-        // estimate the number of uncompacted indexes
-        int num_estimated_uncompacted_indexes = H3_EXPORT(maxUncompactSize)(compacted_indexes,
-                        num_compacted_indexes, resolution);
-        if (num_estimated_uncompacted_indexes < 0) {
-            pfree(compacted_indexes);
-            fail_and_report("Error while estimating the number of uncompacted indexes"
-                    " for %d compacted indexes and the target resolution %d", num_compacted_indexes, resolution);
+        H3Index child;
+        while ((child = __h3_child_iterator_next(&iter)) != 0) {
+            uncompacted_indexes[pos++] = child;
         }
+    }
 
-        // allocate memory for the results
-        uncompacted_indexes = __h3_polyfill_palloc0(num_estimated_uncompacted_indexes * sizeof(H3Index));
+    ArrayType *result = __h3_index_array_to_pg(fcinfo, uncompacted_indexes, NULL, (int) pos);
 
-        if (H3_EXPORT(uncompact)(compacted_indexes, num_compacted_indexes,
-                        uncompacted_indexes, num_estimated_uncompacted_indexes, resolution) != 0) {
-            pfree(uncompacted_indexes);
-            pfree(compacted_indexes);
-            fail_and_report("Error while uncompacting the h3 indexes");
-        }
+    pfree(uncompacted_indexes);
+    if (compacted_indexes != NULL) {
         pfree(compacted_indexes);
+    }
+
+    __h3_stats_stop(&timer, 1, pos);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+/*
+ * Compaction of sets of indexes with mixed resolutions
+ *
+ * The compact function of H3 requires all indexes to have the same
+ * resolution, which is not the case for sets which have been compacted
+ * partially. This compaction sorts the indexes in the hierarchical order
+ * of the btree operator class, removes duplicates and indexes contained
+ * in other indexes of the set and then replaces complete sets of children
+ * by their parent, from the finest resolution to the coarsest.
+ */
+
+static int
+h3_index_qsort_cmp(const void *a, const void *b)
+{
+    return __h3_index_cmp(*((const H3Index *) a), *((const H3Index *) b));
+}
 
-        for (int i = 0; i < num_estimated_uncompacted_indexes; i++) {
-            if (uncompacted_indexes[i] != 0) {
-                if (i > max_calls) {
-                    // fill NULL "holes" in list of hexagons with the hexagons located
-                    // after the NULL value. This allows us to use call_cntr and max_calls
-                    // for iteration during SRF calls.
-                    uncompacted_indexes[max_calls] = uncompacted_indexes[i];
-                    uncompacted_indexes[i] = 0;
+/*
+ * compact the indexes in place, returns the new number of indexes. The
+ * result is sorted in the order of the btree operator class.
+ */
+int64
+__h3_compact_mixed(H3Index *indexes, int64 num_indexes)
+{
+    if (num_indexes == 0) {
+        return 0;
+    }
+
+    qsort(indexes, num_indexes, sizeof(H3Index), h3_index_qsort_cmp);
+    return __h3_compact_sorted(indexes, num_indexes);
+}
+
+/*
+ * compact indexes already sorted in the order of the btree operator
+ * class in place, returns the new number of indexes.
+ */
+int64
+__h3_compact_sorted(H3Index *indexes, int64 num_indexes)
+{
+    // The descendants of an index are sorted directly before it, so walking
+    // backwards the contained indexes directly follow the index containing them.
+    int64 num_kept = 0;
+    H3Index cover = 0;
+    for (int64 i = num_indexes - 1; i >= 0; i--) {
+        if (cover != 0 && __h3_index_contains(cover, indexes[i])) {
+            continue;
+        }
+        cover = indexes[i];
+        indexes[num_indexes - 1 - num_kept] = cover;
+        num_kept++;
+    }
+    memmove(indexes, indexes + num_indexes - num_kept, num_kept * sizeof(H3Index));
+    num_indexes = num_kept;
+
+    // The children of a parent are sorted directly before the parent and the
+    // set is free of nested indexes, so complete sets of children are
+    // consecutive and the parent takes the position of the last child.
+    for (int res = PGH3_MAX_RES; res > 0; res--) {
+        int64 out = 0;
+        int64 i = 0;
+        while (i < num_indexes) {
+            if (H3_EXPORT(h3GetResolution)(indexes[i]) != res) {
+                indexes[out++] = indexes[i++];
+                continue;
+            }
+
+            H3Index parent = H3_EXPORT(h3ToParent)(indexes[i], res - 1);
+            int64 run_end = i + 1;
+            while (run_end < num_indexes
+                    && H3_EXPORT(h3GetResolution)(indexes[run_end]) == res
+                    && H3_EXPORT(h3ToParent)(indexes[run_end], res - 1) == parent) {
+                run_end++;
+            }
+
+            int num_children = H3_EXPORT(h3IsPentagon)(parent) ? 6 : 7;
+            if (run_end - i == num_children) {
+                indexes[out++] = parent;
+            }
+            else {
+                while (i < run_end) {
+                    indexes[out++] = indexes[i++];
                 }
-                max_calls++;
             }
+            i = run_end;
         }
+        num_indexes = out;
+    }
+
+    return num_indexes;
+}
+
 
-        report_debug1("Uncompacted %d H3 hexagons to %d",
-                    num_compacted_indexes, max_calls);
+/*
+ * The h3_compact_agg aggregate
+ *
+ * The transition state is a growing buffer of native indexes. It is
+ * compacted whenever it has grown to twice its size after the last
+ * compaction, before being serialized to be sent from a parallel worker
+ * and by the final function.
+ */
+
+// number of indexes before the state is compacted for the first time
+#define COMPACT_AGG_MIN_COMPACT_SIZE    (1 << 20)
+
+typedef struct {
+    H3Index *indexes;
+    int64 num_indexes;
+    int64 size;
+    int64 compact_at;
+} H3CompactAggState;
 
-        if (max_calls > 0) {
-            // keep track of the results
-            funcctx->max_calls = max_calls;
-            funcctx->user_fctx = uncompacted_indexes;
+static H3CompactAggState *
+h3_compact_agg_state_create(MemoryContext context, int64 size)
+{
+    H3CompactAggState *state = MemoryContextAlloc(context, sizeof(H3CompactAggState));
+
+    state->size = Max(size, 64);
+    state->indexes = MemoryContextAllocHuge(context, state->size * sizeof(H3Index));
+    state->num_indexes = 0;
+    state->compact_at = COMPACT_AGG_MIN_COMPACT_SIZE;
+    return state;
+}
+
+static void
+h3_compact_agg_state_compact(H3CompactAggState *state)
+{
+    state->num_indexes = __h3_compact_mixed(state->indexes, state->num_indexes);
+    state->compact_at = Max(state->num_indexes * 2, COMPACT_AGG_MIN_COMPACT_SIZE);
+}
+
+/*
+ * make room for additional indexes. The buffer is reallocated in the
+ * memory context it has been allocated in.
+ */
+static void
+h3_compact_agg_state_reserve(H3CompactAggState *state, int64 num_additional)
+{
+    if (state->num_indexes + num_additional > state->compact_at) {
+        h3_compact_agg_state_compact(state);
+    }
+    if (state->num_indexes + num_additional > state->size) {
+        state->size = Max(state->size * 2, state->num_indexes + num_additional);
+        state->indexes = repalloc_huge(state->indexes, state->size * sizeof(H3Index));
+    }
+}
+
+
+PG_FUNCTION_INFO_V1(h3_compact_agg_transfn);
+
+Datum
+h3_compact_agg_transfn(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggcontext;
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "h3_compact_agg_transfn called in non-aggregate context");
+    }
+
+    H3CompactAggState *state = PG_ARGISNULL(0) ? NULL : (H3CompactAggState *) PG_GETARG_POINTER(0);
+
+    if (PG_ARGISNULL(1)) {
+        if (state == NULL) {
+            PG_RETURN_NULL();
         }
-        else {
-            // fast track when no results
-            pfree(uncompacted_indexes);
-            uncompacted_indexes = NULL;
+        PG_RETURN_POINTER(state);
+    }
+
+    if (state == NULL) {
+        state = h3_compact_agg_state_create(aggcontext, 0);
+    }
+
+    h3_compact_agg_state_reserve(state, 1);
+    state->indexes[state->num_indexes++] = PG_GETARG_H3INDEX(1);
+
+    PG_RETURN_POINTER(state);
+}
+
+
+PG_FUNCTION_INFO_V1(h3_compact_agg_combinefn);
 
-            MemoryContextSwitchTo(oldcontext);
-            SRF_RETURN_DONE(funcctx);
+Datum
+h3_compact_agg_combinefn(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggcontext;
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "h3_compact_agg_combinefn called in non-aggregate context");
+    }
+
+    H3CompactAggState *state1 = PG_ARGISNULL(0) ? NULL : (H3CompactAggState *) PG_GETARG_POINTER(0);
+    H3CompactAggState *state2 = PG_ARGISNULL(1) ? NULL : (H3CompactAggState *) PG_GETARG_POINTER(1);
+
+    if (state2 == NULL) {
+        if (state1 == NULL) {
+            PG_RETURN_NULL();
         }
-        MemoryContextSwitchTo(oldcontext);
+        PG_RETURN_POINTER(state1);
     }
 
-    // stuff done on every call of the function
-    funcctx = SRF_PERCALL_SETUP();
+    // the state must be allocated in the aggregate context
+    if (state1 == NULL) {
+        state1 = h3_compact_agg_state_create(aggcontext, state2->num_indexes);
+    }
+
+    h3_compact_agg_state_reserve(state1, state2->num_indexes);
+    memcpy(state1->indexes + state1->num_indexes, state2->indexes,
+                state2->num_indexes * sizeof(H3Index));
+    state1->num_indexes += state2->num_indexes;
+
+    PG_RETURN_POINTER(state1);
+}
+
 
-    // Initialize per-call variables
-    call_cntr = funcctx->call_cntr;
-    max_calls = funcctx->max_calls;
-    uncompacted_indexes = funcctx->user_fctx;
+PG_FUNCTION_INFO_V1(h3_compact_agg_serialfn);
 
-    if (call_cntr < max_calls) {
-        text * index_text = __h3_index_to_text(uncompacted_indexes[call_cntr]);
-        SRF_RETURN_NEXT(funcctx, PointerGetDatum(index_text));
+/*
+ * the serialized state is the compacted set of indexes as a vector
+ * of native indexes
+ */
+Datum
+h3_compact_agg_serialfn(PG_FUNCTION_ARGS)
+{
+    H3CompactAggState *state = (H3CompactAggState *) PG_GETARG_POINTER(0);
+
+    h3_compact_agg_state_compact(state);
+
+    Size size = VARHDRSZ + state->num_indexes * sizeof(H3Index);
+    if (!AllocSizeIsValid(size)) {
+        fail_and_report_with_code(ERRCODE_PROGRAM_LIMIT_EXCEEDED,
+                "The partially compacted set of %ld h3 indexes is too large to be serialized",
+                (long) state->num_indexes);
     }
-    else {
-        pfree(uncompacted_indexes);
-        uncompacted_indexes = NULL;
 
-        SRF_RETURN_DONE(funcctx);
+    bytea *result = palloc(size);
+    SET_VARSIZE(result, size);
+    memcpy(VARDATA(result), state->indexes, state->num_indexes * sizeof(H3Index));
+
+    PG_RETURN_BYTEA_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(h3_compact_agg_deserialfn);
+
+Datum
+h3_compact_agg_deserialfn(PG_FUNCTION_ARGS)
+{
+    bytea *serialized = PG_GETARG_BYTEA_PP(0);
+
+    int64 num_indexes = VARSIZE_ANY_EXHDR(serialized) / sizeof(H3Index);
+
+    H3CompactAggState *state = h3_compact_agg_state_create(CurrentMemoryContext, num_indexes);
+    memcpy(state->indexes, VARDATA_ANY(serialized), num_indexes * sizeof(H3Index));
+    state->num_indexes = num_indexes;
+
+    PG_RETURN_POINTER(state);
+}
+
+
+PG_FUNCTION_INFO_V1(h3_compact_agg_finalfn);
+
+Datum
+h3_compact_agg_finalfn(PG_FUNCTION_ARGS)
+{
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_NULL();
     }
 
+    H3CompactAggState *state = (H3CompactAggState *) PG_GETARG_POINTER(0);
+
+    // compacting keeps the set of covered cells, so the state stays
+    // valid for further calls
+    h3_compact_agg_state_compact(state);
+
+    if (state->num_indexes > INT_MAX) {
+        fail_and_report_with_code(ERRCODE_PROGRAM_LIMIT_EXCEEDED,
+                "The compacted set of %ld h3 indexes is too large for an array",
+                (long) state->num_indexes);
+    }
+
+    PG_RETURN_ARRAYTYPE_P(__h3_index_array_to_pg(fcinfo, state->indexes, NULL,
+                (int) state->num_indexes));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_agg_finalfn);
+
+/*
+ * the final function of h3set_agg, which shares the state of h3_compact_agg
+ */
+Datum
+h3set_agg_finalfn(PG_FUNCTION_ARGS)
+{
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_NULL();
+    }
+
+    H3CompactAggState *state = (H3CompactAggState *) PG_GETARG_POINTER(0);
+
+    h3_compact_agg_state_compact(state);
+
+    PG_RETURN_H3SET_P(__h3_set_from_sorted(state->indexes, state->num_indexes));
 }
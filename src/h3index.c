@@ -0,0 +1,156 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "utils/builtins.h"
+#include "fmgr.h"
+#include "libpq/pqformat.h"
+
+#include <h3/h3api.h>
+
+
+/*
+ * The h3index type
+ *
+ * A H3 index is stored in its native 64bit integer form as a
+ * pass-by-value datum. The text representation is the hexadecimal
+ * string used by the H3 library itself.
+ */
+
+PG_FUNCTION_INFO_V1(h3index_in);
+
+Datum
+h3index_in(PG_FUNCTION_ARGS)
+{
+    char *index_cstr = PG_GETARG_CSTRING(0);
+
+    H3Index index;
+    __h3_index_from_cstring(index_cstr, &index);
+
+    PG_RETURN_H3INDEX(index);
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_out);
+
+Datum
+h3index_out(PG_FUNCTION_ARGS)
+{
+    H3Index index = PG_GETARG_H3INDEX(0);
+
+    char *index_cstr = palloc(H3_INDEX_STR_LEN * sizeof(char));
+    H3_EXPORT(h3ToString)(index, index_cstr, H3_INDEX_STR_LEN);
+
+    PG_RETURN_CSTRING(index_cstr);
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_recv);
+
+/*
+ * binary input: the index as a 64bit integer in network byte order
+ */
+Datum
+h3index_recv(PG_FUNCTION_ARGS)
+{
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+
+    H3Index index = (H3Index) pq_getmsgint64(buf);
+
+    if (!PGH3_INDEX_IS_STORABLE(index)) {
+        fail_and_report_with_code(ERRCODE_INVALID_BINARY_REPRESENTATION,
+                "The value " UINT64_FORMAT " is not a H3 index", index);
+    }
+
+    PG_RETURN_H3INDEX(index);
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_send);
+
+/*
+ * binary output
+ */
+Datum
+h3index_send(PG_FUNCTION_ARGS)
+{
+    H3Index index = PG_GETARG_H3INDEX(0);
+
+    StringInfoData buf;
+    pq_begintypsend(&buf);
+    pq_sendint64(&buf, (int64) index);
+
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_to_text);
+
+/*
+ * cast h3index -> text
+ */
+Datum
+h3index_to_text(PG_FUNCTION_ARGS)
+{
+    H3Index index = PG_GETARG_H3INDEX(0);
+    PG_RETURN_TEXT_P(__h3_index_to_text(index));
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_from_text);
+
+/*
+ * cast text -> h3index
+ */
+Datum
+h3index_from_text(PG_FUNCTION_ARGS)
+{
+    text *index_text = PG_GETARG_TEXT_P(0);
+    char * index_cstr = text_to_cstring(index_text);
+
+    H3Index index;
+    __h3_index_from_cstring(index_cstr, &index);
+    pfree(index_cstr);
+
+    PG_RETURN_H3INDEX(index);
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_from_bigint);
+
+/*
+ * cast bigint -> h3index
+ *
+ * The cast in the other direction is binary coercible and does
+ * not require a function.
+ */
+Datum
+h3index_from_bigint(PG_FUNCTION_ARGS)
+{
+    int64 value = PG_GETARG_INT64(0);
+
+    if (!PGH3_INDEX_IS_STORABLE(value)) {
+        fail_and_report_with_code(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE,
+                "The value " INT64_FORMAT " is not a H3 index", value);
+    }
+
+    PG_RETURN_H3INDEX((H3Index) value);
+}
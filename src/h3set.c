@@ -0,0 +1,1147 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "funcapi.h"
+#include "libpq/pqformat.h"
+#include "utils/datum.h"
+#include "utils/memutils.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include <h3/h3api.h>
+
+/*
+ * The h3set type
+ *
+ * A set of cells stored in its compacted form: sorted in the order of the
+ * btree operator class, without duplicates, without cells contained in
+ * other cells of the set and without complete sets of siblings. A set
+ * containing a cell therefore contains all of its descendants, and equal
+ * sets have equal representations.
+ *
+ * In this order the descendants of a cell are the interval between the
+ * lower bound of its descendants and the cell itself. As the cells of a
+ * set are not nested, the first cell of a set not sorted before a cell is
+ * the only one which may contain it. All operations are merges or
+ * binary searches over the sorted cells and never expand a cell unless
+ * a part of it has to be removed.
+ *
+ * Storage
+ *
+ * The cells are split into chunks of H3SET_CHUNK_CELLS cells. The header
+ * is followed by a directory holding the first cell of each chunk and
+ * the position of its encoded cells, followed by the encoded chunks. The
+ * further cells of a chunk are stored relative to their predecessor as
+ * a varint of
+ *
+ *     (key delta >> shift) << H3SET_RES_BITS | resolution
+ *
+ * where the key delta is the difference of the PGH3_ORDER_KEY of both
+ * cells and shift is the digit offset of the finer resolution of both.
+ * The unused digits of both cells are all ones below that offset, so
+ * the delta has no bits there. Cells close to each other differ by a few
+ * units of their last digit and take one or two bytes instead of eight.
+ *
+ * As the directory has a fixed position, a probe for a single cell reads
+ * the header, binary searches the directory and decodes a single chunk.
+ * The type uses the external storage, so these reads fetch only the
+ * toast chunks they touch instead of detoasting the complete value. pglz
+ * would hardly shrink the encoded cells anyway.
+ */
+
+#define H3SET_CHUNK_CELLS       256
+#define H3SET_RES_BITS          4
+
+#define H3SET_CHUNKS(s)         ((H3SetChunk *) ((char *) (s) + sizeof(H3Set)))
+#define H3SET_DATA_OFFSET(num_chunks) (sizeof(H3Set) + (Size) (num_chunks) * sizeof(H3SetChunk))
+
+#define h3set_fail_corrupted() \
+    fail_and_report_with_code(ERRCODE_DATA_CORRUPTED, "Corrupted h3set value")
+
+/*
+ * the order of __h3_index_cmp, written without branches
+ */
+static inline bool
+h3set_less(H3Index a, H3Index b)
+{
+    uint64 key_a = PGH3_ORDER_KEY(a);
+    uint64 key_b = PGH3_ORDER_KEY(b);
+    return (key_a < key_b) | ((key_a == key_b) & (a < b));
+}
+
+/*
+ * Check if the cell is the parent itself or one of its descendants
+ * using only the bits of the indexes.
+ */
+static inline bool
+h3set_cell_contains(H3Index parent, H3Index cell)
+{
+    int parent_res = (int) ((parent & PGH3_RES_MASK) >> PGH3_RES_OFFSET);
+    int cell_res = (int) ((cell & PGH3_RES_MASK) >> PGH3_RES_OFFSET);
+    uint64 digits_mask = (UINT64CONST(1) << PGH3_DIGIT_OFFSET(parent_res)) - 1;
+
+    return (cell_res >= parent_res)
+        & ((PGH3_ORDER_KEY(parent) & ~digits_mask) == (PGH3_ORDER_KEY(cell) & ~digits_mask));
+}
+
+/*
+ * the first position in [from, to) not sorted before key
+ */
+static inline int64
+h3set_lower_bound(const H3Index *cells, int64 from, int64 to, H3Index key)
+{
+    if (from >= to) {
+        return to;
+    }
+    const H3Index *base = cells + from;
+    int64 len = to - from;
+    while (len > 1) {
+        int64 half = len / 2;
+        base += h3set_less(base[half], key) ? half : 0;
+        len -= half;
+    }
+    return (base - cells) + h3set_less(*base, key);
+}
+
+/*
+ * lower bound starting at from with exponentially growing steps, fast
+ * when the position is close to from
+ */
+static inline int64
+h3set_gallop(const H3Index *cells, int64 from, int64 to, H3Index key)
+{
+    int64 low = from;
+    int64 step = 1;
+    while (low < to && h3set_less(cells[Min(low + step, to) - 1], key)) {
+        low = Min(low + step, to);
+        step *= 2;
+    }
+    return h3set_lower_bound(cells, low, Min(low + step, to), key);
+}
+
+
+static inline int
+h3set_res(H3Index cell)
+{
+    return (int) ((cell & PGH3_RES_MASK) >> PGH3_RES_OFFSET);
+}
+
+/*
+ * Check the bits the encoding relies on: cell mode, no reserved bits and
+ * all digits below the resolution unused.
+ */
+static inline bool
+h3set_is_cell(H3Index cell)
+{
+    uint64 unused_digits = (UINT64CONST(1) << PGH3_DIGIT_OFFSET(h3set_res(cell))) - 1;
+    return ((cell >> PGH3_MODE_OFFSET) == PGH3_CELL_MODE) & ((cell & unused_digits) == unused_digits);
+}
+
+static inline uint64
+h3set_delta_encode(H3Index prev, H3Index cell)
+{
+    int res = h3set_res(cell);
+    int shift = PGH3_DIGIT_OFFSET(Max(h3set_res(prev), res));
+    uint64 delta = PGH3_ORDER_KEY(cell) - PGH3_ORDER_KEY(prev);
+    return ((delta >> shift) << H3SET_RES_BITS) | (uint64) res;
+}
+
+static inline H3Index
+h3set_delta_decode(H3Index prev, uint64 value)
+{
+    int res = (int) (value & ((1 << H3SET_RES_BITS) - 1));
+    int shift = PGH3_DIGIT_OFFSET(Max(h3set_res(prev), res));
+    uint64 delta = (value >> H3SET_RES_BITS) << shift;
+    return (PGH3_ORDER_KEY(prev) + delta) | ((uint64) res << PGH3_RES_OFFSET);
+}
+
+static inline int
+h3set_varint_size(uint64 value)
+{
+    int size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static inline uint8 *
+h3set_varint_write(uint8 *p, uint64 value)
+{
+    while (value >= 0x80) {
+        *p++ = (uint8) (value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8) value;
+    return p;
+}
+
+static inline int
+h3set_chunk_num_cells(const H3Set *header, int32 chunk)
+{
+    return (chunk + 1 < header->num_chunks)
+        ? header->chunk_cells
+        : (int) (header->num_cells - (int64) chunk * header->chunk_cells);
+}
+
+/*
+ * decode the num_cells cells of a chunk from its encoded cells in data
+ */
+static void
+h3set_decode_chunk(const H3SetChunk *chunk, const uint8 *data, int num_cells, H3Index *cells)
+{
+    const uint8 *end = data + chunk->length;
+    H3Index prev = chunk->first;
+
+    cells[0] = prev;
+    for (int i = 1; i < num_cells; i++) {
+        uint64 value = 0;
+        int shift = 0;
+        uint8 byte;
+        do {
+            if (data == end || shift > 63) {
+                h3set_fail_corrupted();
+            }
+            byte = *data++;
+            value |= (uint64) (byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        prev = h3set_delta_decode(prev, value);
+        cells[i] = prev;
+    }
+}
+
+static void
+h3set_check_header(const H3Set *header)
+{
+    if (header->format != H3SET_FORMAT_DELTA) {
+        fail_and_report_with_code(ERRCODE_DATA_CORRUPTED,
+                "Unsupported h3set format %d", header->format);
+    }
+    if (header->num_cells < 0 || header->chunk_cells <= 0
+            || header->num_chunks != (header->num_cells + header->chunk_cells - 1) / header->chunk_cells) {
+        h3set_fail_corrupted();
+    }
+}
+
+
+/*
+ * a set of compacted cells sorted in the order of the btree operator class
+ */
+H3Set *
+__h3_set_from_sorted(const H3Index *cells, int64 num_cells)
+{
+    int64 num_chunks = (num_cells + H3SET_CHUNK_CELLS - 1) / H3SET_CHUNK_CELLS;
+
+    Size size = H3SET_DATA_OFFSET(num_chunks);
+    for (int64 i = 0; i < num_cells; i++) {
+        if (!h3set_is_cell(cells[i])) {
+            char index_cstr[H3_INDEX_STR_LEN];
+            H3_EXPORT(h3ToString)(cells[i], index_cstr, H3_INDEX_STR_LEN);
+            fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                    "The index %s is not a valid cell", index_cstr);
+        }
+        if (i % H3SET_CHUNK_CELLS != 0) {
+            size += h3set_varint_size(h3set_delta_encode(cells[i - 1], cells[i]));
+        }
+    }
+    if (!AllocSizeIsValid(size)) {
+        fail_and_report_with_code(ERRCODE_PROGRAM_LIMIT_EXCEEDED,
+                "The set of %ld cells exceeds the maximum size of a value", (long) num_cells);
+    }
+
+    H3Set *set = palloc0(size);
+    SET_VARSIZE(set, size);
+    set->format = H3SET_FORMAT_DELTA;
+    set->num_cells = num_cells;
+    set->num_chunks = (int32) num_chunks;
+    set->chunk_cells = H3SET_CHUNK_CELLS;
+
+    H3SetChunk *chunks = H3SET_CHUNKS(set);
+    uint8 *data = (uint8 *) set + H3SET_DATA_OFFSET(num_chunks);
+    uint8 *p = data;
+    for (int64 chunk = 0; chunk < num_chunks; chunk++) {
+        int64 from = chunk * H3SET_CHUNK_CELLS;
+        int64 to = Min(from + H3SET_CHUNK_CELLS, num_cells);
+
+        chunks[chunk].first = cells[from];
+        chunks[chunk].offset = (uint32) (p - data);
+        for (int64 i = from + 1; i < to; i++) {
+            p = h3set_varint_write(p, h3set_delta_encode(cells[i - 1], cells[i]));
+        }
+        chunks[chunk].length = (uint32) (p - data) - chunks[chunk].offset;
+    }
+    return set;
+}
+
+/*
+ * the cells of a detoasted set
+ */
+H3Index *
+__h3_set_decode(const H3Set *set, int64 *num_cells)
+{
+    h3set_check_header(set);
+
+    Size data_size = VARSIZE(set) - H3SET_DATA_OFFSET(set->num_chunks);
+    if (VARSIZE(set) < H3SET_DATA_OFFSET(set->num_chunks)) {
+        h3set_fail_corrupted();
+    }
+
+    H3Index *cells = MemoryContextAllocHuge(CurrentMemoryContext,
+                Max(set->num_cells, 1) * sizeof(H3Index));
+    const H3SetChunk *chunks = H3SET_CHUNKS(set);
+    const uint8 *data = (const uint8 *) set + H3SET_DATA_OFFSET(set->num_chunks);
+
+    for (int32 chunk = 0; chunk < set->num_chunks; chunk++) {
+        if ((Size) chunks[chunk].offset + chunks[chunk].length > data_size) {
+            h3set_fail_corrupted();
+        }
+        h3set_decode_chunk(&chunks[chunk], data + chunks[chunk].offset,
+                h3set_chunk_num_cells(set, chunk),
+                cells + (int64) chunk * set->chunk_cells);
+    }
+
+    *num_cells = set->num_cells;
+    return cells;
+}
+
+
+/*
+ * Sequential and random access to the cells of a set one chunk at a
+ * time. Values stored out of line are read in slices of the header, the
+ * directory entries and the chunks, all other values are detoasted once.
+ */
+typedef struct {
+    struct varlena *value;      // the value as passed to the function
+    H3Set *set;                 // the detoasted value, NULL when reading slices
+    H3Set header;
+    H3Index *cells;             // the decoded cells of the current chunk
+    int32 chunk;                // the current chunk, -1 before the first one
+    int num_chunk_cells;
+    int next;                   // the position of the next cell in the chunk
+} H3SetReader;
+
+/*
+ * copy length bytes of the value starting at offset, which is counted
+ * from the start of the H3Set
+ */
+static void
+h3set_reader_read(H3SetReader *reader, Size offset, Size length, void *dest)
+{
+    if (length == 0) {
+        return;
+    }
+    if (reader->set != NULL) {
+        if (offset + length > VARSIZE(reader->set)) {
+            h3set_fail_corrupted();
+        }
+        memcpy(dest, (char *) reader->set + offset, length);
+        return;
+    }
+
+    struct varlena *slice = pg_detoast_datum_slice(reader->value,
+                (int32) (offset - VARHDRSZ), (int32) length);
+    if (VARSIZE_ANY_EXHDR(slice) < length) {
+        h3set_fail_corrupted();
+    }
+    memcpy(dest, VARDATA_ANY(slice), length);
+    pfree(slice);
+}
+
+static void
+h3set_reader_init(H3SetReader *reader, Datum value)
+{
+    reader->value = (struct varlena *) DatumGetPointer(value);
+    if (VARATT_IS_EXTERNAL_ONDISK(reader->value)) {
+        reader->set = NULL;
+    }
+    else {
+        reader->set = DatumGetH3SetP(value);
+    }
+    h3set_reader_read(reader, VARHDRSZ, sizeof(H3Set) - VARHDRSZ,
+            (char *) &reader->header + VARHDRSZ);
+    h3set_check_header(&reader->header);
+
+    reader->cells = palloc(reader->header.chunk_cells * sizeof(H3Index));
+    reader->chunk = -1;
+    reader->num_chunk_cells = 0;
+    reader->next = 0;
+}
+
+static void
+h3set_reader_chunk(H3SetReader *reader, int32 chunk, H3SetChunk *entry)
+{
+    h3set_reader_read(reader, sizeof(H3Set) + chunk * sizeof(H3SetChunk),
+            sizeof(H3SetChunk), entry);
+}
+
+static void
+h3set_reader_load(H3SetReader *reader, int32 chunk)
+{
+    H3SetChunk entry;
+    h3set_reader_chunk(reader, chunk, &entry);
+
+    uint8 *data = palloc(Max(entry.length, 1));
+    h3set_reader_read(reader, H3SET_DATA_OFFSET(reader->header.num_chunks) + entry.offset,
+            entry.length, data);
+
+    reader->num_chunk_cells = h3set_chunk_num_cells(&reader->header, chunk);
+    h3set_decode_chunk(&entry, data, reader->num_chunk_cells, reader->cells);
+    pfree(data);
+
+    reader->chunk = chunk;
+    reader->next = 0;
+}
+
+static bool
+h3set_reader_next(H3SetReader *reader, H3Index *cell)
+{
+    if (reader->next == reader->num_chunk_cells) {
+        if (reader->chunk + 1 >= reader->header.num_chunks) {
+            return false;
+        }
+        h3set_reader_load(reader, reader->chunk + 1);
+    }
+    *cell = reader->cells[reader->next++];
+    return true;
+}
+
+/*
+ * Check if the set contains the cell. Only the directory entries of the
+ * binary search and a single chunk are read.
+ */
+static bool
+h3set_reader_covers(H3SetReader *reader, H3Index cell)
+{
+    int32 num_chunks = reader->header.num_chunks;
+    H3SetChunk entry;
+
+    // the number of chunks starting at or before the cell
+    int32 low = 0;
+    int32 high = num_chunks;
+    while (low < high) {
+        int32 mid = low + (high - low) / 2;
+        h3set_reader_chunk(reader, mid, &entry);
+        if (h3set_less(cell, entry.first)) {
+            high = mid;
+        }
+        else {
+            low = mid + 1;
+        }
+    }
+
+    // the first cell not sorted before the cell is in the last of these
+    // chunks or starts the next one
+    if (low > 0) {
+        if (reader->chunk != low - 1) {
+            h3set_reader_load(reader, low - 1);
+        }
+        int64 pos = h3set_lower_bound(reader->cells, 0, reader->num_chunk_cells, cell);
+        if (pos < reader->num_chunk_cells) {
+            return h3set_cell_contains(reader->cells[pos], cell);
+        }
+    }
+    if (low < num_chunks) {
+        h3set_reader_chunk(reader, low, &entry);
+        return h3set_cell_contains(entry.first, cell);
+    }
+    return false;
+}
+
+/*
+ * a set of arbitrary cells, the cells are compacted in place
+ */
+static H3Set *
+h3set_from_cells(H3Index *cells, int64 num_cells)
+{
+    num_cells = __h3_compact_mixed(cells, num_cells);
+    return __h3_set_from_sorted(cells, num_cells);
+}
+
+/*
+ * Check if a set contains the cell. Returns the position of the first
+ * cell not sorted before the cell in pos.
+ */
+static inline bool
+h3set_covers(const H3Index *cells, int64 from, int64 num_cells, H3Index cell, int64 *pos)
+{
+    *pos = h3set_gallop(cells, from, num_cells, cell);
+    return (*pos < num_cells) && h3set_cell_contains(cells[*pos], cell);
+}
+
+
+/*
+ * growing buffer of cells
+ */
+typedef struct {
+    H3Index *cells;
+    int64 num_cells;
+    int64 size;
+} H3SetBuffer;
+
+static void
+h3set_buffer_init(H3SetBuffer *buffer, int64 size)
+{
+    buffer->size = Max(size, 16);
+    buffer->cells = __h3_index_array_buffer(buffer->size);
+    buffer->num_cells = 0;
+}
+
+static inline void
+h3set_buffer_append(H3SetBuffer *buffer, H3Index cell)
+{
+    if (buffer->num_cells == buffer->size) {
+        buffer->size *= 2;
+        buffer->cells = repalloc_huge(buffer->cells, buffer->size * sizeof(H3Index));
+    }
+    buffer->cells[buffer->num_cells++] = cell;
+}
+
+
+/*
+ * the union of two sets
+ */
+static H3Set *
+h3set_union_internal(const H3Index *a, int64 num_a, const H3Index *b, int64 num_b)
+{
+    H3Index *out = MemoryContextAllocHuge(CurrentMemoryContext,
+                (num_a + num_b + 1) * sizeof(H3Index));
+    int64 num_out = 0;
+    int64 i = 0;
+    int64 j = 0;
+
+    // equal cells are taken from both sets at once
+    while (i < num_a && j < num_b) {
+        H3Index x = a[i];
+        H3Index y = b[j];
+        bool take_a = !h3set_less(y, x);
+        bool take_b = !h3set_less(x, y);
+        out[num_out++] = take_a ? x : y;
+        i += take_a;
+        j += take_b;
+    }
+    memcpy(out + num_out, a + i, (num_a - i) * sizeof(H3Index));
+    num_out += num_a - i;
+    memcpy(out + num_out, b + j, (num_b - j) * sizeof(H3Index));
+    num_out += num_b - j;
+
+    // cells of one set may contain cells of the other one or complete
+    // their siblings
+    num_out = __h3_compact_sorted(out, num_out);
+
+    H3Set *result = __h3_set_from_sorted(out, num_out);
+    pfree(out);
+    return result;
+}
+
+/*
+ * The intersection of two sets: the cells of each set contained in a
+ * cell of the other one. When a cell of a is sorted before the next cell
+ * of b without being contained in it, no other cell of b can contain it
+ * and all cells of a before the descendants of that cell of b are skipped.
+ *
+ * The cells are appended to out. Without out, only checks if the
+ * intersection is not empty.
+ */
+static bool
+h3set_intersect(const H3Index *a, int64 num_a, const H3Index *b, int64 num_b, H3SetBuffer *out)
+{
+    int64 i = 0;
+    int64 j = 0;
+    while (i < num_a && j < num_b) {
+        H3Index x = a[i];
+        H3Index y = b[j];
+        H3Index found = 0;
+
+        if (x == y) {
+            found = x;
+            i++;
+            j++;
+        }
+        else if (h3set_less(x, y)) {
+            if (h3set_cell_contains(y, x)) {
+                found = x;
+                i++;
+            }
+            else {
+                i = h3set_gallop(a, i + 1, num_a, __h3_index_descendants_lower_bound(y));
+            }
+        }
+        else {
+            if (h3set_cell_contains(x, y)) {
+                found = y;
+                j++;
+            }
+            else {
+                j = h3set_gallop(b, j + 1, num_b, __h3_index_descendants_lower_bound(x));
+            }
+        }
+
+        if (found != 0) {
+            if (out == NULL) {
+                return true;
+            }
+            h3set_buffer_append(out, found);
+        }
+    }
+    return out != NULL && out->num_cells > 0;
+}
+
+static H3Set *
+h3set_intersection_internal(const H3Index *a, int64 num_a, const H3Index *b, int64 num_b)
+{
+    H3SetBuffer out;
+    h3set_buffer_init(&out, Min(num_a, num_b));
+
+    h3set_intersect(a, num_a, b, num_b, &out);
+
+    // the cells are not nested and no complete sets of siblings, as
+    // these would have been compacted in both sets
+    H3Set *result = __h3_set_from_sorted(out.cells, out.num_cells);
+    pfree(out.cells);
+    return result;
+}
+
+/*
+ * Append the parts of the cell not covered by the cells of b in
+ * [from, to), which must all be descendants of the cell.
+ */
+static void
+h3set_subtract_cell(H3Index cell, const H3Index *b, int64 from, int64 to, H3SetBuffer *out)
+{
+    H3ChildIterator iter;
+    __h3_child_iterator_init(&iter, cell, H3_EXPORT(h3GetResolution)(cell) + 1);
+
+    int64 pos = from;
+    H3Index child;
+    while ((child = __h3_child_iterator_next(&iter)) != 0) {
+        // the remaining cells of b are not sorted before the descendants of the child
+        int64 end = h3set_lower_bound(b, pos, to, child);
+
+        if (end < to && b[end] == child) {
+            pos = end + 1;
+        }
+        else if (end > pos) {
+            h3set_subtract_cell(child, b, pos, end, out);
+            pos = end;
+        }
+        else {
+            h3set_buffer_append(out, child);
+        }
+    }
+}
+
+/*
+ * The cells of a not covered by b. Cells of a containing cells of b
+ * are split into their children until the remaining parts are disjoint
+ * from b.
+ */
+static H3Set *
+h3set_difference_internal(const H3Index *a, int64 num_a, const H3Index *b, int64 num_b)
+{
+    H3SetBuffer out;
+    h3set_buffer_init(&out, num_a);
+
+    int64 j = 0;
+    for (int64 i = 0; i < num_a; i++) {
+        H3Index x = a[i];
+
+        // the cells of b before the descendants of x are not relevant
+        // for x nor for the following cells of a
+        j = h3set_gallop(b, j, num_b, __h3_index_descendants_lower_bound(x));
+
+        if (j == num_b) {
+            h3set_buffer_append(&out, x);
+        }
+        else if (h3set_less(b[j], x)) {
+            // b contains descendants of x
+            int64 end = h3set_lower_bound(b, j, num_b, x);
+            h3set_subtract_cell(x, b, j, end, &out);
+            j = end;
+        }
+        else if (!h3set_cell_contains(b[j], x)) {
+            h3set_buffer_append(&out, x);
+        }
+    }
+
+    H3Set *result = __h3_set_from_sorted(out.cells, out.num_cells);
+    pfree(out.cells);
+    return result;
+}
+
+/*
+ * Check if a contains all cells of b
+ */
+static bool
+h3set_contains_internal(const H3Index *a, int64 num_a, const H3Index *b, int64 num_b)
+{
+    int64 pos = 0;
+    for (int64 j = 0; j < num_b; j++) {
+        if (!h3set_covers(a, pos, num_a, b[j], &pos)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_in);
+
+/*
+ * text input: the cells in braces, separated by commas
+ */
+Datum
+h3set_in(PG_FUNCTION_ARGS)
+{
+    char *str = PG_GETARG_CSTRING(0);
+    const char *p = str;
+
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+    if (*p != '{') {
+        fail_and_report_with_code(ERRCODE_INVALID_TEXT_REPRESENTATION,
+                "Malformed h3set literal: \"%s\"", str);
+    }
+    p++;
+
+    H3SetBuffer cells;
+    h3set_buffer_init(&cells, 16);
+
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+    if (*p == '}') {
+        p++;
+    }
+    else {
+        for (;;) {
+            const char *start = p;
+            while (*p != '\0' && *p != ',' && *p != '}' && !isspace((unsigned char) *p)) {
+                p++;
+            }
+            if (p == start) {
+                fail_and_report_with_code(ERRCODE_INVALID_TEXT_REPRESENTATION,
+                        "Malformed h3set literal: \"%s\"", str);
+            }
+
+            char *index_cstr = pnstrdup(start, p - start);
+            H3Index index;
+            __h3_index_from_cstring(index_cstr, &index);
+            pfree(index_cstr);
+            h3set_buffer_append(&cells, index);
+
+            while (isspace((unsigned char) *p)) {
+                p++;
+            }
+            if (*p == ',') {
+                p++;
+                while (isspace((unsigned char) *p)) {
+                    p++;
+                }
+                continue;
+            }
+            if (*p == '}') {
+                p++;
+                break;
+            }
+            fail_and_report_with_code(ERRCODE_INVALID_TEXT_REPRESENTATION,
+                    "Malformed h3set literal: \"%s\"", str);
+        }
+    }
+
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+    if (*p != '\0') {
+        fail_and_report_with_code(ERRCODE_INVALID_TEXT_REPRESENTATION,
+                "Malformed h3set literal: \"%s\"", str);
+    }
+
+    PG_RETURN_H3SET_P(h3set_from_cells(cells.cells, cells.num_cells));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_out);
+
+Datum
+h3set_out(PG_FUNCTION_ARGS)
+{
+    H3SetReader reader;
+    h3set_reader_init(&reader, PG_GETARG_DATUM(0));
+
+    StringInfoData buf;
+    initStringInfo(&buf);
+    appendStringInfoChar(&buf, '{');
+
+    char index_cstr[H3_INDEX_STR_LEN];
+    H3Index cell;
+    bool first = true;
+    while (h3set_reader_next(&reader, &cell)) {
+        if (!first) {
+            appendStringInfoChar(&buf, ',');
+        }
+        first = false;
+        H3_EXPORT(h3ToString)(cell, index_cstr, H3_INDEX_STR_LEN);
+        appendStringInfoString(&buf, index_cstr);
+    }
+    appendStringInfoChar(&buf, '}');
+
+    PG_RETURN_CSTRING(buf.data);
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_recv);
+
+/*
+ * binary input: the number of cells and the cells as 64bit integers
+ * in network byte order
+ */
+Datum
+h3set_recv(PG_FUNCTION_ARGS)
+{
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+
+    int64 num_cells = pq_getmsgint64(buf);
+    if (num_cells < 0 || num_cells > (buf->len - buf->cursor) / (int64) sizeof(H3Index)) {
+        fail_and_report_with_code(ERRCODE_INVALID_BINARY_REPRESENTATION,
+                "Invalid number of cells in the binary representation of a h3set: %ld",
+                (long) num_cells);
+    }
+
+    H3Index *cells = __h3_index_array_buffer(Max(num_cells, 1));
+    for (int64 i = 0; i < num_cells; i++) {
+        cells[i] = (H3Index) pq_getmsgint64(buf);
+    }
+
+    // the cells may come from other sources, so they are compacted again
+    H3Set *set = h3set_from_cells(cells, num_cells);
+    pfree(cells);
+
+    PG_RETURN_H3SET_P(set);
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_send);
+
+/*
+ * binary output: the decoded cells, independent of the storage format
+ */
+Datum
+h3set_send(PG_FUNCTION_ARGS)
+{
+    H3SetReader reader;
+    h3set_reader_init(&reader, PG_GETARG_DATUM(0));
+
+    StringInfoData buf;
+    pq_begintypsend(&buf);
+    pq_sendint64(&buf, reader.header.num_cells);
+
+    H3Index cell;
+    while (h3set_reader_next(&reader, &cell)) {
+        pq_sendint64(&buf, (int64) cell);
+    }
+
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_from_array);
+
+/*
+ * cast h3index[] -> h3set
+ */
+Datum
+h3set_from_array(PG_FUNCTION_ARGS)
+{
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+
+    int num_cells = 0;
+    H3Index *cells = __h3_index_array_from_pg(array, &num_cells);
+
+    PG_RETURN_H3SET_P(h3set_from_cells(cells, num_cells));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_to_array);
+
+/*
+ * cast h3set -> h3index[], the compacted cells of the set
+ */
+Datum
+h3set_to_array(PG_FUNCTION_ARGS)
+{
+    H3Set *set = PG_GETARG_H3SET_P(0);
+
+    int64 num_cells;
+    __h3_index_array_check_size(set->num_cells);
+    H3Index *cells = __h3_set_decode(set, &num_cells);
+
+    PG_RETURN_ARRAYTYPE_P(__h3_index_array_to_pg(fcinfo, cells, NULL, (int) num_cells));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_num_cells);
+
+/*
+ * the number of compacted cells stored in the set, only reads the header
+ */
+Datum
+h3set_num_cells(PG_FUNCTION_ARGS)
+{
+    H3SetReader reader;
+    h3set_reader_init(&reader, PG_GETARG_DATUM(0));
+    PG_RETURN_INT64(reader.header.num_cells);
+}
+
+
+typedef struct {
+    H3SetReader reader;
+    H3ChildIterator children;
+    int resolution;             // -1 to return the compacted cells
+} H3SetCellsState;
+
+static Datum
+h3set_cells_srf(FunctionCallInfo fcinfo, int resolution)
+{
+    FuncCallContext *funcctx;
+    H3SetCellsState *state;
+
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        state = palloc0(sizeof(H3SetCellsState));
+        // of values stored out of line only the toast pointer is copied,
+        // the chunks are fetched as the rows are returned
+        h3set_reader_init(&state->reader, datumCopy(PG_GETARG_DATUM(0), false, -1));
+        state->resolution = resolution;
+        funcctx->user_fctx = state;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    state = funcctx->user_fctx;
+
+    if (state->resolution < 0) {
+        H3Index cell;
+        if (h3set_reader_next(&state->reader, &cell)) {
+            SRF_RETURN_NEXT(funcctx, H3IndexGetDatum(cell));
+        }
+        SRF_RETURN_DONE(funcctx);
+    }
+
+    H3Index child = __h3_child_iterator_next(&state->children);
+    while (child == 0) {
+        // the chunks are decoded into the buffer of the reader
+        H3Index cell;
+        if (!h3set_reader_next(&state->reader, &cell)) {
+            SRF_RETURN_DONE(funcctx);
+        }
+        if (h3set_res(cell) > state->resolution) {
+            char index_cstr[H3_INDEX_STR_LEN];
+            H3_EXPORT(h3ToString)(cell, index_cstr, H3_INDEX_STR_LEN);
+            fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                    "The cell %s of the set has a finer resolution than %d",
+                    index_cstr, state->resolution);
+        }
+        __h3_child_iterator_init(&state->children, cell, state->resolution);
+        child = __h3_child_iterator_next(&state->children);
+    }
+    SRF_RETURN_NEXT(funcctx, H3IndexGetDatum(child));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_cells);
+
+/*
+ * The compacted cells of the set, decoded one chunk at a time.
+ */
+Datum
+h3set_cells(PG_FUNCTION_ARGS)
+{
+    return h3set_cells_srf(fcinfo, -1);
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_uncompact);
+
+/*
+ * The cells of the set at the given resolution. Like h3_uncompact the
+ * children are returned one per call, and the chunks of the set are
+ * only decoded when they are reached.
+ */
+Datum
+h3set_uncompact(PG_FUNCTION_ARGS)
+{
+    int resolution = PG_GETARG_INT32(1);
+    if (resolution < 0 || resolution > PGH3_MAX_RES) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "Invalid resolution %d", resolution);
+    }
+    return h3set_cells_srf(fcinfo, resolution);
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_union);
+
+Datum
+h3set_union(PG_FUNCTION_ARGS)
+{
+    int64 num_a;
+    int64 num_b;
+    H3Index *a = __h3_set_decode(PG_GETARG_H3SET_P(0), &num_a);
+    H3Index *b = __h3_set_decode(PG_GETARG_H3SET_P(1), &num_b);
+    PG_RETURN_H3SET_P(h3set_union_internal(a, num_a, b, num_b));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_intersection);
+
+Datum
+h3set_intersection(PG_FUNCTION_ARGS)
+{
+    int64 num_a;
+    int64 num_b;
+    H3Index *a = __h3_set_decode(PG_GETARG_H3SET_P(0), &num_a);
+    H3Index *b = __h3_set_decode(PG_GETARG_H3SET_P(1), &num_b);
+    PG_RETURN_H3SET_P(h3set_intersection_internal(a, num_a, b, num_b));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_difference);
+
+Datum
+h3set_difference(PG_FUNCTION_ARGS)
+{
+    int64 num_a;
+    int64 num_b;
+    H3Index *a = __h3_set_decode(PG_GETARG_H3SET_P(0), &num_a);
+    H3Index *b = __h3_set_decode(PG_GETARG_H3SET_P(1), &num_b);
+    PG_RETURN_H3SET_P(h3set_difference_internal(a, num_a, b, num_b));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_contains_index);
+
+/*
+ * Check if the index is a cell of the set or a descendant of one. Of a
+ * value stored out of line only the chunk which may contain the index
+ * is fetched.
+ */
+Datum
+h3set_contains_index(PG_FUNCTION_ARGS)
+{
+    H3Index index = PG_GETARG_H3INDEX(1);
+
+    H3SetReader reader;
+    h3set_reader_init(&reader, PG_GETARG_DATUM(0));
+    PG_RETURN_BOOL(h3set_reader_covers(&reader, index));
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_contained_by_set);
+
+Datum
+h3index_contained_by_set(PG_FUNCTION_ARGS)
+{
+    H3Index index = PG_GETARG_H3INDEX(0);
+
+    H3SetReader reader;
+    h3set_reader_init(&reader, PG_GETARG_DATUM(1));
+    PG_RETURN_BOOL(h3set_reader_covers(&reader, index));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_contains);
+
+Datum
+h3set_contains(PG_FUNCTION_ARGS)
+{
+    int64 num_a;
+    int64 num_b;
+    H3Index *a = __h3_set_decode(PG_GETARG_H3SET_P(0), &num_a);
+    H3Index *b = __h3_set_decode(PG_GETARG_H3SET_P(1), &num_b);
+    PG_RETURN_BOOL(h3set_contains_internal(a, num_a, b, num_b));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_contained_by);
+
+Datum
+h3set_contained_by(PG_FUNCTION_ARGS)
+{
+    int64 num_a;
+    int64 num_b;
+    H3Index *a = __h3_set_decode(PG_GETARG_H3SET_P(0), &num_a);
+    H3Index *b = __h3_set_decode(PG_GETARG_H3SET_P(1), &num_b);
+    PG_RETURN_BOOL(h3set_contains_internal(b, num_b, a, num_a));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_overlaps);
+
+Datum
+h3set_overlaps(PG_FUNCTION_ARGS)
+{
+    int64 num_a;
+    int64 num_b;
+    H3Index *a = __h3_set_decode(PG_GETARG_H3SET_P(0), &num_a);
+    H3Index *b = __h3_set_decode(PG_GETARG_H3SET_P(1), &num_b);
+    PG_RETURN_BOOL(h3set_intersect(a, num_a, b, num_b, NULL));
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_eq);
+
+/*
+ * sets are equal when they cover the same cells, which is the case
+ * when their compacted cells and so their encodings are equal
+ */
+Datum
+h3set_eq(PG_FUNCTION_ARGS)
+{
+    H3Set *a = PG_GETARG_H3SET_P(0);
+    H3Set *b = PG_GETARG_H3SET_P(1);
+
+    PG_RETURN_BOOL(VARSIZE(a) == VARSIZE(b)
+            && memcmp(a, b, VARSIZE(a)) == 0);
+}
+
+
+PG_FUNCTION_INFO_V1(h3set_ne);
+
+Datum
+h3set_ne(PG_FUNCTION_ARGS)
+{
+    H3Set *a = PG_GETARG_H3SET_P(0);
+    H3Set *b = PG_GETARG_H3SET_P(1);
+
+    PG_RETURN_BOOL(VARSIZE(a) != VARSIZE(b)
+            || memcmp(a, b, VARSIZE(a)) != 0);
+}
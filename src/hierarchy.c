@@ -35,23 +35,24 @@ PG_FUNCTION_INFO_V1(h3_to_parent);
 
 /*
  * Return the parent (coarser) index containing the index in the parameter.
- *
- * The Index is returned in its string representation
  */
 Datum
 h3_to_parent(PG_FUNCTION_ARGS)
 {
-    text *index_text = PG_GETARG_TEXT_P(0);
-    char * index_cstr = text_to_cstring(index_text);
-    H3Index index;
-    __h3_index_from_cstring(index_cstr, &index);
+    H3Index index = PG_GETARG_H3INDEX(0);
 
     int resolution = PG_GETARG_INT32(1);
 
+    // h3ToParent returns 0 for these, which would not be accepted as an
+    // input of h3index
+    if (resolution < 0 || resolution > H3_EXPORT(h3GetResolution)(index)) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "The resolution of the parent must be between 0 and %d",
+                H3_EXPORT(h3GetResolution)(index));
+    }
     H3Index parent = H3_EXPORT(h3ToParent)(index, resolution);
 
-    text * parent_text = __h3_index_to_text(parent);
-    PG_RETURN_TEXT_P(parent_text);
+    PG_RETURN_H3INDEX(parent);
 }
 
 
@@ -61,70 +62,79 @@ PG_FUNCTION_INFO_V1(h3_to_children);
  * Return the child (finer) index contained the index in the given 
  * resolution.
  *
- * The indexes are returned in thier string representations
+ * The children are generated one per call, so the memory usage does
+ * not depend on their number.
  */
 Datum
 h3_to_children(PG_FUNCTION_ARGS)
 {
     FuncCallContext *funcctx;
-    int call_cntr = 0;
-    int max_calls = 0;
     MemoryContext oldcontext;
-    H3Index *hexagons = NULL;
+    H3ChildIterator *iter = NULL;
 
     if (SRF_IS_FIRSTCALL()) {
 
-        text *parent_index_text = PG_GETARG_TEXT_P(0);
-        char * parent_index_cstr = text_to_cstring(parent_index_text);
-        H3Index parent_index;
-        __h3_index_from_cstring(parent_index_cstr, &parent_index);
+        H3Index parent_index = PG_GETARG_H3INDEX(0);
 
         int child_resolution = PG_GETARG_INT32(1);
 
         funcctx = SRF_FIRSTCALL_INIT();
         oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
 
-        int num_children = H3_EXPORT(maxH3ToChildrenSize)(parent_index, child_resolution);
-        max_calls = num_children;
-
-        report_debug1("Generating %d H3 child hexagons at resolution %d", 
-                        num_children, child_resolution);
+        report_debug1("Generating H3 child hexagons at resolution %d", child_resolution);
 
-        hexagons = palloc0(num_children * sizeof(H3Index));
-        H3_EXPORT(h3ToChildren)(parent_index, child_resolution, hexagons);
+        iter = palloc(sizeof(H3ChildIterator));
+        __h3_child_iterator_init(iter, parent_index, child_resolution);
+        funcctx->user_fctx = iter;
 
-        if (max_calls > 0) {
-            // keep track of the results
-            funcctx->max_calls = max_calls;
-            funcctx->user_fctx = hexagons;
-        }
-        else {
-            // fast track when no results
-            pfree(hexagons);
-            hexagons = NULL;
-
-            MemoryContextSwitchTo(oldcontext);
-            SRF_RETURN_DONE(funcctx);
-        }
         MemoryContextSwitchTo(oldcontext);
     }
 
     // stuff done on every call of the function
     funcctx = SRF_PERCALL_SETUP();
+    iter = funcctx->user_fctx;
 
-    // Initialize per-call variables
-    call_cntr = funcctx->call_cntr;
-    max_calls = funcctx->max_calls;
-    hexagons = funcctx->user_fctx;
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_TO_CHILDREN);
+    H3Index child = __h3_child_iterator_next(iter);
+    __h3_stats_stop(&timer, funcctx->call_cntr == 0 ? 1 : 0, child != 0 ? 1 : 0);
 
-    if (call_cntr < max_calls) {
-        text * index_text = __h3_index_to_text(hexagons[call_cntr]);
-        SRF_RETURN_NEXT(funcctx, PointerGetDatum(index_text));
+    if (child != 0) {
+        SRF_RETURN_NEXT(funcctx, H3IndexGetDatum(child));
     }
     else {
-        pfree(hexagons);
-        hexagons = NULL;
-
         SRF_RETURN_DONE(funcctx);
     }
 }
+
+
+PG_FUNCTION_INFO_V1(h3_to_children_array);
+
+/*
+ * Return the children of the index in the given resolution as an array.
+ */
+Datum
+h3_to_children_array(PG_FUNCTION_ARGS)
+{
+    H3Index parent_index = PG_GETARG_H3INDEX(0);
+
+    int child_resolution = PG_GETARG_INT32(1);
+
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_TO_CHILDREN);
+
+    int64 num_children = __h3_child_count(parent_index, child_resolution);
+    H3Index *children = __h3_index_array_buffer(num_children);
+
+    H3ChildIterator iter;
+    __h3_child_iterator_init(&iter, parent_index, child_resolution);
+    for (int64 i = 0; i < num_children; i++) {
+        children[i] = __h3_child_iterator_next(&iter);
+    }
+
+    ArrayType *result = __h3_index_array_to_pg(fcinfo, children, NULL, (int) num_children);
+    pfree(children);
+
+    __h3_stats_stop(&timer, 1, num_children);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
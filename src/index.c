@@ -28,19 +28,27 @@
 #include "utils/geo_decls.h"
 #include "funcapi.h"
 
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 #include <h3/h3api.h>
 
 
-PG_FUNCTION_INFO_V1(h3_geo_to_h3index);
+PG_FUNCTION_INFO_V1(h3_geo_to_cell);
 
 /*
  * Find the H3 index for a coordinate pair.
- *
- * The Index is returned in its string representation
  */
 Datum
-h3_geo_to_h3index(PG_FUNCTION_ARGS)
+h3_geo_to_cell(PG_FUNCTION_ARGS)
 {
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_GEO_TO_CELL);
+
     Point *p = PG_GETARG_POINT_P(0);
 
     GeoCoord location;
@@ -54,10 +62,284 @@ h3_geo_to_h3index(PG_FUNCTION_ARGS)
         fail_and_report("Could not convert the coordinates (%f %f) to a H3 index", p->x, p->y);
     }
 
-    text * index_text = __h3_index_to_text(index);
-    PG_RETURN_TEXT_P(index_text);
+    __h3_stats_stop(&timer, 1, 1);
+    PG_RETURN_H3INDEX(index);
+}
+
+
+
+/*
+ * Batch conversion of coordinates to H3 indexes
+ *
+ * The coordinates are passed as separate arrays of longitudes and latitudes
+ * in degrees, which are converted to radians in place. isnull may be NULL,
+ * otherwise NULL elements result in NULL indexes.
+ */
+static ArrayType *
+h3_geo_to_cells_batch(FunctionCallInfo fcinfo, double *lons, double *lats, bool *isnull,
+            int num_points, int resolution)
+{
+    if (resolution < 0 || resolution > PGH3_MAX_RES) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "Invalid resolution %d", resolution);
+    }
+
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_GEO_TO_CELLS);
+
+    // no function calls in this loop, so the compiler can vectorize it
+    const double degs_to_rads = M_PI / 180.0;
+    for (int i = 0; i < num_points; i++) {
+        lons[i] *= degs_to_rads;
+        lats[i] *= degs_to_rads;
+    }
+
+    H3Index *indexes = palloc(Max(num_points, 1) * sizeof(H3Index));
+    for (int i = 0; i < num_points; i++) {
+        if (isnull != NULL && isnull[i]) {
+            indexes[i] = 0;
+            continue;
+        }
+
+        GeoCoord location = {lats[i], lons[i]};
+        indexes[i] = H3_EXPORT(geoToH3)(&location, resolution);
+        if (indexes[i] == 0) {
+            fail_and_report("Could not convert the coordinates (%f %f) at position %d to a H3 index",
+                    radsToDegs(lons[i]), radsToDegs(lats[i]), i + 1);
+        }
+    }
+
+    ArrayType *result = __h3_index_array_to_pg(fcinfo, indexes, isnull, num_points);
+    pfree(indexes);
+
+    __h3_stats_stop(&timer, 1, num_points);
+    return result;
+}
+
+/*
+ * copy a float8[] array into a plain vector of doubles. NULL elements
+ * are flagged in isnull.
+ */
+static double *
+h3_float8_array_values(ArrayType *array, bool *isnull, int *num_values, const char *name)
+{
+    if (ARR_NDIM(array) > 1) {
+        fail_and_report("The %s array must be an 1-dimensional array", name);
+    }
+    int nitems = (ARR_NDIM(array) == 0) ? 0 : ARR_DIMS(array)[0];
+    double *values = palloc(Max(nitems, 1) * sizeof(double));
+
+    if (!ARR_HASNULL(array)) {
+        // float8 is a fixed-length pass-by-value type, without NULLs
+        // the array data is a plain vector of doubles
+        memcpy(values, ARR_DATA_PTR(array), nitems * sizeof(double));
+    }
+    else {
+        bits8 *bitmap = ARR_NULLBITMAP(array);
+        double *data = (double *) ARR_DATA_PTR(array);
+        for (int i = 0; i < nitems; i++) {
+            if (bitmap[i / 8] & (1 << (i % 8))) {
+                values[i] = *data++;
+            }
+            else {
+                values[i] = 0.0;
+                isnull[i] = true;
+            }
+        }
+    }
+
+    *num_values = nitems;
+    return values;
+}
+
+
+PG_FUNCTION_INFO_V1(h3_geo_to_cells_lonlat);
+
+/*
+ * Find the H3 indexes for arrays of longitudes and latitudes.
+ */
+Datum
+h3_geo_to_cells_lonlat(PG_FUNCTION_ARGS)
+{
+    ArrayType *lon_array = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType *lat_array = PG_GETARG_ARRAYTYPE_P(1);
+    int resolution = PG_GETARG_INT32(2);
+
+    int num_lons = (ARR_NDIM(lon_array) == 0) ? 0 : ArrayGetNItems(ARR_NDIM(lon_array), ARR_DIMS(lon_array));
+    int num_lats = (ARR_NDIM(lat_array) == 0) ? 0 : ArrayGetNItems(ARR_NDIM(lat_array), ARR_DIMS(lat_array));
+    if (num_lons != num_lats) {
+        fail_and_report_with_code(ERRCODE_ARRAY_SUBSCRIPT_ERROR,
+                "The arrays of longitudes and latitudes must have the same length (%d != %d)",
+                num_lons, num_lats);
+    }
+
+    bool *isnull = palloc0(Max(num_lons, 1) * sizeof(bool));
+    int num_points;
+    double *lons = h3_float8_array_values(lon_array, isnull, &num_points, "longitude");
+    double *lats = h3_float8_array_values(lat_array, isnull, &num_points, "latitude");
+
+    PG_RETURN_ARRAYTYPE_P(h3_geo_to_cells_batch(fcinfo, lons, lats, isnull, num_points, resolution));
+}
+
+
+PG_FUNCTION_INFO_V1(h3_geo_to_cells_points);
+
+/*
+ * Find the H3 indexes for an array of points.
+ */
+Datum
+h3_geo_to_cells_points(PG_FUNCTION_ARGS)
+{
+    ArrayType *point_array = PG_GETARG_ARRAYTYPE_P(0);
+    int resolution = PG_GETARG_INT32(1);
+
+    if (ARR_NDIM(point_array) > 1) {
+        fail_and_report("The array of points must be an 1-dimensional array");
+    }
+    int num_points = (ARR_NDIM(point_array) == 0) ? 0 : ARR_DIMS(point_array)[0];
+
+    double *lons = palloc(Max(num_points, 1) * sizeof(double));
+    double *lats = palloc(Max(num_points, 1) * sizeof(double));
+    bool *isnull = palloc0(Max(num_points, 1) * sizeof(bool));
+
+    // point is a fixed-length type with double alignment, so the non-null
+    // elements are stored as a plain vector of Points
+    Point *data = (Point *) ARR_DATA_PTR(point_array);
+    bits8 *bitmap = ARR_NULLBITMAP(point_array);
+    for (int i = 0; i < num_points; i++) {
+        if (bitmap != NULL && !(bitmap[i / 8] & (1 << (i % 8)))) {
+            isnull[i] = true;
+            lons[i] = lats[i] = 0.0;
+            continue;
+        }
+        lons[i] = data->x;
+        lats[i] = data->y;
+        data++;
+    }
+
+    PG_RETURN_ARRAYTYPE_P(h3_geo_to_cells_batch(fcinfo, lons, lats, isnull, num_points, resolution));
+}
+
+
+PG_FUNCTION_INFO_V1(_h3_geo_to_cells_wkb);
+
+/*
+ * Find the H3 indexes for the points of a PostGIS point or multipoint
+ * given as (E)WKB. Empty points result in NULL indexes.
+ */
+Datum
+_h3_geo_to_cells_wkb(PG_FUNCTION_ARGS)
+{
+    bytea *wkb = PG_GETARG_BYTEA_PP(0);
+    int resolution = PG_GETARG_INT32(1);
+
+    double *lons, *lats;
+    int num_points = __h3_wkb_to_points((const uint8 *) VARDATA_ANY(wkb),
+                VARSIZE_ANY_EXHDR(wkb), &lons, &lats, NULL);
+    if (num_points < 0) {
+        fail_and_report("h3 only supports point and multipoint geometries");
+    }
+
+    bool *isnull = palloc0(Max(num_points, 1) * sizeof(bool));
+    for (int i = 0; i < num_points; i++) {
+        isnull[i] = isnan(lons[i]) || isnan(lats[i]);
+    }
+
+    PG_RETURN_ARRAYTYPE_P(h3_geo_to_cells_batch(fcinfo, lons, lats, isnull, num_points, resolution));
+}
+
+
+PG_FUNCTION_INFO_V1(_h3_geo_to_cell_wkb);
+
+/*
+ * Find the H3 index for a PostGIS point given as (E)WKB.
+ */
+Datum
+_h3_geo_to_cell_wkb(PG_FUNCTION_ARGS)
+{
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_GEO_TO_CELL);
+
+    bytea *wkb = PG_GETARG_BYTEA_PP(0);
+    int resolution = PG_GETARG_INT32(1);
+
+    double *lons, *lats;
+    bool is_multi;
+    int num_points = __h3_wkb_to_points((const uint8 *) VARDATA_ANY(wkb),
+                VARSIZE_ANY_EXHDR(wkb), &lons, &lats, &is_multi);
+    if (num_points != 1 || is_multi) {
+        fail_and_report("h3 only supports point geometries");
+    }
+
+    GeoCoord location;
+    location.lat = degsToRads(lats[0]);
+    location.lon = degsToRads(lons[0]);
+
+    H3Index index = H3_EXPORT(geoToH3)(&location, resolution);
+    if (index == 0) {
+        fail_and_report("Could not convert the coordinates (%f %f) to a H3 index", lons[0], lats[0]);
+    }
+
+    __h3_stats_stop(&timer, 1, 1);
+    PG_RETURN_H3INDEX(index);
+}
+
+
+/*
+ * The last result of a geometry function, kept in fn_extra. Queries often
+ * call the function with the same index many times in a row, e.g. when
+ * joining many rows to a few cells, which then is answered without
+ * looking the index up in the geometry cache.
+ */
+typedef struct {
+    H3Index index;
+    void *value;        // Point or a varlena: POLYGON or EWKB
+    Size size;          // allocated size of value
+} LastGeometry;
+
+static LastGeometry *
+last_geometry_get(FunctionCallInfo fcinfo)
+{
+    if (fcinfo->flinfo->fn_extra == NULL) {
+        fcinfo->flinfo->fn_extra = MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+                    sizeof(LastGeometry));
+    }
+    return (LastGeometry *) fcinfo->flinfo->fn_extra;
 }
 
+/*
+ * a copy of the last result when it belongs to the index, NULL otherwise.
+ * size is the size of a Point, 0 for varlenas.
+ */
+static void *
+last_geometry_lookup(const LastGeometry *last, H3Index index, Size size)
+{
+    if (last->value == NULL || last->index != index) {
+        return NULL;
+    }
+    __h3_geometry_cache_count_hit();
+
+    if (size == 0) {
+        size = VARSIZE(last->value);
+    }
+    void *copy = palloc(size);
+    memcpy(copy, last->value, size);
+    return copy;
+}
+
+static void
+last_geometry_store(FunctionCallInfo fcinfo, LastGeometry *last, H3Index index, const void *value, Size size)
+{
+    if (last->size < size) {
+        if (last->value != NULL) {
+            pfree(last->value);
+        }
+        last->value = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, size);
+        last->size = size;
+    }
+    memcpy(last->value, value, size);
+    last->index = index;
+}
 
 
 PG_FUNCTION_INFO_V1(_h3_h3index_to_geo);
@@ -65,24 +347,22 @@ PG_FUNCTION_INFO_V1(_h3_h3index_to_geo);
 /*
  * Return the centroid coordinates for the given h3 index.
  *
- * The index is expected in its string serialized representation.
  */
 Datum
 _h3_h3index_to_geo(PG_FUNCTION_ARGS)
 {
-    text *index_text = PG_GETARG_TEXT_P(0);
-    
-    char * index_cstr = text_to_cstring(index_text);
-    H3Index index;
-    __h3_index_from_cstring(index_cstr, &index);
+    H3Index index = PG_GETARG_H3INDEX(0);
 
-    GeoCoord coord;
-    H3_EXPORT(h3ToGeo)(index, &coord);
+    LastGeometry *last = last_geometry_get(fcinfo);
+    Point *p = last_geometry_lookup(last, index, sizeof(Point));
+    if (p != NULL) {
+        PG_RETURN_POINT_P(p);
+    }
 
     // return as a postgresql native point
-    Point *p = palloc0(sizeof(Point));
-    p->y = radsToDegs(coord.lat);
-    p->x = radsToDegs(coord.lon);
+    p = palloc0(sizeof(Point));
+    __h3_cached_centroid(index, p);
+    last_geometry_store(fcinfo, last, index, p, sizeof(Point));
 
     PG_RETURN_POINT_P(p);
 }
@@ -94,57 +374,136 @@ PG_FUNCTION_INFO_V1(_h3_h3index_to_geoboundary);
 /*
  * Return the boundary coordinates for the given h3 index as a
  * native postgresql polygon
- *
- * The index is expected in its string serialized representation.
  */
 Datum
 _h3_h3index_to_geoboundary(PG_FUNCTION_ARGS)
 {
-    text *index_text = PG_GETARG_TEXT_P(0);
-    
-    char * index_cstr = text_to_cstring(index_text);
-    H3Index index;
-    __h3_index_from_cstring(index_cstr, &index);
+    H3Index index = PG_GETARG_H3INDEX(0);
+
+    LastGeometry *last = last_geometry_get(fcinfo);
+    POLYGON *poly = last_geometry_lookup(last, index, 0);
+    if (poly != NULL) {
+        PG_RETURN_POLYGON_P(poly);
+    }
 
-    GeoBoundary gp;
-    H3_EXPORT(h3ToGeoBoundary)(index, &gp);
+    Point verts[MAX_CELL_BNDRY_VERTS];
+    int num_verts = __h3_cached_boundary(index, verts);
 
     // return as an polygon
     //
     // initialize the POLYGON structure
-    POLYGON *poly = NULL;
-    int size = offsetof(POLYGON, p) + (sizeof(poly->p[0]) * gp.numVerts);
+    int size = offsetof(POLYGON, p) + (sizeof(poly->p[0]) * num_verts);
     poly = (POLYGON*) palloc0(size);
     SET_VARSIZE(poly, size);
 
-    poly->npts = gp.numVerts;
-
-    for(int i = 0; i < gp.numVerts; i++) {
-        poly->p[i].y = radsToDegs(gp.verts[i].lat);
-        poly->p[i].x = radsToDegs(gp.verts[i].lon);
-    }
+    poly->npts = num_verts;
+    memcpy(poly->p, verts, num_verts * sizeof(Point));
 
     __h3_make_bound_box(poly);
 
+    last_geometry_store(fcinfo, last, index, poly, size);
+
     PG_RETURN_POLYGON_P(poly);
 }
 
 
+PG_FUNCTION_INFO_V1(_h3_h3index_to_geo_ewkb);
+
+/*
+ * Return the centroid of the given h3 index as an EWKB point
+ * with the SRID 4326
+ */
+Datum
+_h3_h3index_to_geo_ewkb(PG_FUNCTION_ARGS)
+{
+    H3Index index = PG_GETARG_H3INDEX(0);
+
+    LastGeometry *last = last_geometry_get(fcinfo);
+    bytea *wkb = last_geometry_lookup(last, index, 0);
+    if (wkb != NULL) {
+        PG_RETURN_BYTEA_P(wkb);
+    }
+
+    Point centroid;
+    __h3_cached_centroid(index, &centroid);
+
+    wkb = __h3_wkb_point(&centroid);
+    last_geometry_store(fcinfo, last, index, wkb, VARSIZE(wkb));
+
+    PG_RETURN_BYTEA_P(wkb);
+}
+
+
+PG_FUNCTION_INFO_V1(_h3_h3index_to_geoboundary_ewkb);
+
+/*
+ * Return the boundary of the given h3 index as an EWKB polygon
+ * with the SRID 4326
+ */
+Datum
+_h3_h3index_to_geoboundary_ewkb(PG_FUNCTION_ARGS)
+{
+    H3Index index = PG_GETARG_H3INDEX(0);
+
+    LastGeometry *last = last_geometry_get(fcinfo);
+    bytea *wkb = last_geometry_lookup(last, index, 0);
+    if (wkb != NULL) {
+        PG_RETURN_BYTEA_P(wkb);
+    }
+
+    Point verts[MAX_CELL_BNDRY_VERTS];
+    int num_verts = __h3_cached_boundary(index, verts);
+
+    wkb = __h3_wkb_polygon(verts, num_verts);
+    last_geometry_store(fcinfo, last, index, wkb, VARSIZE(wkb));
+
+    PG_RETURN_BYTEA_P(wkb);
+}
+
+
+PG_FUNCTION_INFO_V1(_h3_h3indexes_to_multipolygon_ewkb);
+
+/*
+ * Return the boundaries of an array of h3 indexes as an EWKB
+ * multipolygon with the SRID 4326. Each index becomes a polygon of its
+ * own, in the order of the array; the cells are not merged.
+ */
+Datum
+_h3_h3indexes_to_multipolygon_ewkb(PG_FUNCTION_ARGS)
+{
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+
+    int num_indexes = 0;
+    H3Index *indexes = __h3_index_array_from_pg(array, &num_indexes);
+
+    Point *verts = palloc(sizeof(Point) * MAX_CELL_BNDRY_VERTS * Max(num_indexes, 1));
+    int *num_verts = palloc(sizeof(int) * Max(num_indexes, 1));
+
+    Point *next_verts = verts;
+    for (int i = 0; i < num_indexes; i++) {
+        num_verts[i] = __h3_cached_boundary(indexes[i], next_verts);
+        next_verts += num_verts[i];
+    }
+
+    bytea *result = __h3_wkb_multipolygon(verts, num_verts, num_indexes);
+
+    pfree(verts);
+    pfree(num_verts);
+
+    PG_RETURN_BYTEA_P(result);
+}
+
+
 PG_FUNCTION_INFO_V1(h3_h3index_is_valid);
 
 /*
  * Return True when an H3 index is valid.
  *
- * The index is expected in its string serialized representation.
  */
 Datum
 h3_h3index_is_valid(PG_FUNCTION_ARGS)
 {
-    text *index_text = PG_GETARG_TEXT_P(0);
-    
-    char * index_cstr = text_to_cstring(index_text);
-    H3Index index;
-    __h3_index_from_cstring(index_cstr, &index);
+    H3Index index = PG_GETARG_H3INDEX(0);
 
     int isvalid = H3_EXPORT(h3IsValid)(index);
 
@@ -157,16 +516,11 @@ PG_FUNCTION_INFO_V1(h3_get_resolution);
 /*
  * Get the H3 resolution.
  *
- * The index is expected in its string serialized representation.
  */
 Datum
 h3_get_resolution(PG_FUNCTION_ARGS)
 {
-    text *index_text = PG_GETARG_TEXT_P(0);
-    
-    char * index_cstr = text_to_cstring(index_text);
-    H3Index index;
-    __h3_index_from_cstring(index_cstr, &index);
+    H3Index index = PG_GETARG_H3INDEX(0);
 
     int res = H3_EXPORT(h3GetResolution)(index); 
 
@@ -179,16 +533,11 @@ PG_FUNCTION_INFO_V1(h3_get_basecell);
 /*
  * Get the H3 basecell.
  *
- * The index is expected in its string serialized representation.
  */
 Datum
 h3_get_basecell(PG_FUNCTION_ARGS)
 {
-    text *index_text = PG_GETARG_TEXT_P(0);
-    
-    char * index_cstr = text_to_cstring(index_text);
-    H3Index index;
-    __h3_index_from_cstring(index_cstr, &index);
+    H3Index index = PG_GETARG_H3INDEX(0);
 
     int basecell = H3_EXPORT(h3GetBaseCell)(index); 
 
@@ -198,66 +547,43 @@ h3_get_basecell(PG_FUNCTION_ARGS)
 
 #if PGH3_H3_VERSION_NUM >= 30400
 
-PG_FUNCTION_INFO_V1(h3_get_basecells);
+PG_FUNCTION_INFO_V1(h3_get_res0_cells);
 
 /*
  * Return all indexes at resolution 0, the base cells.
- *
- * The indexes are returned in thier string representations
  */
 Datum
-h3_get_basecells(PG_FUNCTION_ARGS)
+h3_get_res0_cells(PG_FUNCTION_ARGS)
 {
-    FuncCallContext *funcctx;
-    int call_cntr = 0;
-    int max_calls = 0;
-    MemoryContext oldcontext;
-    H3Index *hexagons = NULL;
-
-    if (SRF_IS_FIRSTCALL()) {
-        funcctx = SRF_FIRSTCALL_INIT();
-        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
-
-        int num_children = H3_EXPORT(res0IndexCount)();
-        max_calls = num_children;
-
-        hexagons = palloc0(num_children * sizeof(H3Index));
-        H3_EXPORT(getRes0Indexes)(hexagons);
-
-        if (max_calls > 0) {
-            // keep track of the results
-            funcctx->max_calls = max_calls;
-            funcctx->user_fctx = hexagons;
-        }
-        else {
-            // fast track when no results
-            pfree(hexagons);
-            hexagons = NULL;
+    int num_cells = H3_EXPORT(res0IndexCount)();
 
-            MemoryContextSwitchTo(oldcontext);
-            SRF_RETURN_DONE(funcctx);
-        }
-        MemoryContextSwitchTo(oldcontext);
-    }
+    H3Index *cells = palloc0(num_cells * sizeof(H3Index));
+    H3_EXPORT(getRes0Indexes)(cells);
 
-    // stuff done on every call of the function
-    funcctx = SRF_PERCALL_SETUP();
+    __h3_index_srf_materialize(fcinfo, cells, num_cells);
 
-    // Initialize per-call variables
-    call_cntr = funcctx->call_cntr;
-    max_calls = funcctx->max_calls;
-    hexagons = funcctx->user_fctx;
+    pfree(cells);
+    return (Datum) 0;
+}
 
-    if (call_cntr < max_calls) {
-        text * index_text = __h3_index_to_text(hexagons[call_cntr]);
-        SRF_RETURN_NEXT(funcctx, PointerGetDatum(index_text));
-    }
-    else {
-        pfree(hexagons);
-        hexagons = NULL;
 
-        SRF_RETURN_DONE(funcctx);
-    }
+PG_FUNCTION_INFO_V1(h3_get_res0_cells_array);
+
+/*
+ * Return all indexes at resolution 0 as an array.
+ */
+Datum
+h3_get_res0_cells_array(PG_FUNCTION_ARGS)
+{
+    int num_cells = H3_EXPORT(res0IndexCount)();
+
+    H3Index *cells = palloc0(num_cells * sizeof(H3Index));
+    H3_EXPORT(getRes0Indexes)(cells);
+
+    ArrayType *result = __h3_index_array_to_pg(fcinfo, cells, NULL, num_cells);
+
+    pfree(cells);
+    PG_RETURN_ARRAYTYPE_P(result);
 }
 
 #endif
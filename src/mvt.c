@@ -0,0 +1,628 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "catalog/pg_type.h"
+#include "lib/stringinfo.h"
+#include "port/pg_bswap.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <h3/h3api.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Mapbox Vector Tiles of the hexagons covering a web mercator tile
+ *
+ * The cells are found by a polyfill of the bounding box of the tile
+ * extended by a margin, so cells with their centroid outside of the tile
+ * but parts of their boundary inside are found as well. Only the cells
+ * overlapping the tile are kept. Their boundaries are projected to the
+ * integer coordinates of the tile, clipped to the tile and its buffer and
+ * written as protobuf messages following version 2 of the specification:
+ * https://github.com/mapbox/vector-tile-spec/tree/master/2.1
+ *
+ * Each feature has the index as its id and as the string property
+ * "h3index", as the ids exceed the integers of javascript. When values
+ * are given, only the cells having a value are written, with the
+ * double property "value".
+ */
+
+#define MVT_MAX_ZOOM            30
+#define MVT_MAX_LAT             85.0511287798066
+
+// the buffer of ST_AsMVTGeom
+#define MVT_BUFFER              256
+
+// fields of the messages
+#define MVT_TILE_LAYERS         3
+#define MVT_LAYER_NAME          1
+#define MVT_LAYER_FEATURES      2
+#define MVT_LAYER_KEYS          3
+#define MVT_LAYER_VALUES        4
+#define MVT_LAYER_EXTENT        5
+#define MVT_LAYER_VERSION       15
+#define MVT_FEATURE_ID          1
+#define MVT_FEATURE_TAGS        2
+#define MVT_FEATURE_TYPE        3
+#define MVT_FEATURE_GEOMETRY    4
+#define MVT_VALUE_STRING        1
+#define MVT_VALUE_DOUBLE        3
+
+#define MVT_GEOM_POLYGON        3
+
+#define MVT_CMD_MOVE_TO         1
+#define MVT_CMD_LINE_TO         2
+#define MVT_CMD_CLOSE_PATH      7
+
+#define PB_WIRE_VARINT          0
+#define PB_WIRE_FIXED64         1
+#define PB_WIRE_LENGTH          2
+
+#define MVT_KEY_H3INDEX         0
+#define MVT_KEY_VALUE           1
+
+// clipping a ring to one side of the box at most doubles its vertices
+#define MVT_MAX_RING_VERTS      (16 * MAX_CELL_BNDRY_VERTS)
+
+static inline void
+pb_write_varint(StringInfo buf, uint64 value)
+{
+    while (value >= 0x80) {
+        appendStringInfoCharMacro(buf, (char) ((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    appendStringInfoCharMacro(buf, (char) value);
+}
+
+static inline void
+pb_write_key(StringInfo buf, int field, int wire_type)
+{
+    pb_write_varint(buf, ((uint64) field << 3) | wire_type);
+}
+
+static void
+pb_write_bytes(StringInfo buf, int field, const char *data, int length)
+{
+    pb_write_key(buf, field, PB_WIRE_LENGTH);
+    pb_write_varint(buf, length);
+    appendBinaryStringInfo(buf, data, length);
+}
+
+static void
+pb_write_double(StringInfo buf, int field, double value)
+{
+    uint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+#ifdef WORDS_BIGENDIAN
+    bits = pg_bswap64(bits);
+#endif
+    pb_write_key(buf, field, PB_WIRE_FIXED64);
+    appendBinaryStringInfo(buf, (const char *) &bits, sizeof(bits));
+}
+
+static inline uint32
+mvt_zigzag(int32 value)
+{
+    return ((uint32) value << 1) ^ (uint32) (value >> 31);
+}
+
+static inline uint32
+mvt_command(int id, int count)
+{
+    return (id & 0x7) | ((uint32) count << 3);
+}
+
+
+typedef struct {
+    int zoom;
+    int x;
+    int y;
+    int extent;
+    BOX box;                    // the tile in degrees
+} MvtTile;
+
+static double
+mvt_tile_lat(int y, int zoom)
+{
+    double n = M_PI - 2.0 * M_PI * y / ldexp(1.0, zoom);
+    return radsToDegs(atan(sinh(n)));
+}
+
+static void
+mvt_tile_init(MvtTile *tile, int zoom, int x, int y, int extent)
+{
+    if (zoom < 0 || zoom > MVT_MAX_ZOOM) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "The zoom level must be between 0 and %d", MVT_MAX_ZOOM);
+    }
+    int64 num_tiles = (int64) 1 << zoom;
+    if (x < 0 || x >= num_tiles || y < 0 || y >= num_tiles) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "The tile %d/%d/%d does not exist", zoom, x, y);
+    }
+    if (extent <= 0) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "The extent must be positive");
+    }
+
+    tile->zoom = zoom;
+    tile->x = x;
+    tile->y = y;
+    tile->extent = extent;
+
+    tile->box.low.x = x * 360.0 / num_tiles - 180.0;
+    tile->box.high.x = (x + 1) * 360.0 / num_tiles - 180.0;
+    tile->box.low.y = mvt_tile_lat(y + 1, zoom);
+    tile->box.high.y = mvt_tile_lat(y, zoom);
+}
+
+/*
+ * project a vertex in degrees to the coordinates of the tile
+ */
+static void
+mvt_tile_project(const MvtTile *tile, const Point *vert, double *px, double *py)
+{
+    double num_tiles = ldexp(1.0, tile->zoom);
+    double lon = vert->x;
+    double lat = Max(Min(vert->y, MVT_MAX_LAT), -MVT_MAX_LAT);
+    double sin_lat = sin(degsToRads(lat));
+
+    double mx = (lon + 180.0) / 360.0 * num_tiles;
+    double my = (0.5 - log((1.0 + sin_lat) / (1.0 - sin_lat)) / (4.0 * M_PI)) * num_tiles;
+
+    *px = (mx - tile->x) * tile->extent;
+    *py = (my - tile->y) * tile->extent;
+}
+
+/*
+ * clip a ring against one side of the box (Sutherland-Hodgman)
+ */
+static int
+mvt_clip_ring_side(const double *in, int num_in, int axis, double value, bool keep_greater,
+            double *out)
+{
+    int num_out = 0;
+    for (int i = 0; i < num_in; i++) {
+        const double *cur = &in[2 * i];
+        const double *prev = &in[2 * ((i + num_in - 1) % num_in)];
+        bool cur_inside = keep_greater ? cur[axis] >= value : cur[axis] <= value;
+        bool prev_inside = keep_greater ? prev[axis] >= value : prev[axis] <= value;
+
+        if (cur_inside != prev_inside) {
+            double t = (value - prev[axis]) / (cur[axis] - prev[axis]);
+            out[2 * num_out + axis] = value;
+            out[2 * num_out + 1 - axis] = prev[1 - axis] + t * (cur[1 - axis] - prev[1 - axis]);
+            num_out++;
+        }
+        if (cur_inside) {
+            out[2 * num_out] = cur[0];
+            out[2 * num_out + 1] = cur[1];
+            num_out++;
+        }
+    }
+    return num_out;
+}
+
+/*
+ * The boundary of the cell as integer coordinates of the tile, clipped to
+ * the tile and its buffer. The ring is not closed and has a positive area.
+ * Returns the number of vertices, 0 when nothing of the cell is left.
+ */
+static int
+mvt_cell_ring(const MvtTile *tile, H3Index index, int32 *ring)
+{
+    Point verts[MAX_CELL_BNDRY_VERTS];
+    int num_verts = __h3_cached_boundary(index, verts);
+
+    // make the longitudes of cells crossing the antimeridian continuous
+    // and take the cell to the side of the antimeridian the tile is on
+    double center = (tile->box.low.x + tile->box.high.x) / 2.0;
+    for (int i = 0; i < num_verts; i++) {
+        double reference = (i == 0) ? center : verts[i - 1].x;
+        if (verts[i].x - reference > 180.0) {
+            verts[i].x -= 360.0;
+        }
+        else if (verts[i].x - reference < -180.0) {
+            verts[i].x += 360.0;
+        }
+    }
+
+    double a[2 * MVT_MAX_RING_VERTS];
+    double b[2 * MVT_MAX_RING_VERTS];
+    for (int i = 0; i < num_verts; i++) {
+        mvt_tile_project(tile, &verts[i], &a[2 * i], &a[2 * i + 1]);
+    }
+
+    double low = -MVT_BUFFER;
+    double high = tile->extent + MVT_BUFFER;
+    int num = num_verts;
+    num = mvt_clip_ring_side(a, num, 0, low, true, b);
+    num = mvt_clip_ring_side(b, num, 0, high, false, a);
+    num = mvt_clip_ring_side(a, num, 1, low, true, b);
+    num = mvt_clip_ring_side(b, num, 1, high, false, a);
+
+    // round, dropping repeated vertices
+    int num_ring = 0;
+    for (int i = 0; i < num; i++) {
+        int32 px = (int32) lround(a[2 * i]);
+        int32 py = (int32) lround(a[2 * i + 1]);
+        if (num_ring > 0 && ring[2 * (num_ring - 1)] == px && ring[2 * (num_ring - 1) + 1] == py) {
+            continue;
+        }
+        ring[2 * num_ring] = px;
+        ring[2 * num_ring + 1] = py;
+        num_ring++;
+    }
+    while (num_ring > 1 && ring[0] == ring[2 * (num_ring - 1)]
+                && ring[1] == ring[2 * (num_ring - 1) + 1]) {
+        num_ring--;
+    }
+    if (num_ring < 3) {
+        return 0;
+    }
+
+    int64 area = 0;
+    for (int i = 0; i < num_ring; i++) {
+        int j = (i + 1) % num_ring;
+        area += (int64) ring[2 * i] * ring[2 * j + 1] - (int64) ring[2 * j] * ring[2 * i + 1];
+    }
+    if (area == 0) {
+        return 0;
+    }
+    if (area < 0) {
+        for (int i = 0, j = num_ring - 1; i < j; i++, j--) {
+            int32 x = ring[2 * i];
+            int32 y = ring[2 * i + 1];
+            ring[2 * i] = ring[2 * j];
+            ring[2 * i + 1] = ring[2 * j + 1];
+            ring[2 * j] = x;
+            ring[2 * j + 1] = y;
+        }
+    }
+    return num_ring;
+}
+
+/*
+ * the commands of a polygon with a single ring
+ */
+static void
+mvt_write_ring(StringInfo buf, const int32 *ring, int num_ring)
+{
+    pb_write_varint(buf, mvt_command(MVT_CMD_MOVE_TO, 1));
+    pb_write_varint(buf, mvt_zigzag(ring[0]));
+    pb_write_varint(buf, mvt_zigzag(ring[1]));
+
+    pb_write_varint(buf, mvt_command(MVT_CMD_LINE_TO, num_ring - 1));
+    for (int i = 1; i < num_ring; i++) {
+        pb_write_varint(buf, mvt_zigzag(ring[2 * i] - ring[2 * (i - 1)]));
+        pb_write_varint(buf, mvt_zigzag(ring[2 * i + 1] - ring[2 * (i - 1) + 1]));
+    }
+
+    pb_write_varint(buf, mvt_command(MVT_CMD_CLOSE_PATH, 1));
+}
+
+
+typedef struct {
+    H3Index index;
+    double value;
+    bool isnull;
+} MvtCellValue;
+
+static int
+mvt_cell_value_cmp(const void *a, const void *b)
+{
+    return __h3_index_cmp(((const MvtCellValue *) a)->index, ((const MvtCellValue *) b)->index);
+}
+
+/*
+ * the cells and values given as parallel arrays, sorted by the cells
+ */
+static MvtCellValue *
+mvt_cell_values_from_pg(ArrayType *cells_array, ArrayType *values_array, int *num_values)
+{
+    int num_cells = 0;
+    H3Index *cells = __h3_index_array_from_pg(cells_array, &num_cells);
+
+    Datum *value_datums;
+    bool *value_nulls;
+    int num_vals;
+    deconstruct_array(values_array, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd',
+                &value_datums, &value_nulls, &num_vals);
+
+    if (num_cells != num_vals) {
+        fail_and_report_with_code(ERRCODE_ARRAY_SUBSCRIPT_ERROR,
+                "The arrays of cells and values must have the same length (%d != %d)",
+                num_cells, num_vals);
+    }
+
+    MvtCellValue *values = palloc(sizeof(MvtCellValue) * Max(num_cells, 1));
+    for (int i = 0; i < num_cells; i++) {
+        values[i].index = cells[i];
+        values[i].isnull = value_nulls[i];
+        values[i].value = value_nulls[i] ? 0.0 : DatumGetFloat8(value_datums[i]);
+    }
+    pfree(cells);
+    pfree(value_datums);
+    pfree(value_nulls);
+
+    qsort(values, num_cells, sizeof(MvtCellValue), mvt_cell_value_cmp);
+    for (int i = 1; i < num_cells; i++) {
+        if (values[i].index == values[i - 1].index) {
+            char index_str[H3_INDEX_STR_LEN];
+            H3_EXPORT(h3ToString)(values[i].index, index_str, H3_INDEX_STR_LEN);
+            fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                    "The cell %s has more than one value", index_str);
+        }
+    }
+
+    *num_values = num_cells;
+    return values;
+}
+
+
+typedef struct {
+    uint64 bits;            // hash key, must be the first member
+    uint32 position;
+} MvtDoubleValue;
+
+/*
+ * The layer being written. The values of the properties are stored
+ * once per distinct value, the h3index strings are distinct anyway.
+ */
+typedef struct {
+    StringInfoData features;
+    StringInfoData values;
+    uint32 num_values;
+    HTAB *double_values;
+
+    StringInfoData feature;     // scratch buffers of the current feature
+    StringInfoData packed;
+} MvtLayer;
+
+static void
+mvt_layer_init(MvtLayer *layer)
+{
+    initStringInfo(&layer->features);
+    initStringInfo(&layer->values);
+    initStringInfo(&layer->feature);
+    initStringInfo(&layer->packed);
+    layer->num_values = 0;
+
+    HASHCTL ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.keysize = sizeof(uint64);
+    ctl.entrysize = sizeof(MvtDoubleValue);
+    ctl.hcxt = CurrentMemoryContext;
+    layer->double_values = hash_create("pgh3 mvt values", 256, &ctl,
+                HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+}
+
+static uint32
+mvt_layer_add_string(MvtLayer *layer, const char *value)
+{
+    StringInfo message = &layer->packed;
+    resetStringInfo(message);
+    pb_write_bytes(message, MVT_VALUE_STRING, value, strlen(value));
+    pb_write_bytes(&layer->values, MVT_LAYER_VALUES, message->data, message->len);
+    return layer->num_values++;
+}
+
+static uint32
+mvt_layer_add_double(MvtLayer *layer, double value)
+{
+    uint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    bool found;
+    MvtDoubleValue *entry = hash_search(layer->double_values, &bits, HASH_ENTER, &found);
+    if (!found) {
+        StringInfo message = &layer->packed;
+        resetStringInfo(message);
+        pb_write_double(message, MVT_VALUE_DOUBLE, value);
+        pb_write_bytes(&layer->values, MVT_LAYER_VALUES, message->data, message->len);
+        entry->position = layer->num_values++;
+    }
+    return entry->position;
+}
+
+static void
+mvt_layer_add_feature(MvtLayer *layer, H3Index index, const int32 *ring, int num_ring,
+            const MvtCellValue *value)
+{
+    char index_str[H3_INDEX_STR_LEN];
+    H3_EXPORT(h3ToString)(index, index_str, H3_INDEX_STR_LEN);
+
+    uint32 tags[4];
+    int num_tags = 0;
+    tags[num_tags++] = MVT_KEY_H3INDEX;
+    tags[num_tags++] = mvt_layer_add_string(layer, index_str);
+    if (value != NULL && !value->isnull) {
+        tags[num_tags++] = MVT_KEY_VALUE;
+        tags[num_tags++] = mvt_layer_add_double(layer, value->value);
+    }
+
+    StringInfo feature = &layer->feature;
+    StringInfo packed = &layer->packed;
+    resetStringInfo(feature);
+
+    pb_write_key(feature, MVT_FEATURE_ID, PB_WIRE_VARINT);
+    pb_write_varint(feature, index);
+
+    resetStringInfo(packed);
+    for (int i = 0; i < num_tags; i++) {
+        pb_write_varint(packed, tags[i]);
+    }
+    pb_write_bytes(feature, MVT_FEATURE_TAGS, packed->data, packed->len);
+
+    pb_write_key(feature, MVT_FEATURE_TYPE, PB_WIRE_VARINT);
+    pb_write_varint(feature, MVT_GEOM_POLYGON);
+
+    resetStringInfo(packed);
+    mvt_write_ring(packed, ring, num_ring);
+    pb_write_bytes(feature, MVT_FEATURE_GEOMETRY, packed->data, packed->len);
+
+    pb_write_bytes(&layer->features, MVT_LAYER_FEATURES, feature->data, feature->len);
+}
+
+/*
+ * adds the cell as a feature when it overlaps the tile
+ */
+static void
+mvt_layer_add_cell(MvtLayer *layer, const MvtTile *tile, H3Index index,
+            const MvtCellValue *value)
+{
+    if (!__h3_index_overlaps_box(index, &tile->box)) {
+        return;
+    }
+
+    int32 ring[2 * MVT_MAX_RING_VERTS];
+    int num_ring = mvt_cell_ring(tile, index, ring);
+    if (num_ring > 0) {
+        mvt_layer_add_feature(layer, index, ring, num_ring, value);
+    }
+}
+
+/*
+ * the tile with a single layer, empty when the layer has no features
+ */
+static bytea *
+mvt_layer_finish(MvtLayer *layer, const char *name, int extent, bool with_values)
+{
+    bytea *result;
+
+    if (layer->features.len == 0) {
+        result = palloc(VARHDRSZ);
+        SET_VARSIZE(result, VARHDRSZ);
+        return result;
+    }
+
+    StringInfoData message;
+    initStringInfo(&message);
+
+    pb_write_key(&message, MVT_LAYER_VERSION, PB_WIRE_VARINT);
+    pb_write_varint(&message, 2);
+    pb_write_bytes(&message, MVT_LAYER_NAME, name, strlen(name));
+    appendBinaryStringInfo(&message, layer->features.data, layer->features.len);
+    pb_write_bytes(&message, MVT_LAYER_KEYS, "h3index", strlen("h3index"));
+    if (with_values) {
+        pb_write_bytes(&message, MVT_LAYER_KEYS, "value", strlen("value"));
+    }
+    appendBinaryStringInfo(&message, layer->values.data, layer->values.len);
+    pb_write_key(&message, MVT_LAYER_EXTENT, PB_WIRE_VARINT);
+    pb_write_varint(&message, extent);
+
+    StringInfoData tile;
+    initStringInfo(&tile);
+    appendStringInfoSpaces(&tile, VARHDRSZ);
+    pb_write_bytes(&tile, MVT_TILE_LAYERS, message.data, message.len);
+    pfree(message.data);
+
+    result = (bytea *) tile.data;
+    SET_VARSIZE(result, tile.len);
+    return result;
+}
+
+
+PG_FUNCTION_INFO_V1(h3_mvt_tile);
+
+/*
+ * Encode the cells of the given resolution covering the tile
+ * zoom/x/y as a Mapbox Vector Tile.
+ *
+ * Arguments: zoom, x, y, resolution, cells, values, layer name, extent.
+ * The cells and values are optional, all other arguments are required.
+ */
+Datum
+h3_mvt_tile(PG_FUNCTION_ARGS)
+{
+    for (int i = 0; i < 8; i++) {
+        if (i != 4 && i != 5 && PG_ARGISNULL(i)) {
+            PG_RETURN_NULL();
+        }
+    }
+    if (PG_ARGISNULL(4) != PG_ARGISNULL(5)) {
+        fail_and_report_with_code(ERRCODE_NULL_VALUE_NOT_ALLOWED,
+                "The cells and the values must both be given or both be null");
+    }
+
+    int resolution = PG_GETARG_INT32(3);
+    if (resolution < 0 || resolution > PGH3_MAX_RES) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "The resolution must be between 0 and %d", PGH3_MAX_RES);
+    }
+
+    MvtTile tile;
+    mvt_tile_init(&tile, PG_GETARG_INT32(0), PG_GETARG_INT32(1), PG_GETARG_INT32(2),
+                PG_GETARG_INT32(7));
+    char *layer_name = text_to_cstring(PG_GETARG_TEXT_PP(6));
+
+    bool with_values = !PG_ARGISNULL(4);
+    MvtCellValue *values = NULL;
+    int num_values = 0;
+    if (with_values) {
+        values = mvt_cell_values_from_pg(PG_GETARG_ARRAYTYPE_P(4), PG_GETARG_ARRAYTYPE_P(5),
+                    &num_values);
+    }
+
+    MvtLayer layer;
+    mvt_layer_init(&layer);
+
+    if (with_values) {
+        // only the given cells are encoded, so they are tested against the
+        // tile instead of filling the tile with all cells of the resolution
+        for (int i = 0; i < num_values; i++) {
+            if (H3_EXPORT(h3GetResolution)(values[i].index) != resolution) {
+                continue;
+            }
+            mvt_layer_add_cell(&layer, &tile, values[i].index, &values[i]);
+        }
+    }
+    else {
+        // centroids of cells overlapping the tile are at most about two edge
+        // lengths away from it, one degree of latitude is approx. 111.2km
+        BOX search_box = tile.box;
+        double margin = 2.0 * H3_EXPORT(edgeLengthKm)(resolution) / 111.2;
+        double max_abs_lat = Min(Max(fabs(tile.box.low.y), fabs(tile.box.high.y)) + margin, 89.0);
+        double margin_lon = margin / cos(degsToRads(max_abs_lat));
+        search_box.low.x -= margin_lon;
+        search_box.high.x += margin_lon;
+        search_box.low.y -= margin;
+        search_box.high.y += margin;
+
+        int64 num_hexagons = 0;
+        H3Index *hexagons = __h3_polyfill_box(&search_box, resolution, &num_hexagons);
+        for (int64 i = 0; i < num_hexagons; i++) {
+            mvt_layer_add_cell(&layer, &tile, hexagons[i], NULL);
+        }
+        pfree(hexagons);
+    }
+
+    PG_RETURN_BYTEA_P(mvt_layer_finish(&layer, layer_name, tile.extent, with_values));
+}
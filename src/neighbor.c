@@ -27,91 +27,591 @@
 #include "utils/array.h"
 #include "utils/geo_decls.h"
 #include "funcapi.h"
+#include "access/htup_details.h"
+#include "utils/memutils.h"
+
+#include <string.h>
 
 #include <h3/h3api.h>
 
 
+/*
+ * Iteration over the rings of neighbors around an index, one ring
+ * at a time.
+ *
+ * The rings are generated with hexRing, which fails when it encounters
+ * a pentagon. In that case the remaining rings are taken from kRingDistances,
+ * which handles pentagons, sorted by their distance. Only this fallback
+ * materializes the disk, for all other cells the memory usage is bound by
+ * the size of the largest ring.
+ */
+typedef struct {
+    H3Index origin;
+    int ring;           // the ring currently returned
+    int last_ring;
+    H3Index *cells;     // cells of the current ring, with the fallback those of all remaining rings
+    int *distances;     // only set with the fallback, otherwise the distance is the ring
+    int num_cells;
+    int position;
+} KRingIterator;
+
+static void
+kring_iterator_init(KRingIterator *iter, H3Index origin, int first_ring, int last_ring)
+{
+    if (first_ring < 0 || last_ring < 0) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "The distance must not be negative");
+    }
+
+    iter->origin = origin;
+    iter->ring = first_ring - 1;
+    iter->last_ring = last_ring;
+    iter->cells = palloc(Max(6 * last_ring, 1) * sizeof(H3Index));
+    iter->distances = NULL;
+    iter->num_cells = 0;
+    iter->position = 0;
+}
+
+/*
+ * replace the cells by the ones of all rings starting with first_ring
+ * as computed by kRingDistances
+ */
+static void
+kring_iterator_fallback(KRingIterator *iter, int first_ring)
+{
+    int max_num_cells = H3_EXPORT(maxKringSize)(iter->last_ring);
+
+    report_debug1("Encountered a pentagon in ring %d, generating the rings up to %d with kRing",
+                first_ring, iter->last_ring);
+
+    H3Index *disk = palloc0(max_num_cells * sizeof(H3Index));
+    int *disk_distances = palloc0(max_num_cells * sizeof(int));
+    H3_EXPORT(kRingDistances)(iter->origin, iter->last_ring, disk, disk_distances);
+
+    // counting sort of the cells by their ring, dropping the inner
+    // rings and the unused slots
+    int num_rings = iter->last_ring - first_ring + 1;
+    int *ring_offsets = palloc0((num_rings + 1) * sizeof(int));
+    for (int i = 0; i < max_num_cells; i++) {
+        if (disk[i] != 0 && disk_distances[i] >= first_ring) {
+            ring_offsets[disk_distances[i] - first_ring + 1]++;
+        }
+    }
+    for (int r = 0; r < num_rings; r++) {
+        ring_offsets[r + 1] += ring_offsets[r];
+    }
+
+    int num_cells = ring_offsets[num_rings];
+    pfree(iter->cells);
+    iter->cells = palloc(Max(num_cells, 1) * sizeof(H3Index));
+    iter->distances = palloc(Max(num_cells, 1) * sizeof(int));
+
+    for (int i = 0; i < max_num_cells; i++) {
+        if (disk[i] != 0 && disk_distances[i] >= first_ring) {
+            int pos = ring_offsets[disk_distances[i] - first_ring]++;
+            iter->cells[pos] = disk[i];
+            iter->distances[pos] = disk_distances[i];
+        }
+    }
+
+    pfree(ring_offsets);
+    pfree(disk_distances);
+    pfree(disk);
+
+    iter->ring = iter->last_ring;
+    iter->num_cells = num_cells;
+    iter->position = 0;
+}
+
+/*
+ * Get the next cell and its distance. Returns false when all rings
+ * have been returned.
+ */
+static bool
+kring_iterator_next(KRingIterator *iter, H3Index *cell, int *distance)
+{
+    while (iter->position >= iter->num_cells) {
+        if (iter->ring >= iter->last_ring) {
+            return false;
+        }
+        iter->ring++;
+
+        if (H3_EXPORT(hexRing)(iter->origin, iter->ring, iter->cells) != 0) {
+            kring_iterator_fallback(iter, iter->ring);
+        }
+        else {
+            iter->num_cells = (iter->ring == 0) ? 1 : 6 * iter->ring;
+            iter->position = 0;
+        }
+    }
+
+    *cell = iter->cells[iter->position];
+    *distance = (iter->distances != NULL) ? iter->distances[iter->position] : iter->ring;
+    iter->position++;
+    return true;
+}
+
+
 PG_FUNCTION_INFO_V1(h3_kring);
 
 /*
  * Returns the neigbor indices within the given distance.
- *
- * The indexex are returned in thier string representations
  */
 Datum
 h3_kring(PG_FUNCTION_ARGS)
 {
     FuncCallContext *funcctx;
-    int call_cntr = 0;
-    int max_calls = 0;
     MemoryContext oldcontext;
-    H3Index *hexagons = NULL;
+    KRingIterator *iter = NULL;
 
     if (SRF_IS_FIRSTCALL()) {
 
-        text *center_index_text = PG_GETARG_TEXT_P(0);
-        char * center_index_cstr = text_to_cstring(center_index_text);
-        H3Index center_index;
-        __h3_index_from_cstring(center_index_cstr, &center_index);
+        H3Index center_index = PG_GETARG_H3INDEX(0);
 
         int distance = PG_GETARG_INT32(1);
 
         funcctx = SRF_FIRSTCALL_INIT();
         oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
 
-        int max_num_neighbors = H3_EXPORT(maxKringSize)(distance);
+        report_debug1("Generating H3 hexagons within distance %d", distance);
 
-        report_debug1("Generating %d H3 child hexagons within distance %d", 
-                        max_num_neighbors, distance);
+        iter = palloc(sizeof(KRingIterator));
+        kring_iterator_init(iter, center_index, 0, distance);
+        funcctx->user_fctx = iter;
 
-        hexagons = palloc0(max_num_neighbors * sizeof(H3Index));
-        kRing(center_index, distance, hexagons);
+        MemoryContextSwitchTo(oldcontext);
+    }
 
-        for (int i = 0; i < max_num_neighbors; i++) {
-            if (hexagons[i] != 0) {
-                if (i > max_calls) {
-                    // fill NULL "holes" in list of hexagons with the hexagons located
-                    // after the NULL value. This allows us to use call_cntr and max_calls
-                    // for iteration during SRF calls.
-                    hexagons[max_calls] = hexagons[i];
-                    hexagons[i] = 0;
-                }
-                max_calls++;
+    // stuff done on every call of the function
+    funcctx = SRF_PERCALL_SETUP();
+    iter = funcctx->user_fctx;
+
+    H3Index cell;
+    int distance;
+    PgH3StatsTimer timer;
+
+    __h3_stats_start(&timer, PGH3_STATS_KRING);
+    oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+    bool found = kring_iterator_next(iter, &cell, &distance);
+    MemoryContextSwitchTo(oldcontext);
+    __h3_stats_stop(&timer, funcctx->call_cntr == 0 ? 1 : 0, found ? 1 : 0);
+
+    if (found) {
+        SRF_RETURN_NEXT(funcctx, H3IndexGetDatum(cell));
+    }
+    else {
+        SRF_RETURN_DONE(funcctx);
+    }
+}
+
+
+PG_FUNCTION_INFO_V1(h3_kring_distances);
+
+/*
+ * Returns the neigbor indices within the given distance together with
+ * their distance to the index, ring by ring starting with the index
+ * itself.
+ */
+Datum
+h3_kring_distances(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    MemoryContext oldcontext;
+    KRingIterator *iter = NULL;
+
+    if (SRF_IS_FIRSTCALL()) {
+
+        H3Index center_index = PG_GETARG_H3INDEX(0);
+
+        int distance = PG_GETARG_INT32(1);
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        TupleDesc tupdesc;
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            fail_and_report_with_code(ERRCODE_FEATURE_NOT_SUPPORTED,
+                    "function returning record called in context that cannot accept type record");
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        iter = palloc(sizeof(KRingIterator));
+        kring_iterator_init(iter, center_index, 0, distance);
+        funcctx->user_fctx = iter;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    // stuff done on every call of the function
+    funcctx = SRF_PERCALL_SETUP();
+    iter = funcctx->user_fctx;
+
+    H3Index cell;
+    int distance;
+    PgH3StatsTimer timer;
+
+    __h3_stats_start(&timer, PGH3_STATS_KRING);
+    oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+    bool found = kring_iterator_next(iter, &cell, &distance);
+    MemoryContextSwitchTo(oldcontext);
+    __h3_stats_stop(&timer, funcctx->call_cntr == 0 ? 1 : 0, found ? 1 : 0);
+
+    if (found) {
+        Datum values[2] = {H3IndexGetDatum(cell), Int32GetDatum(distance)};
+        bool nulls[2] = {false, false};
+        HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+    else {
+        SRF_RETURN_DONE(funcctx);
+    }
+}
+
+
+PG_FUNCTION_INFO_V1(h3_hex_ring);
+
+/*
+ * Returns the neigbor indices at exactly the given distance.
+ */
+Datum
+h3_hex_ring(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    MemoryContext oldcontext;
+    KRingIterator *iter = NULL;
+
+    if (SRF_IS_FIRSTCALL()) {
+
+        H3Index center_index = PG_GETARG_H3INDEX(0);
+
+        int distance = PG_GETARG_INT32(1);
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        iter = palloc(sizeof(KRingIterator));
+        kring_iterator_init(iter, center_index, distance, distance);
+        funcctx->user_fctx = iter;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    // stuff done on every call of the function
+    funcctx = SRF_PERCALL_SETUP();
+    iter = funcctx->user_fctx;
+
+    H3Index cell;
+    int distance;
+    PgH3StatsTimer timer;
+
+    __h3_stats_start(&timer, PGH3_STATS_KRING);
+    oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+    bool found = kring_iterator_next(iter, &cell, &distance);
+    MemoryContextSwitchTo(oldcontext);
+    __h3_stats_stop(&timer, funcctx->call_cntr == 0 ? 1 : 0, found ? 1 : 0);
+
+    if (found) {
+        SRF_RETURN_NEXT(funcctx, H3IndexGetDatum(cell));
+    }
+    else {
+        SRF_RETURN_DONE(funcctx);
+    }
+}
+
+
+/*
+ * the cells of the rings first_ring to last_ring as an array
+ */
+static ArrayType *
+kring_to_array(FunctionCallInfo fcinfo, H3Index origin, int first_ring, int last_ring)
+{
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_KRING);
+
+    KRingIterator iter;
+    kring_iterator_init(&iter, origin, first_ring, last_ring);
+
+    // 1 + 6 + 12 + ... cells, fewer around pentagons
+    int64 max_num_cells = 0;
+    for (int64 ring = first_ring; ring <= last_ring; ring++) {
+        max_num_cells += (ring == 0) ? 1 : 6 * ring;
+    }
+    H3Index *cells = __h3_index_array_buffer(max_num_cells);
+
+    int num_cells = 0;
+    H3Index cell;
+    int distance;
+    while (kring_iterator_next(&iter, &cell, &distance)) {
+        cells[num_cells++] = cell;
+    }
+
+    ArrayType *result = __h3_index_array_to_pg(fcinfo, cells, NULL, num_cells);
+    pfree(cells);
+
+    __h3_stats_stop(&timer, 1, num_cells);
+    return result;
+}
+
+
+PG_FUNCTION_INFO_V1(h3_kring_array);
+
+/*
+ * Returns the neigbor indices within the given distance as an array.
+ */
+Datum
+h3_kring_array(PG_FUNCTION_ARGS)
+{
+    H3Index center_index = PG_GETARG_H3INDEX(0);
+
+    int distance = PG_GETARG_INT32(1);
+
+    PG_RETURN_ARRAYTYPE_P(kring_to_array(fcinfo, center_index, 0, distance));
+}
+
+
+PG_FUNCTION_INFO_V1(h3_hex_ring_array);
+
+/*
+ * Returns the neigbor indices at exactly the given distance as an array.
+ */
+Datum
+h3_hex_ring_array(PG_FUNCTION_ARGS)
+{
+    H3Index center_index = PG_GETARG_H3INDEX(0);
+
+    int distance = PG_GETARG_INT32(1);
+
+    PG_RETURN_ARRAYTYPE_P(kring_to_array(fcinfo, center_index, distance, distance));
+}
+
+/*
+ * Neighborhood of a set of cells
+ *
+ * A breadth-first search starting from all cells of the set at once. Each
+ * cell is visited once, so its distance is the minimum distance to any
+ * cell of the set and no duplicates are generated. The visited cells are
+ * kept in an open-addressing hash set with linear probing, the cells
+ * themselves in the order of their discovery, which is ordered by distance.
+ *
+ * The rings are expanded lazily, one distance at a time.
+ */
+typedef struct {
+    H3Index *cells;         // all visited cells, ordered by distance
+    int64 num_cells;
+    int64 cells_size;
+
+    H3Index *slots;         // hash set of the visited cells, 0 marks free slots
+    uint64 num_slots;       // a power of 2
+
+    int distance;           // distance of the cells currently returned
+    int max_distance;
+    int64 ring_start;       // the cells at the current distance
+    int64 ring_end;
+    int64 position;
+} MultiKRingState;
+
+static inline uint64
+multi_kring_hash(H3Index index)
+{
+    // finalizer of MurmurHash3, the lower bits of indexes are often all set
+    uint64 h = index;
+    h ^= h >> 33;
+    h *= UINT64CONST(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64CONST(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+static void
+multi_kring_resize(MultiKRingState *state, uint64 num_slots)
+{
+    H3Index *old_slots = state->slots;
+    uint64 old_num_slots = state->num_slots;
+
+    state->slots = MemoryContextAllocHuge(CurrentMemoryContext, num_slots * sizeof(H3Index));
+    memset(state->slots, 0, num_slots * sizeof(H3Index));
+    state->num_slots = num_slots;
+
+    for (uint64 i = 0; i < old_num_slots; i++) {
+        if (old_slots[i] != 0) {
+            uint64 slot = multi_kring_hash(old_slots[i]) & (num_slots - 1);
+            while (state->slots[slot] != 0) {
+                slot = (slot + 1) & (num_slots - 1);
+            }
+            state->slots[slot] = old_slots[i];
+        }
+    }
+    if (old_slots != NULL) {
+        pfree(old_slots);
+    }
+}
+
+/*
+ * add the cell to the visited cells unless it has been visited before
+ */
+static void
+multi_kring_visit(MultiKRingState *state, H3Index cell)
+{
+    // keep the load factor below 1/2
+    if ((uint64) state->num_cells * 2 >= state->num_slots) {
+        multi_kring_resize(state, state->num_slots * 2);
+    }
+
+    uint64 slot = multi_kring_hash(cell) & (state->num_slots - 1);
+    while (state->slots[slot] != 0) {
+        if (state->slots[slot] == cell) {
+            return;
+        }
+        slot = (slot + 1) & (state->num_slots - 1);
+    }
+    state->slots[slot] = cell;
+
+    if (state->num_cells == state->cells_size) {
+        state->cells_size *= 2;
+        state->cells = repalloc_huge(state->cells, state->cells_size * sizeof(H3Index));
+    }
+    state->cells[state->num_cells++] = cell;
+}
+
+/*
+ * visit the direct neighbors of the cells at the current distance
+ */
+static void
+multi_kring_expand(MultiKRingState *state)
+{
+    H3Index neighbors[7];
+
+    for (int64 i = state->ring_start; i < state->ring_end; i++) {
+        // holes in the output are left for the deleted neighbor of pentagons
+        memset(neighbors, 0, sizeof(neighbors));
+        H3_EXPORT(kRing)(state->cells[i], 1, neighbors);
+        for (int n = 0; n < 7; n++) {
+            if (neighbors[n] != 0) {
+                multi_kring_visit(state, neighbors[n]);
             }
         }
+    }
 
-        if (max_calls > 0) {
-            // keep track of the results
-            funcctx->max_calls = max_calls;
-            funcctx->user_fctx = hexagons;
+    state->distance++;
+    state->ring_start = state->ring_end;
+    state->ring_end = state->num_cells;
+}
+
+static MultiKRingState *
+multi_kring_state_create(const H3Index *indexes, int num_indexes, int max_distance)
+{
+    if (max_distance < 0) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "The distance must not be negative");
+    }
+
+    MultiKRingState *state = palloc0(sizeof(MultiKRingState));
+    state->max_distance = max_distance;
+    state->cells_size = Max(num_indexes, 64);
+    state->cells = MemoryContextAllocHuge(CurrentMemoryContext, state->cells_size * sizeof(H3Index));
+
+    uint64 num_slots = 1024;
+    while (num_slots < (uint64) num_indexes * 4) {
+        num_slots *= 2;
+    }
+    multi_kring_resize(state, num_slots);
+
+    int resolution = -1;
+    for (int i = 0; i < num_indexes; i++) {
+        if (indexes[i] == 0) {
+            continue;
         }
-        else {
-            // fast track when no results
-            pfree(hexagons);
-            hexagons = NULL;
+        // distances between cells of different resolutions are undefined
+        int index_res = H3_EXPORT(h3GetResolution)(indexes[i]);
+        if (resolution >= 0 && index_res != resolution) {
+            fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                    "All indexes must have the same resolution, found %d and %d", resolution, index_res);
+        }
+        resolution = index_res;
+
+        multi_kring_visit(state, indexes[i]);
+    }
+    state->ring_end = state->num_cells;
+
+    return state;
+}
+
 
-            MemoryContextSwitchTo(oldcontext);
-            SRF_RETURN_DONE(funcctx);
+PG_FUNCTION_INFO_V1(h3_kring_distances_multi);
+
+/*
+ * Returns the union of the neighbors within the given distance of all
+ * indexes of the array, each with its minimum distance to any of
+ * the indexes.
+ */
+Datum
+h3_kring_distances_multi(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    MemoryContext oldcontext;
+    MultiKRingState *state = NULL;
+    PgH3StatsTimer timer;
+
+    // the first call visits the indexes of the array
+    __h3_stats_start(&timer, PGH3_STATS_KRING);
+
+    if (SRF_IS_FIRSTCALL()) {
+
+        ArrayType *indexes_array = PG_GETARG_ARRAYTYPE_P(0);
+
+        int distance = PG_GETARG_INT32(1);
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        TupleDesc tupdesc;
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            fail_and_report_with_code(ERRCODE_FEATURE_NOT_SUPPORTED,
+                    "function returning record called in context that cannot accept type record");
         }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        int num_indexes = 0;
+        H3Index *indexes = __h3_index_array_from_pg(indexes_array, &num_indexes);
+
+        state = multi_kring_state_create(indexes, num_indexes, distance);
+        if (indexes != NULL) {
+            pfree(indexes);
+        }
+
+        report_debug1("Generating H3 hexagons within distance %d of %d hexagons",
+                    distance, (int) state->num_cells);
+
+        funcctx->user_fctx = state;
+
         MemoryContextSwitchTo(oldcontext);
     }
 
     // stuff done on every call of the function
     funcctx = SRF_PERCALL_SETUP();
+    state = funcctx->user_fctx;
 
-    // Initialize per-call variables
-    call_cntr = funcctx->call_cntr;
-    max_calls = funcctx->max_calls;
-    hexagons = funcctx->user_fctx;
+    if (state->position == state->ring_end && state->distance < state->max_distance
+            && state->ring_start < state->ring_end) {
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        multi_kring_expand(state);
+        MemoryContextSwitchTo(oldcontext);
+    }
 
-    if (call_cntr < max_calls) {
-        text * index_text = __h3_index_to_text(hexagons[call_cntr]);
-        SRF_RETURN_NEXT(funcctx, PointerGetDatum(index_text));
+    bool found = state->position < state->ring_end;
+    __h3_stats_stop(&timer, funcctx->call_cntr == 0 ? 1 : 0, found ? 1 : 0);
+
+    if (found) {
+        Datum values[2] = {H3IndexGetDatum(state->cells[state->position]), Int32GetDatum(state->distance)};
+        bool nulls[2] = {false, false};
+        HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+        state->position++;
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
     }
     else {
-        pfree(hexagons);
-        hexagons = NULL;
-
         SRF_RETURN_DONE(funcctx);
     }
 }
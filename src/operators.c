@@ -0,0 +1,208 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "utils/sortsupport.h"
+
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#elif PG_VERSION_NUM >= 120000
+#include "utils/hashutils.h"
+#else
+#include "access/hash.h"
+#endif
+
+#include <h3/h3api.h>
+
+
+/*
+ * Comparison operators for the btree operator class.
+ *
+ * See PGH3_ORDER_KEY for the sort order.
+ */
+
+#define H3INDEX_CMP_FUNC(FUNC_NAME, OPERATOR) \
+    Datum \
+    FUNC_NAME(PG_FUNCTION_ARGS) \
+    { \
+        H3Index a = PG_GETARG_H3INDEX(0); \
+        H3Index b = PG_GETARG_H3INDEX(1); \
+        PG_RETURN_BOOL(__h3_index_cmp(a, b) OPERATOR 0); \
+    }
+
+PG_FUNCTION_INFO_V1(h3index_lt);
+H3INDEX_CMP_FUNC(h3index_lt, <);
+
+PG_FUNCTION_INFO_V1(h3index_le);
+H3INDEX_CMP_FUNC(h3index_le, <=);
+
+PG_FUNCTION_INFO_V1(h3index_gt);
+H3INDEX_CMP_FUNC(h3index_gt, >);
+
+PG_FUNCTION_INFO_V1(h3index_ge);
+H3INDEX_CMP_FUNC(h3index_ge, >=);
+
+
+PG_FUNCTION_INFO_V1(h3index_eq);
+
+Datum
+h3index_eq(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(PG_GETARG_H3INDEX(0) == PG_GETARG_H3INDEX(1));
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_ne);
+
+Datum
+h3index_ne(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(PG_GETARG_H3INDEX(0) != PG_GETARG_H3INDEX(1));
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_cmp);
+
+Datum
+h3index_cmp(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_INT32(__h3_index_cmp(PG_GETARG_H3INDEX(0), PG_GETARG_H3INDEX(1)));
+}
+
+
+static int
+h3index_fastcmp(Datum x, Datum y, SortSupport ssup)
+{
+    return __h3_index_cmp(DatumGetH3Index(x), DatumGetH3Index(y));
+}
+
+PG_FUNCTION_INFO_V1(h3index_sortsupport);
+
+/*
+ * SortSupport for the btree operator class. Compares the integers
+ * directly without going through the fmgr interface.
+ */
+Datum
+h3index_sortsupport(PG_FUNCTION_ARGS)
+{
+    SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+    ssup->comparator = h3index_fastcmp;
+    PG_RETURN_VOID();
+}
+
+
+/*
+ * Hash functions for the hash operator class.
+ *
+ * These fold the 64bit value into 32bit the same way the hash function
+ * for bigint does.
+ */
+
+static inline uint32
+h3index_fold(H3Index index)
+{
+    return ((uint32) index) ^ ((uint32) (index >> 32));
+}
+
+PG_FUNCTION_INFO_V1(h3index_hash);
+
+Datum
+h3index_hash(PG_FUNCTION_ARGS)
+{
+    H3Index index = PG_GETARG_H3INDEX(0);
+    return hash_uint32(h3index_fold(index));
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_hash_extended);
+
+Datum
+h3index_hash_extended(PG_FUNCTION_ARGS)
+{
+    H3Index index = PG_GETARG_H3INDEX(0);
+    uint64 seed = PG_GETARG_INT64(1);
+    return hash_uint32_extended(h3index_fold(index), seed);
+}
+
+
+/*
+ * Hierarchical containment: an index contains itself and all
+ * of its descendants.
+ */
+
+PG_FUNCTION_INFO_V1(h3index_contains);
+
+Datum
+h3index_contains(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(__h3_index_contains(PG_GETARG_H3INDEX(0), PG_GETARG_H3INDEX(1)));
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_contained_by);
+
+Datum
+h3index_contained_by(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_BOOL(__h3_index_contains(PG_GETARG_H3INDEX(1), PG_GETARG_H3INDEX(0)));
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_descendants_lower_bound);
+
+/*
+ * The lower end of the range of the btree order holding the index
+ * and its descendants. The index itself is the upper end.
+ */
+Datum
+h3index_descendants_lower_bound(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_H3INDEX(__h3_index_descendants_lower_bound(PG_GETARG_H3INDEX(0)));
+}
+
+
+/*
+ * Overlap of the boundary of an index with a box of coordinates
+ * in degrees.
+ */
+
+PG_FUNCTION_INFO_V1(h3index_overlaps_box);
+
+Datum
+h3index_overlaps_box(PG_FUNCTION_ARGS)
+{
+    H3Index index = PG_GETARG_H3INDEX(0);
+    BOX *box = PG_GETARG_BOX_P(1);
+    PG_RETURN_BOOL(__h3_index_overlaps_box(index, box));
+}
+
+
+PG_FUNCTION_INFO_V1(box_overlaps_h3index);
+
+Datum
+box_overlaps_h3index(PG_FUNCTION_ARGS)
+{
+    BOX *box = PG_GETARG_BOX_P(0);
+    H3Index index = PG_GETARG_H3INDEX(1);
+    PG_RETURN_BOOL(__h3_index_overlaps_box(index, box));
+}
@@ -21,10 +21,24 @@
 #include "fmgr.h"
 #include "utils/builtins.h"
 
+#include "util.h"
+
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
+void _PG_init(void);
+
+/*
+ * called when the library is loaded
+ */
+void
+_PG_init(void)
+{
+    __h3_geometry_cache_init();
+    __h3_stats_init();
+}
+
 
 PG_FUNCTION_INFO_V1(h3_ext_version);
 
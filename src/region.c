@@ -30,6 +30,17 @@
 #include "utils/lsyscache.h"
 #include "access/tupmacs.h"
 #include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/memutils.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
 #include <h3/h3api.h>
 
@@ -147,16 +158,816 @@ h3_maxPolyfillSize_checked(GeoPolygon *h3polygon, int resolution)
 }
 
 
+// radius of the earth used by H3
+#define PGH3_EARTH_RADIUS_KM 6371.007180918475
+
+/*
+ * The number of hexagons in the bounding box of the polygon, holes are
+ * ignored. Unlike the estimate of H3 this does not overflow, so it
+ * can be used for polygons of any size.
+ */
+double
+__h3_polyfill_area_estimate(const GeoPolygon *polygon, int resolution)
+{
+    const Geofence *geofence = &polygon->geofence;
+    if (geofence->numVerts == 0) {
+        return 0.0;
+    }
+
+    double min_lat = geofence->verts[0].lat;
+    double max_lat = min_lat;
+    double min_lon = geofence->verts[0].lon;
+    double max_lon = min_lon;
+    double min_lon_shifted = INFINITY;  // longitudes shifted to 0 - 2 pi
+    double max_lon_shifted = -INFINITY;
+    for (int v = 0; v < geofence->numVerts; v++) {
+        double lat = geofence->verts[v].lat;
+        double lon = geofence->verts[v].lon;
+        double lon_shifted = lon < 0 ? lon + 2 * M_PI : lon;
+
+        min_lat = Min(min_lat, lat);
+        max_lat = Max(max_lat, lat);
+        min_lon = Min(min_lon, lon);
+        max_lon = Max(max_lon, lon);
+        min_lon_shifted = Min(min_lon_shifted, lon_shifted);
+        max_lon_shifted = Max(max_lon_shifted, lon_shifted);
+    }
+
+    // a polygon crossing the antimeridian is narrower with shifted longitudes
+    double width = Min(max_lon - min_lon, max_lon_shifted - min_lon_shifted);
+    double area_km2 = PGH3_EARTH_RADIUS_KM * PGH3_EARTH_RADIUS_KM * width * (sin(max_lat) - sin(min_lat));
+
+    return area_km2 / H3_EXPORT(hexAreaKm2)(resolution);
+}
+
+/*
+ * The estimate of H3 covers the bounding box of the polygon. When it is
+ * negative or far below the area of the bounding box, it has overflowed.
+ * The average area of the hexagons differs from the smallest one by less
+ * than a factor of 2.
+ */
+static bool
+h3_maxPolyfillSize_overflows(int numHexagons, double area_estimate)
+{
+    return numHexagons < 0 || numHexagons == INT_MAX || area_estimate > 2.0 * numHexagons;
+}
+
+
+/*
+ * Tiled polyfill
+ *
+ * Instead of preallocating the memory for the estimated number of hexagons
+ * of the whole polygon, the polygon is filled tile by tile. The tiles are the
+ * cells at a coarser resolution which are found by a depth-first traversal
+ * of the H3 hierarchy starting at the base cells. On each level the polygon
+ * is clipped to the bounding box of the descendants of the cell, cells with
+ * an empty clipped polygon are skipped together with all of their
+ * descendants.
+ *
+ * The tiles are filled using polyfill of H3 with the clipped polygon, only
+ * hexagons having the tile as their parent are kept. As every hexagon
+ * has exactly one parent and the bounding box of the tile contains the
+ * centroids of all of its descendants, the result is the same as
+ * the one of a polyfill of the whole polygon - only the order differs.
+ *
+ * The working set is bounded by the size of a tile and the depth of the
+ * hierarchy, so the hexagons can be returned as soon as a tile is done.
+ */
+
+// number of resolutions between the tiles and the requested resolution
+#define POLYFILL_TILE_RES_OFFSET    4
+
+// maximum number of children of a cell one resolution finer
+#define POLYFILL_MAX_CHILDREN       7
+
+typedef struct {
+    GeoPolygon polygon;         // the polygon clipped to the parent of the candidates
+    H3Index *candidates;        // cells of this resolution to visit
+    int num_candidates;
+    int next_candidate;
+    MemoryContext context;      // holds the clipped polygon
+} PolyfillLevel;
+
+typedef struct {
+    int resolution;
+    int tile_resolution;
+    int depth;
+    PolyfillLevel levels[PGH3_MAX_RES + 1];
+    H3Index basecells[PGH3_NUM_BASECELLS];
+    H3Index children[PGH3_MAX_RES + 1][POLYFILL_MAX_CHILDREN];
+
+    // number of threads filling the tiles, 1 fills them in the backend itself
+    int num_threads;
+
+    // return cells covered completely by the polygon as tiles without
+    // descending further, see the compacted polyfill
+    bool find_inside;
+    bool tile_inside;           // the last tile is covered completely
+
+    // the hexagons of the current tile or batch of tiles
+    H3Index *hexagons;
+    int num_hexagons;
+    int next_hexagon;
+    MemoryContext tile_context;
+} PolyfillTiles;
+
+typedef struct {
+    GeoCoord *verts;
+    int num_verts;
+    int size;
+} PolyfillRing;
+
+static inline void
+polyfill_ring_append(PolyfillRing *ring, GeoCoord coord)
+{
+    if (ring->num_verts == ring->size) {
+        ring->size = (ring->size == 0) ? 16 : ring->size * 2;
+        if (ring->verts == NULL) {
+            ring->verts = palloc(ring->size * sizeof(GeoCoord));
+        }
+        else {
+            ring->verts = repalloc(ring->verts, ring->size * sizeof(GeoCoord));
+        }
+    }
+    ring->verts[ring->num_verts++] = coord;
+}
+
+/*
+ * Sutherland-Hodgman clipping of a ring against one edge of the box.
+ * edge: 0 = west, 1 = east, 2 = south, 3 = north.
+ */
+static void
+polyfill_clip_ring_edge(const GeoCoord *in, int num_in, int edge, double value, PolyfillRing *out)
+{
+    out->num_verts = 0;
+
+#define POLYFILL_INSIDE(c) \
+    ((edge == 0) ? (c).lon >= value : (edge == 1) ? (c).lon <= value : \
+     (edge == 2) ? (c).lat >= value : (c).lat <= value)
+
+    for (int i = 0; i < num_in; i++) {
+        GeoCoord cur = in[i];
+        GeoCoord prev = in[(i + num_in - 1) % num_in];
+        bool cur_inside = POLYFILL_INSIDE(cur);
+        bool prev_inside = POLYFILL_INSIDE(prev);
+
+        if (cur_inside != prev_inside) {
+            GeoCoord intersection;
+            if (edge < 2) {
+                double t = (value - prev.lon) / (cur.lon - prev.lon);
+                intersection.lon = value;
+                intersection.lat = prev.lat + t * (cur.lat - prev.lat);
+            }
+            else {
+                double t = (value - prev.lat) / (cur.lat - prev.lat);
+                intersection.lat = value;
+                intersection.lon = prev.lon + t * (cur.lon - prev.lon);
+            }
+            polyfill_ring_append(out, intersection);
+        }
+        if (cur_inside) {
+            polyfill_ring_append(out, cur);
+        }
+    }
+#undef POLYFILL_INSIDE
+}
+
+/*
+ * clip a ring to a box given as west, east, south, north in radians.
+ *
+ * Returns false when nothing of the ring remains.
+ */
+static bool
+polyfill_clip_geofence(const Geofence *in, const double *box, Geofence *out)
+{
+    PolyfillRing a = {NULL, 0, 0};
+    PolyfillRing b = {NULL, 0, 0};
+
+    polyfill_clip_ring_edge(in->verts, in->numVerts, 0, box[0], &a);
+    polyfill_clip_ring_edge(a.verts, a.num_verts, 1, box[1], &b);
+    polyfill_clip_ring_edge(b.verts, b.num_verts, 2, box[2], &a);
+    polyfill_clip_ring_edge(a.verts, a.num_verts, 3, box[3], &b);
+
+    if (a.verts != NULL) {
+        pfree(a.verts);
+    }
+    if (b.num_verts < 3) {
+        if (b.verts != NULL) {
+            pfree(b.verts);
+        }
+        return false;
+    }
+
+    out->verts = b.verts;
+    out->numVerts = b.num_verts;
+    return true;
+}
+
+/*
+ * the bounding box of the descendants of the cell as west, east, south,
+ * north in radians
+ */
+static void
+polyfill_cell_box(H3Index cell, double *box)
+{
+    BOX bbox;
+    __h3_index_descendants_bbox(cell, &bbox);
+
+    box[0] = degsToRads(bbox.low.x);
+    box[1] = degsToRads(bbox.high.x);
+    box[2] = degsToRads(bbox.low.y);
+    box[3] = degsToRads(bbox.high.y);
+}
+
+/*
+ * clip the polygon to the bounding box of the descendants of the cell.
+ * The result is allocated in the current memory context.
+ *
+ * Returns false when the clipped polygon is empty.
+ */
+static bool
+polyfill_clip_to_cell(const GeoPolygon *polygon, H3Index cell, GeoPolygon *clipped)
+{
+    double box[4];
+    polyfill_cell_box(cell, box);
+
+    if (!polyfill_clip_geofence(&polygon->geofence, box, &clipped->geofence)) {
+        return false;
+    }
+
+    clipped->numHoles = 0;
+    clipped->holes = NULL;
+    if (polygon->numHoles > 0) {
+        clipped->holes = palloc(polygon->numHoles * sizeof(Geofence));
+        for (int i = 0; i < polygon->numHoles; i++) {
+            if (polyfill_clip_geofence(&polygon->holes[i], box, &clipped->holes[clipped->numHoles])) {
+                clipped->numHoles++;
+            }
+        }
+    }
+    return true;
+}
+
+static bool
+polyfill_geofence_touches_box(const Geofence *geofence, const double *box)
+{
+    for (int i = 0; i < geofence->numVerts; i++) {
+        int next = (i + 1) % geofence->numVerts;
+        if (__h3_segment_intersects_box(&geofence->verts[i], &geofence->verts[next], box)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Check if the polygon covers the bounding box of the descendants of
+ * the cell, so the centroids of all descendants are inside the polygon.
+ * When no ring touches the box, the box is either inside or outside of
+ * each ring completely and its center decides.
+ */
+static bool
+polyfill_covers_cell(const GeoPolygon *polygon, H3Index cell)
+{
+    double box[4];
+    polyfill_cell_box(cell, box);
+
+    if (polyfill_geofence_touches_box(&polygon->geofence, box)) {
+        return false;
+    }
+    for (int i = 0; i < polygon->numHoles; i++) {
+        if (polyfill_geofence_touches_box(&polygon->holes[i], box)) {
+            return false;
+        }
+    }
+
+    double lon = (box[0] + box[1]) / 2.0;
+    double lat = (box[2] + box[3]) / 2.0;
+    if (!__h3_point_in_ring(polygon->geofence.verts, polygon->geofence.numVerts, lon, lat)) {
+        return false;
+    }
+    for (int i = 0; i < polygon->numHoles; i++) {
+        if (__h3_point_in_ring(polygon->holes[i].verts, polygon->holes[i].numVerts, lon, lat)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * polygons crossing the antimeridian are handled by H3 in a way the
+ * clipping does not support.
+ */
+static bool
+polyfill_is_transmeridian(const Geofence *geofence)
+{
+    for (int i = 0; i < geofence->numVerts; i++) {
+        int next = (i + 1) % geofence->numVerts;
+        if (fabs(geofence->verts[i].lon - geofence->verts[next].lon) > M_PI) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static PolyfillTiles *
+polyfill_tiles_create(const GeoPolygon *polygon, int resolution)
+{
+    PolyfillTiles *tiles = palloc0(sizeof(PolyfillTiles));
+
+    tiles->resolution = resolution;
+    tiles->tile_resolution = Max(0, resolution - POLYFILL_TILE_RES_OFFSET);
+    tiles->num_threads = __h3_polyfill_threads();
+    tiles->tile_context = AllocSetContextCreate(CurrentMemoryContext,
+                "pgh3 polyfill tile", ALLOCSET_DEFAULT_SIZES);
+
+    for (int res = 1; res <= tiles->tile_resolution; res++) {
+        tiles->levels[res].context = AllocSetContextCreate(CurrentMemoryContext,
+                "pgh3 polyfill level", ALLOCSET_SMALL_SIZES);
+    }
+
+    for (int bc = 0; bc < PGH3_NUM_BASECELLS; bc++) {
+        tiles->basecells[bc] = PGH3_BASECELL_INDEX(bc);
+    }
+
+    // the polygon is owned by the caller and lives as long as the tiles
+    tiles->levels[0].polygon = *polygon;
+    tiles->levels[0].candidates = tiles->basecells;
+    tiles->levels[0].num_candidates = PGH3_NUM_BASECELLS;
+    tiles->levels[0].next_candidate = 0;
+    tiles->depth = 0;
+
+    return tiles;
+}
+
+/*
+ * fill the tile with the polygon clipped to it. Only the hexagons
+ * having the tile as their parent are kept.
+ */
+static void
+polyfill_tiles_fill(PolyfillTiles *tiles, H3Index tile, GeoPolygon *clipped)
+{
+    int numHexagons = h3_maxPolyfillSize_checked(clipped, tiles->resolution);
+
+    H3Index *hexagons = palloc0(numHexagons * sizeof(H3Index));
+    H3_EXPORT(polyfill)(clipped, tiles->resolution, hexagons);
+
+    int num_hexagons = 0;
+    for (int i = 0; i < numHexagons; i++) {
+        if (hexagons[i] != 0
+                && H3_EXPORT(h3ToParent)(hexagons[i], tiles->tile_resolution) == tile) {
+            hexagons[num_hexagons++] = hexagons[i];
+        }
+    }
+
+    tiles->hexagons = hexagons;
+    tiles->num_hexagons = num_hexagons;
+    tiles->next_hexagon = 0;
+}
+
+/*
+ * advance the traversal to the next tile with a non-empty clipped polygon.
+ * The clipped polygon is allocated in the current memory context.
+ *
+ * With find_inside, cells covered completely by the polygon are returned
+ * as soon as they are found, with tile_inside set and without a
+ * clipped polygon.
+ *
+ * Returns false when all tiles are done.
+ */
+static bool
+polyfill_tiles_next_tile(PolyfillTiles *tiles, H3Index *tile, GeoPolygon *clipped)
+{
+    MemoryContext oldcontext;
+
+    tiles->tile_inside = false;
+    while (tiles->depth >= 0) {
+        PolyfillLevel *level = &tiles->levels[tiles->depth];
+
+        if (level->next_candidate >= level->num_candidates) {
+            tiles->depth--;
+            continue;
+        }
+
+        H3Index cell = level->candidates[level->next_candidate++];
+        if (cell == 0) {
+            // the missing child of a pentagon
+            continue;
+        }
+
+        CHECK_FOR_INTERRUPTS();
+
+        if (tiles->find_inside && polyfill_covers_cell(&level->polygon, cell)) {
+            *tile = cell;
+            tiles->tile_inside = true;
+            return true;
+        }
+
+        if (tiles->depth == tiles->tile_resolution) {
+            if (polyfill_clip_to_cell(&level->polygon, cell, clipped)) {
+                *tile = cell;
+                return true;
+            }
+            continue;
+        }
+
+        PolyfillLevel *child_level = &tiles->levels[tiles->depth + 1];
+        MemoryContextReset(child_level->context);
+        oldcontext = MemoryContextSwitchTo(child_level->context);
+        bool non_empty = polyfill_clip_to_cell(&level->polygon, cell, &child_level->polygon);
+        MemoryContextSwitchTo(oldcontext);
+
+        if (non_empty) {
+            H3Index *children = tiles->children[tiles->depth + 1];
+            memset(children, 0, sizeof(H3Index) * POLYFILL_MAX_CHILDREN);
+            H3_EXPORT(h3ToChildren)(cell, tiles->depth + 1, children);
+
+            child_level->candidates = children;
+            child_level->num_candidates = POLYFILL_MAX_CHILDREN;
+            child_level->next_candidate = 0;
+            tiles->depth++;
+        }
+    }
+    return false;
+}
+
+
+/*
+ * Filling tiles using native threads
+ *
+ * The tiles are independent from each other, so a batch of tiles can be
+ * filled concurrently. The threads only call functions of H3 and use
+ * malloc for their buffers, as neither palloc nor ereport may be used
+ * outside of the backend thread. The results are copied to the memory
+ * context of the tiles and errors are reported after all threads
+ * have been joined.
+ */
+
+// number of tiles per thread in a batch
+#define POLYFILL_TILES_PER_THREAD   8
+
+#define POLYFILL_JOB_OK             0
+#define POLYFILL_JOB_OVERFLOW       1
+#define POLYFILL_JOB_OUT_OF_MEMORY  2
+
+typedef struct {
+    H3Index tile;
+    GeoPolygon polygon;     // clipped to the tile
+    H3Index *hexagons;      // allocated using malloc
+    int num_hexagons;
+    int status;
+} PolyfillJob;
+
+typedef struct {
+    PolyfillJob *jobs;
+    int num_jobs;
+    int first_job;
+    int job_step;
+    int resolution;
+    int tile_resolution;
+} PolyfillWorker;
+
+static void
+polyfill_job_run(PolyfillJob *job, int resolution, int tile_resolution)
+{
+    int numHexagons = H3_EXPORT(maxPolyfillSize)(&job->polygon, resolution);
+    if ((numHexagons < 0) || (numHexagons == INT_MAX)) {
+        job->status = POLYFILL_JOB_OVERFLOW;
+        return;
+    }
+
+    H3Index *hexagons = calloc(Max(numHexagons, 1), sizeof(H3Index));
+    if (hexagons == NULL) {
+        job->status = POLYFILL_JOB_OUT_OF_MEMORY;
+        return;
+    }
+    H3_EXPORT(polyfill)(&job->polygon, resolution, hexagons);
+
+    int num_hexagons = 0;
+    for (int i = 0; i < numHexagons; i++) {
+        if (hexagons[i] != 0
+                && H3_EXPORT(h3ToParent)(hexagons[i], tile_resolution) == job->tile) {
+            hexagons[num_hexagons++] = hexagons[i];
+        }
+    }
+
+    job->hexagons = hexagons;
+    job->num_hexagons = num_hexagons;
+    job->status = POLYFILL_JOB_OK;
+}
+
+static void *
+polyfill_worker_main(void *arg)
+{
+    PolyfillWorker *worker = (PolyfillWorker *) arg;
+
+    for (int i = worker->first_job; i < worker->num_jobs; i += worker->job_step) {
+        polyfill_job_run(&worker->jobs[i], worker->resolution, worker->tile_resolution);
+    }
+    return NULL;
+}
+
+/*
+ * run the jobs on the threads. Jobs of threads which could not be
+ * started are run in the backend.
+ */
+static void
+polyfill_run_jobs(PolyfillTiles *tiles, PolyfillJob *jobs, int num_jobs)
+{
+    int num_threads = Min(tiles->num_threads, num_jobs);
+    PolyfillWorker *workers = palloc(num_threads * sizeof(PolyfillWorker));
+    pthread_t *threads = palloc(num_threads * sizeof(pthread_t));
+    bool *started = palloc0(num_threads * sizeof(bool));
+
+    // signals must be handled by the backend thread
+    sigset_t all_signals, old_signals;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].jobs = jobs;
+        workers[t].num_jobs = num_jobs;
+        workers[t].first_job = t;
+        workers[t].job_step = num_threads;
+        workers[t].resolution = tiles->resolution;
+        workers[t].tile_resolution = tiles->tile_resolution;
+
+        started[t] = (pthread_create(&threads[t], NULL, polyfill_worker_main, &workers[t]) == 0);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    for (int t = 0; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+        else {
+            polyfill_worker_main(&workers[t]);
+        }
+    }
+
+    pfree(workers);
+    pfree(threads);
+    pfree(started);
+}
+
+/*
+ * fill a batch of tiles using threads and merge their hexagons.
+ * Allocates in the current memory context.
+ */
+static void
+polyfill_tiles_fill_batch(PolyfillTiles *tiles)
+{
+    int max_jobs = tiles->num_threads * POLYFILL_TILES_PER_THREAD;
+    PolyfillJob *jobs = palloc0(max_jobs * sizeof(PolyfillJob));
+
+    int num_jobs = 0;
+    while (num_jobs < max_jobs
+            && polyfill_tiles_next_tile(tiles, &jobs[num_jobs].tile, &jobs[num_jobs].polygon)) {
+        num_jobs++;
+    }
+
+    tiles->hexagons = NULL;
+    tiles->num_hexagons = 0;
+    tiles->next_hexagon = 0;
+    if (num_jobs == 0) {
+        return;
+    }
+
+    polyfill_run_jobs(tiles, jobs, num_jobs);
+
+    // merge the results in the backend
+    int status = POLYFILL_JOB_OK;
+    int64 num_hexagons = 0;
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i].status != POLYFILL_JOB_OK) {
+            status = jobs[i].status;
+        }
+        num_hexagons += jobs[i].num_hexagons;
+    }
+
+    if (status == POLYFILL_JOB_OK && num_hexagons > 0) {
+        tiles->hexagons = __h3_polyfill_palloc0(num_hexagons * sizeof(H3Index));
+        for (int i = 0; i < num_jobs; i++) {
+            memcpy(tiles->hexagons + tiles->num_hexagons, jobs[i].hexagons,
+                        jobs[i].num_hexagons * sizeof(H3Index));
+            tiles->num_hexagons += jobs[i].num_hexagons;
+        }
+    }
+
+    for (int i = 0; i < num_jobs; i++) {
+        free(jobs[i].hexagons);
+    }
+
+    if (status == POLYFILL_JOB_OVERFLOW) {
+        fail_and_report_with_code(
+                    ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE,
+                    "Integer overflow detected when estimating the number of hexagons "
+                    "for a polyfill at resolution %d. Please use a smaller resolution.", tiles->resolution);
+    }
+    if (status == POLYFILL_JOB_OUT_OF_MEMORY) {
+        fail_and_report_with_code(ERRCODE_OUT_OF_MEMORY,
+                    "Out of memory while filling a tile of the polygon");
+    }
+}
+
+/*
+ * advance to the next tile, or batch of tiles when using threads,
+ * containing hexagons.
+ *
+ * Returns false when all tiles are done.
+ */
+static bool
+polyfill_tiles_next(PolyfillTiles *tiles)
+{
+    for (;;) {
+        MemoryContextReset(tiles->tile_context);
+        MemoryContext oldcontext = MemoryContextSwitchTo(tiles->tile_context);
+
+        bool done = false;
+        if (tiles->num_threads > 1) {
+            polyfill_tiles_fill_batch(tiles);
+            done = (tiles->hexagons == NULL && tiles->depth < 0);
+        }
+        else {
+            H3Index tile;
+            GeoPolygon clipped;
+            tiles->num_hexagons = 0;
+            if (polyfill_tiles_next_tile(tiles, &tile, &clipped)) {
+                polyfill_tiles_fill(tiles, tile, &clipped);
+            }
+            else {
+                done = true;
+            }
+        }
+        MemoryContextSwitchTo(oldcontext);
+
+        if (tiles->num_hexagons > 0) {
+            return true;
+        }
+        if (done) {
+            return false;
+        }
+    }
+}
+
+
+static void
+polyfill_tiles_free(PolyfillTiles *tiles)
+{
+    MemoryContextDelete(tiles->tile_context);
+    for (int res = 1; res <= tiles->tile_resolution; res++) {
+        MemoryContextDelete(tiles->levels[res].context);
+    }
+    pfree(tiles);
+}
+
+
+/*
+ * State of a polyfill of a list of polygons returning the hexagons
+ * polygon by polygon. Each polygon is either filled at once or tile by tile.
+ */
+typedef struct {
+    GeoPolygon *polygons;
+    int num_polygons;
+    int next_polygon;
+    int resolution;
+
+    PolyfillTiles *tiles;       // tiles of the current polygon, NULL when not tiled
+    H3Index *hexagons;          // hexagons of the current polygon when not tiled
+    int num_hexagons;
+    int next_hexagon;
+
+    int64 estimated_hexagons;   // estimate of H3 for the current polygon, for pg_stat_pgh3
+    int64 emitted_hexagons;     // hexagons of the current polygon returned so far
+} PolyfillState;
+
+static void
+polyfill_state_start_polygon(PolyfillState *state, GeoPolygon *h3polygon)
+{
+    int resolution = state->resolution;
+
+    // the estimate of H3 is an int, which overflows for large polygons at
+    // fine resolutions. Whether to tile is decided without it, the tiles
+    // are small enough for their estimates.
+    double area_estimate = __h3_polyfill_area_estimate(h3polygon, resolution);
+    int numHexagons = H3_EXPORT(maxPolyfillSize)(h3polygon, resolution);
+    bool overflow = h3_maxPolyfillSize_overflows(numHexagons, area_estimate);
+
+    state->estimated_hexagons = overflow ? (int64) area_estimate : numHexagons;
+    state->emitted_hexagons = 0;
+
+    int tile_threshold = __h3_polyfill_tile_threshold();
+    if (tile_threshold >= 0 && (overflow || area_estimate > tile_threshold)
+                && !polyfill_is_transmeridian(&h3polygon->geofence)) {
+        report_debug1("Generating an estimated number of %.0f H3 hexagons "
+                    "at resolution %d tile by tile", area_estimate, resolution);
+
+        // the polygon is kept for the lifetime of the tiles
+        state->tiles = polyfill_tiles_create(h3polygon, resolution);
+        return;
+    }
+
+    numHexagons = h3_maxPolyfillSize_checked(h3polygon, resolution);
+    report_debug1("Generating an estimated number of %d H3 "
+                    "hexagons at resolution %d", numHexagons, resolution);
+
+    H3Index *hexagons = __h3_polyfill_palloc0(numHexagons * sizeof(H3Index));
+    H3_EXPORT(polyfill)(h3polygon, resolution, hexagons);
+    __h3_free_geopolygon_internal_structs(h3polygon);
+
+    int num_hexagons = 0;
+    for (int i = 0; i < numHexagons; i++) {
+        if (hexagons[i] != 0) {
+            if (i > num_hexagons) {
+                // fill NULL "holes" in list of hexagons with the hexagons located
+                // after the NULL value. This allows iterating over the
+                // first num_hexagons elements.
+                hexagons[num_hexagons] = hexagons[i];
+                hexagons[i] = 0;
+            }
+            num_hexagons++;
+        }
+    }
+    report_debug1("Generated exactly %d H3 hexagons at resolution %d",
+                num_hexagons, resolution);
+
+    state->hexagons = hexagons;
+    state->num_hexagons = num_hexagons;
+    state->next_hexagon = 0;
+}
+
+/*
+ * the next hexagon of the polyfill. Must be called in a memory context
+ * living as long as the state.
+ *
+ * Returns false when all polygons are done.
+ */
+static bool
+polyfill_state_next(PolyfillState *state, H3Index *hexagon)
+{
+    for (;;) {
+        if (state->tiles != NULL) {
+            PolyfillTiles *tiles = state->tiles;
+            if (tiles->next_hexagon < tiles->num_hexagons || polyfill_tiles_next(tiles)) {
+                *hexagon = tiles->hexagons[tiles->next_hexagon++];
+                state->emitted_hexagons++;
+                return true;
+            }
+            polyfill_tiles_free(tiles);
+            state->tiles = NULL;
+            __h3_stats_polyfill(state->estimated_hexagons, state->emitted_hexagons);
+        }
+        else if (state->next_hexagon < state->num_hexagons) {
+            *hexagon = state->hexagons[state->next_hexagon++];
+            state->emitted_hexagons++;
+            return true;
+        }
+        else if (state->hexagons != NULL) {
+            pfree(state->hexagons);
+            state->hexagons = NULL;
+            state->num_hexagons = 0;
+            __h3_stats_polyfill(state->estimated_hexagons, state->emitted_hexagons);
+        }
+
+        if (state->next_polygon >= state->num_polygons) {
+            return false;
+        }
+        polyfill_state_start_polygon(state, &state->polygons[state->next_polygon++]);
+    }
+}
+
+/*
+ * value-per-call SRF returning the hexagons of the polyfill state
+ * stored in user_fctx.
+ */
+static Datum
+polyfill_srf_next(FunctionCallInfo fcinfo, FuncCallContext *funcctx)
+{
+    PolyfillState *state = funcctx->user_fctx;
+    H3Index hexagon;
+    PgH3StatsTimer timer;
+
+    __h3_stats_start(&timer, PGH3_STATS_POLYFILL);
+    MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+    bool found = polyfill_state_next(state, &hexagon);
+    MemoryContextSwitchTo(oldcontext);
+    __h3_stats_stop(&timer, funcctx->call_cntr == 0 ? 1 : 0, found ? 1 : 0);
+
+    if (found) {
+        SRF_RETURN_NEXT(funcctx, H3IndexGetDatum(hexagon));
+    }
+    SRF_RETURN_DONE(funcctx);
+}
+
+
 PG_FUNCTION_INFO_V1(_h3_polyfill_polygon);
 
 Datum
 _h3_polyfill_polygon(PG_FUNCTION_ARGS)
 {
     FuncCallContext *funcctx;
-    int call_cntr = 0;
-    int max_calls = 0;
     MemoryContext oldcontext;
-    H3Index *hexagons = NULL;
 
     if (SRF_IS_FIRSTCALL()) {
         // early exit when exterior_ring is null
@@ -172,72 +983,340 @@ _h3_polyfill_polygon(PG_FUNCTION_ARGS)
         if (!(PG_ARGISNULL(1))) {
             interior_rings = PG_GETARG_ARRAYTYPE_P(1);
         }
-        int resolution = PG_GETARG_INT32(2);
 
-        GeoPolygon h3polygon;
-        __h3_polyfill_build_geopolygon(&h3polygon, exterior_ring, interior_rings);
+        PolyfillState *state = palloc0(sizeof(PolyfillState));
+        state->resolution = PG_GETARG_INT32(2);
+        state->polygons = palloc(sizeof(GeoPolygon));
+        state->num_polygons = 1;
+        __h3_polyfill_build_geopolygon(state->polygons, exterior_ring, interior_rings);
 
-        int numHexagons = h3_maxPolyfillSize_checked(&h3polygon, resolution);
+        funcctx->user_fctx = state;
+        MemoryContextSwitchTo(oldcontext);
+    }
 
-        report_debug1("Generating an estimated number of %d H3 "
-                        "hexagons at resolution %d", numHexagons, resolution);
+    // stuff done on every call of the function
+    funcctx = SRF_PERCALL_SETUP();
+    return polyfill_srf_next(fcinfo, funcctx);
+}
 
-        hexagons = __h3_polyfill_palloc0(numHexagons * sizeof(H3Index));
-        H3_EXPORT(polyfill)(&h3polygon, resolution, hexagons);
-        __h3_free_geopolygon_internal_structs(&h3polygon);
 
-        for (int i = 0; i < numHexagons; i++) {
-            if (hexagons[i] != 0) {
-                if (i > max_calls) {
-                    // fill NULL "holes" in list of hexagons with the hexagons located
-                    // after the NULL value. This allows us to use call_cntr and max_calls
-                    // for iteration during SRF calls.
-                    hexagons[max_calls] = hexagons[i];
-                    hexagons[i] = 0;
-                }
-                max_calls++;
-            }
-        }
-        report_debug1("Generated exactly %d H3 hexagons at resolution %d",
-                    max_calls, resolution);
+PG_FUNCTION_INFO_V1(_h3_polyfill_wkb);
 
-        if (max_calls > 0) {
-            // keep track of the results
-            funcctx->max_calls = max_calls;
-            funcctx->user_fctx = hexagons;
-        }
-        else {
-            // fast track when no results
-            pfree(hexagons);
-            hexagons = NULL;
+/*
+ * polyfill of a PostGIS polygon or multipolygon given as (E)WKB
+ */
+Datum
+_h3_polyfill_wkb(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    MemoryContext oldcontext;
 
-            MemoryContextSwitchTo(oldcontext);
-            SRF_RETURN_DONE(funcctx);
-        }
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        bytea *wkb = PG_GETARG_BYTEA_PP(0);
+
+        PolyfillState *state = palloc0(sizeof(PolyfillState));
+        state->resolution = PG_GETARG_INT32(1);
+        state->num_polygons = __h3_wkb_to_geopolygons((const uint8 *) VARDATA_ANY(wkb),
+                    VARSIZE_ANY_EXHDR(wkb), &state->polygons);
+
+        funcctx->user_fctx = state;
         MemoryContextSwitchTo(oldcontext);
     }
 
     // stuff done on every call of the function
     funcctx = SRF_PERCALL_SETUP();
+    return polyfill_srf_next(fcinfo, funcctx);
+}
+
 
-    // Initialize per-call variables
-    call_cntr = funcctx->call_cntr;
-    max_calls = funcctx->max_calls;
-    hexagons = funcctx->user_fctx;
+PG_FUNCTION_INFO_V1(_h3_polyfill_wkb_array);
+
+/*
+ * polyfill of a PostGIS polygon or multipolygon given as (E)WKB,
+ * returning an array
+ */
+Datum
+_h3_polyfill_wkb_array(PG_FUNCTION_ARGS)
+{
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_POLYFILL);
 
-    if (call_cntr < max_calls) {
-        text * index_text = __h3_index_to_text(hexagons[call_cntr]);
-        SRF_RETURN_NEXT(funcctx, PointerGetDatum(index_text));
+    bytea *wkb = PG_GETARG_BYTEA_PP(0);
+
+    PolyfillState *state = palloc0(sizeof(PolyfillState));
+    state->resolution = PG_GETARG_INT32(1);
+    state->num_polygons = __h3_wkb_to_geopolygons((const uint8 *) VARDATA_ANY(wkb),
+                VARSIZE_ANY_EXHDR(wkb), &state->polygons);
+
+    int64 size = 1024;
+    int64 num_hexagons = 0;
+    H3Index *hexagons = __h3_index_array_buffer(size);
+
+    H3Index hexagon;
+    while (polyfill_state_next(state, &hexagon)) {
+        if (num_hexagons == size) {
+            __h3_index_array_check_size(size + 1);
+            size = Min(size * 2, PGH3_MAX_ARRAY_INDEXES);
+            hexagons = repalloc(hexagons, size * sizeof(H3Index));
+        }
+        hexagons[num_hexagons++] = hexagon;
     }
-    else {
-        pfree(hexagons);
-        hexagons = NULL;
 
-        SRF_RETURN_DONE(funcctx);
+    ArrayType *result = __h3_index_array_to_pg(fcinfo, hexagons, NULL, (int) num_hexagons);
+    pfree(hexagons);
+
+    __h3_stats_stop(&timer, 1, num_hexagons);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+static int
+h3_index_qsort_cmp(const void *a, const void *b)
+{
+    return __h3_index_cmp(*((const H3Index *) a), *((const H3Index *) b));
+}
+
+// widest polygon passed to polyfill, H3 takes longer edges as crossing the antimeridian
+#define POLYFILL_BOX_MAX_WIDTH      90.0
+
+/*
+ * The hexagons of a polyfill of a box given in degrees, sorted and
+ * without duplicates. The box may extend over the antimeridian, it is
+ * split into strips of at most POLYFILL_BOX_MAX_WIDTH degrees.
+ */
+H3Index *
+__h3_polyfill_box(const BOX *box, int resolution, int64 *num_hexagons)
+{
+    double west = box->low.x;
+    double east = box->high.x;
+    if (east - west >= 360.0) {
+        west = -180.0;
+        east = 180.0;
+    }
+    while (west < -180.0) {
+        west += 360.0;
+        east += 360.0;
+    }
+    while (west >= 180.0) {
+        west -= 360.0;
+        east -= 360.0;
+    }
+    double south = Max(box->low.y, -90.0);
+    double north = Min(box->high.y, 90.0);
+
+    PolyfillState *state = palloc0(sizeof(PolyfillState));
+    state->resolution = resolution;
+    state->polygons = palloc0(sizeof(GeoPolygon) * (int) (360.0 / POLYFILL_BOX_MAX_WIDTH + 2));
+
+    for (double lo = west; lo < east;) {
+        double hi = Min(lo + POLYFILL_BOX_MAX_WIDTH, east);
+        if (lo < 180.0 && hi > 180.0) {
+            hi = 180.0;
+        }
+        double shift = (lo >= 180.0) ? -360.0 : 0.0;
+
+        Geofence *geofence = &state->polygons[state->num_polygons++].geofence;
+        geofence->numVerts = 4;
+        geofence->verts = palloc(sizeof(GeoCoord) * 4);
+        geofence->verts[0].lon = geofence->verts[3].lon = degsToRads(lo + shift);
+        geofence->verts[1].lon = geofence->verts[2].lon = degsToRads(hi + shift);
+        geofence->verts[0].lat = geofence->verts[1].lat = degsToRads(south);
+        geofence->verts[2].lat = geofence->verts[3].lat = degsToRads(north);
+
+        lo = hi;
+    }
+
+    int64 size = 1024;
+    int64 num = 0;
+    H3Index *hexagons = __h3_index_array_buffer(size);
+
+    H3Index hexagon;
+    while (polyfill_state_next(state, &hexagon)) {
+        if (num == size) {
+            __h3_index_array_check_size(size + 1);
+            size = Min(size * 2, PGH3_MAX_ARRAY_INDEXES);
+            hexagons = repalloc(hexagons, size * sizeof(H3Index));
+        }
+        hexagons[num++] = hexagon;
+    }
+    pfree(state->polygons);
+    pfree(state);
+
+    // centroids on the edges between the strips may be found twice
+    qsort(hexagons, num, sizeof(H3Index), h3_index_qsort_cmp);
+    int64 num_unique = 0;
+    for (int64 i = 0; i < num; i++) {
+        if (num_unique == 0 || hexagons[num_unique - 1] != hexagons[i]) {
+            hexagons[num_unique++] = hexagons[i];
+        }
     }
+
+    *num_hexagons = num_unique;
+    return hexagons;
 }
 
 
+
+/*
+ * Compacted polyfill
+ *
+ * The traversal of the tiled polyfill stops at cells whose descendants
+ * are covered completely by the polygon and returns them at their own
+ * resolution. Only the tiles on the boundary of the polygon are filled
+ * at the requested resolution, so the work and the size of the result
+ * grow with the perimeter of the polygon instead of its area. The result
+ * equals the compacted polyfill of the complete polygon.
+ */
+
+typedef struct {
+    H3Index *cells;
+    int64 num_cells;
+    int64 size;
+} PolyfillCompactBuffer;
+
+static void
+polyfill_compact_append(PolyfillCompactBuffer *buffer, H3Index cell)
+{
+    if (buffer->num_cells == buffer->size) {
+        // the cells of neighbouring tiles may complete their parents
+        buffer->num_cells = __h3_compact_mixed(buffer->cells, buffer->num_cells);
+        if (buffer->num_cells > buffer->size / 2) {
+            __h3_index_array_check_size(buffer->size + 1);
+            buffer->size = Min(buffer->size * 2, PGH3_MAX_ARRAY_INDEXES);
+            buffer->cells = repalloc(buffer->cells, buffer->size * sizeof(H3Index));
+        }
+    }
+    buffer->cells[buffer->num_cells++] = cell;
+}
+
+static void
+polyfill_compact_polygon(GeoPolygon *polygon, int resolution, PolyfillCompactBuffer *buffer)
+{
+    H3Index hexagon;
+
+    if (polyfill_is_transmeridian(&polygon->geofence)) {
+        // the tiles do not support these polygons, see polyfill_state_start_polygon
+        PolyfillState state;
+        memset(&state, 0, sizeof(state));
+        state.polygons = polygon;
+        state.num_polygons = 1;
+        state.resolution = resolution;
+        while (polyfill_state_next(&state, &hexagon)) {
+            polyfill_compact_append(buffer, hexagon);
+        }
+        return;
+    }
+
+    PolyfillTiles *tiles = polyfill_tiles_create(polygon, resolution);
+    tiles->find_inside = true;
+
+    for (;;) {
+        MemoryContextReset(tiles->tile_context);
+        MemoryContext oldcontext = MemoryContextSwitchTo(tiles->tile_context);
+
+        H3Index tile;
+        GeoPolygon clipped;
+        bool found = polyfill_tiles_next_tile(tiles, &tile, &clipped);
+        tiles->num_hexagons = 0;
+        if (found && !tiles->tile_inside) {
+            polyfill_tiles_fill(tiles, tile, &clipped);
+        }
+        MemoryContextSwitchTo(oldcontext);
+
+        if (!found) {
+            break;
+        }
+        if (tiles->tile_inside) {
+            polyfill_compact_append(buffer, tile);
+        }
+        for (int i = 0; i < tiles->num_hexagons; i++) {
+            polyfill_compact_append(buffer, tiles->hexagons[i]);
+        }
+    }
+    polyfill_tiles_free(tiles);
+}
+
+/*
+ * the compacted polyfill of the polygons of a (E)WKB, sorted in the
+ * order of the btree operator class
+ */
+static H3Index *
+polyfill_compact_wkb(bytea *wkb, int resolution, int64 *num_cells)
+{
+    if (resolution < 0 || resolution > PGH3_MAX_RES) {
+        fail_and_report_with_code(ERRCODE_INVALID_PARAMETER_VALUE,
+                "Invalid resolution %d", resolution);
+    }
+
+    GeoPolygon *polygons;
+    int num_polygons = __h3_wkb_to_geopolygons((const uint8 *) VARDATA_ANY(wkb),
+                VARSIZE_ANY_EXHDR(wkb), &polygons);
+
+    PolyfillCompactBuffer buffer;
+    buffer.size = 1024;
+    buffer.num_cells = 0;
+    buffer.cells = __h3_index_array_buffer(buffer.size);
+
+    for (int i = 0; i < num_polygons; i++) {
+        polyfill_compact_polygon(&polygons[i], resolution, &buffer);
+    }
+
+    *num_cells = __h3_compact_mixed(buffer.cells, buffer.num_cells);
+    report_debug1("Generated %ld compacted H3 hexagons for resolution %d",
+                (long) *num_cells, resolution);
+    return buffer.cells;
+}
+
+
+PG_FUNCTION_INFO_V1(_h3_polyfill_compact_wkb);
+
+/*
+ * compacted polyfill of a PostGIS polygon or multipolygon given as
+ * (E)WKB. The cells are compacted before the first row is returned, so
+ * they are returned in materialize mode.
+ */
+Datum
+_h3_polyfill_compact_wkb(PG_FUNCTION_ARGS)
+{
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_POLYFILL_COMPACT);
+
+    int64 num_cells;
+    H3Index *cells = polyfill_compact_wkb(PG_GETARG_BYTEA_PP(0), PG_GETARG_INT32(1), &num_cells);
+
+    __h3_index_srf_materialize(fcinfo, cells, num_cells);
+    pfree(cells);
+
+    __h3_stats_stop(&timer, 1, num_cells);
+    return (Datum) 0;
+}
+
+
+PG_FUNCTION_INFO_V1(_h3_polyfill_compact_wkb_array);
+
+/*
+ * compacted polyfill of a PostGIS polygon or multipolygon given as
+ * (E)WKB, returning an array
+ */
+Datum
+_h3_polyfill_compact_wkb_array(PG_FUNCTION_ARGS)
+{
+    PgH3StatsTimer timer;
+    __h3_stats_start(&timer, PGH3_STATS_POLYFILL_COMPACT);
+
+    int64 num_cells;
+    H3Index *cells = polyfill_compact_wkb(PG_GETARG_BYTEA_PP(0), PG_GETARG_INT32(1), &num_cells);
+
+    ArrayType *result = __h3_index_array_to_pg(fcinfo, cells, NULL, (int) num_cells);
+    pfree(cells);
+
+    __h3_stats_stop(&timer, 1, num_cells);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
 PG_FUNCTION_INFO_V1(_h3_polyfill_polygon_estimate);
 
 Datum
@@ -264,3 +1343,41 @@ _h3_polyfill_polygon_estimate(PG_FUNCTION_ARGS)
 
     PG_RETURN_INT32(numHexagons);
 }
+
+
+PG_FUNCTION_INFO_V1(_h3_polyfill_wkb_estimate);
+
+/*
+ * sum of the estimates of all polygons of a PostGIS polygon or
+ * multipolygon given as (E)WKB. NULL when the geometry contains no polygons.
+ */
+Datum
+_h3_polyfill_wkb_estimate(PG_FUNCTION_ARGS)
+{
+    bytea *wkb = PG_GETARG_BYTEA_PP(0);
+    int resolution = PG_GETARG_INT32(1);
+
+    GeoPolygon *polygons;
+    int num_polygons = __h3_wkb_to_geopolygons((const uint8 *) VARDATA_ANY(wkb),
+                VARSIZE_ANY_EXHDR(wkb), &polygons);
+
+    if (num_polygons == 0) {
+        PG_RETURN_NULL();
+    }
+
+    int64 numHexagons = 0;
+    for (int i = 0; i < num_polygons; i++) {
+        numHexagons += h3_maxPolyfillSize_checked(&polygons[i], resolution);
+        __h3_free_geopolygon_internal_structs(&polygons[i]);
+    }
+    pfree(polygons);
+
+    if (numHexagons > INT_MAX) {
+        fail_and_report_with_code(
+                    ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE,
+                    "Integer overflow detected when estimating the number of hexagons "
+                    "for a polyfill at resolution %d. Please use a smaller resolution.", resolution);
+    }
+
+    PG_RETURN_INT32((int32) numHexagons);
+}
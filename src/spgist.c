@@ -0,0 +1,284 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/spgist.h"
+#include "access/stratnum.h"
+#include "catalog/pg_type.h"
+#include "utils/geo_decls.h"
+
+#include <h3/h3api.h>
+
+/*
+ * SP-GiST operator class for h3index
+ *
+ * The index is a trie following the H3 hierarchy. The inner tuples on
+ * level 0 have one node per base cell, the inner tuples on all further
+ * levels have eight nodes: one per digit (0 - 6) of the resolution
+ * matching the level and one (7) for the indexes having a coarser
+ * resolution. The nodes have no labels, the node number is the path
+ * component itself.
+ *
+ * The traversal value passed down the tree is the most specific cell
+ * known to contain all values below a node. It is used to check for
+ * overlaps with boxes.
+ */
+
+#define SPG_NUM_DIGITS      8
+#define SPG_UNUSED_DIGIT    7
+
+PG_FUNCTION_INFO_V1(h3index_spgist_config);
+
+Datum
+h3index_spgist_config(PG_FUNCTION_ARGS)
+{
+    spgConfigOut *cfg = (spgConfigOut *) PG_GETARG_POINTER(1);
+
+    cfg->prefixType = VOIDOID;
+    cfg->labelType = VOIDOID;
+#if PG_VERSION_NUM >= 140000
+    cfg->leafType = ((spgConfigIn *) PG_GETARG_POINTER(0))->attType;
+#endif
+    cfg->canReturnData = true;
+    cfg->longValuesOK = false;
+
+    PG_RETURN_VOID();
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_spgist_choose);
+
+Datum
+h3index_spgist_choose(PG_FUNCTION_ARGS)
+{
+    spgChooseIn *in = (spgChooseIn *) PG_GETARG_POINTER(0);
+    spgChooseOut *out = (spgChooseOut *) PG_GETARG_POINTER(1);
+
+    H3Index index = DatumGetH3Index(in->datum);
+
+    out->resultType = spgMatchNode;
+    out->result.matchNode.levelAdd = 1;
+    out->result.matchNode.restDatum = H3IndexGetDatum(index);
+
+    if (in->allTheSame) {
+        // nodeN will be set by core
+        PG_RETURN_VOID();
+    }
+
+    out->result.matchNode.nodeN = __h3_index_path_component(index, in->level);
+
+    PG_RETURN_VOID();
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_spgist_picksplit);
+
+Datum
+h3index_spgist_picksplit(PG_FUNCTION_ARGS)
+{
+    spgPickSplitIn *in = (spgPickSplitIn *) PG_GETARG_POINTER(0);
+    spgPickSplitOut *out = (spgPickSplitOut *) PG_GETARG_POINTER(1);
+
+    out->hasPrefix = false;
+    out->nNodes = (in->level == 0) ? PGH3_NUM_BASECELLS : SPG_NUM_DIGITS;
+    out->nodeLabels = NULL;
+
+    out->mapTuplesToNodes = palloc(sizeof(int) * in->nTuples);
+    out->leafTupleDatums = palloc(sizeof(Datum) * in->nTuples);
+
+    for (int i = 0; i < in->nTuples; i++) {
+        H3Index index = DatumGetH3Index(in->datums[i]);
+
+        out->mapTuplesToNodes[i] = __h3_index_path_component(index, in->level);
+        out->leafTupleDatums[i] = in->datums[i];
+    }
+
+    PG_RETURN_VOID();
+}
+
+
+/*
+ * Check if the node with the path component `component` on level `level`
+ * may contain values matching the scankey.
+ *
+ * region is the cell containing all values below the node, or 0 when
+ * it is not known.
+ */
+static bool
+h3index_spgist_node_consistent(ScanKey key, int level, int component, H3Index region)
+{
+    if (key->sk_strategy == RTOverlapStrategyNumber) {
+        if (region == 0) {
+            return true;
+        }
+        BOX region_box;
+        __h3_index_descendants_bbox(region, &region_box);
+        BOX *query_box = DatumGetBoxP(key->sk_argument);
+
+        return (region_box.low.x <= query_box->high.x) && (query_box->low.x <= region_box.high.x)
+            && (region_box.low.y <= query_box->high.y) && (query_box->low.y <= region_box.high.y);
+    }
+
+    H3Index query = DatumGetH3Index(key->sk_argument);
+    int query_res = H3_EXPORT(h3GetResolution)(query);
+    int query_component = __h3_index_path_component(query, level);
+
+    switch (key->sk_strategy) {
+        case RTSameStrategyNumber:
+            return component == query_component;
+
+        case RTContainsStrategyNumber:
+            // the ancestors of the query share its path up to their
+            // resolution, after that all digits are unused
+            return (component == query_component)
+                || (level > 0 && component == SPG_UNUSED_DIGIT);
+
+        case RTContainedByStrategyNumber:
+            // the descendants of the query share its path, the digits
+            // below the resolution of the query may have any value
+            return (level > query_res) || (component == query_component);
+
+        default:
+            elog(ERROR, "unrecognized strategy number: %d", key->sk_strategy);
+    }
+    return false;
+}
+
+/*
+ * the most specific known cell containing all values below the node
+ */
+static H3Index
+h3index_spgist_node_region(H3Index parent_region, int level, int component, bool allTheSame)
+{
+    if (level == 0) {
+        if (allTheSame) {
+            return 0;
+        }
+        return PGH3_BASECELL_INDEX(component);
+    }
+
+    if (allTheSame || parent_region == 0 || component == SPG_UNUSED_DIGIT
+            || H3_EXPORT(h3GetResolution)(parent_region) != level - 1) {
+        return parent_region;
+    }
+
+    H3Index region = (parent_region & ~PGH3_RES_MASK) | ((uint64) level << PGH3_RES_OFFSET);
+    region &= ~(PGH3_DIGIT_MASK << PGH3_DIGIT_OFFSET(level));
+    region |= (uint64) component << PGH3_DIGIT_OFFSET(level);
+    return region;
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_spgist_inner_consistent);
+
+Datum
+h3index_spgist_inner_consistent(PG_FUNCTION_ARGS)
+{
+    spgInnerConsistentIn *in = (spgInnerConsistentIn *) PG_GETARG_POINTER(0);
+    spgInnerConsistentOut *out = (spgInnerConsistentOut *) PG_GETARG_POINTER(1);
+
+    H3Index parent_region = 0;
+    if (in->traversalValue != NULL) {
+        parent_region = *((H3Index *) in->traversalValue);
+    }
+
+    out->nNodes = 0;
+    out->nodeNumbers = palloc(sizeof(int) * in->nNodes);
+    out->levelAdds = palloc(sizeof(int) * in->nNodes);
+    out->traversalValues = palloc(sizeof(void *) * in->nNodes);
+
+    for (int node = 0; node < in->nNodes; node++) {
+        H3Index region = h3index_spgist_node_region(parent_region, in->level,
+                    node, in->allTheSame);
+
+        bool consistent = true;
+
+        // the nodes of allTheSame tuples are not sorted by their path
+        // component, so only the region can be used to filter these
+        for (int i = 0; consistent && i < in->nkeys; i++) {
+            if (in->allTheSame && in->scankeys[i].sk_strategy != RTOverlapStrategyNumber) {
+                continue;
+            }
+            consistent = h3index_spgist_node_consistent(&in->scankeys[i], in->level,
+                        node, region);
+        }
+
+        if (consistent) {
+            H3Index *traversal_value = MemoryContextAlloc(in->traversalMemoryContext, sizeof(H3Index));
+            *traversal_value = region;
+
+            out->nodeNumbers[out->nNodes] = node;
+            out->levelAdds[out->nNodes] = 1;
+            out->traversalValues[out->nNodes] = traversal_value;
+            out->nNodes++;
+        }
+    }
+
+    PG_RETURN_VOID();
+}
+
+
+PG_FUNCTION_INFO_V1(h3index_spgist_leaf_consistent);
+
+Datum
+h3index_spgist_leaf_consistent(PG_FUNCTION_ARGS)
+{
+    spgLeafConsistentIn *in = (spgLeafConsistentIn *) PG_GETARG_POINTER(0);
+    spgLeafConsistentOut *out = (spgLeafConsistentOut *) PG_GETARG_POINTER(1);
+
+    H3Index leaf = DatumGetH3Index(in->leafDatum);
+
+    out->leafValue = in->leafDatum;
+    out->recheck = false;
+
+    for (int i = 0; i < in->nkeys; i++) {
+        ScanKey key = &in->scankeys[i];
+        bool match = false;
+
+        switch (key->sk_strategy) {
+            case RTOverlapStrategyNumber:
+                match = __h3_index_overlaps_box(leaf, DatumGetBoxP(key->sk_argument));
+                break;
+
+            case RTSameStrategyNumber:
+                match = (leaf == DatumGetH3Index(key->sk_argument));
+                break;
+
+            case RTContainsStrategyNumber:
+                match = __h3_index_contains(leaf, DatumGetH3Index(key->sk_argument));
+                break;
+
+            case RTContainedByStrategyNumber:
+                match = __h3_index_contains(DatumGetH3Index(key->sk_argument), leaf);
+                break;
+
+            default:
+                elog(ERROR, "unrecognized strategy number: %d", key->sk_strategy);
+        }
+
+        if (!match) {
+            PG_RETURN_BOOL(false);
+        }
+    }
+
+    PG_RETURN_BOOL(true);
+}
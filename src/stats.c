@@ -0,0 +1,403 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#include "utils/timestamp.h"
+
+#include <string.h>
+
+
+/*
+ * Statistics of the function calls of all backends, shown by the
+ * pg_stat_pgh3 view.
+ *
+ * The statistics are kept in shared memory, which is only available
+ * when pgh3 is loaded by shared_preload_libraries. Otherwise nothing is
+ * collected and the view is empty.
+ *
+ * Each backend collects its statistics locally and adds them to the
+ * shared memory at the end of each transaction, so the functions do
+ * not contend for the lock of the shared statistics.
+ */
+
+#define PGH3_STATS_TRANCHE_NAME "pgh3"
+
+typedef struct {
+    int64 calls;
+    int64 rows;
+    double total_time;          // milliseconds
+    int64 peak_alloc;           // largest allocation of __h3_polyfill_palloc0 in bytes
+    int64 estimated_cells;      // sum of the polyfill estimates of H3
+    int64 generated_cells;      // sum of the cells generated for these estimates
+} PgH3StatsCounters;
+
+typedef struct {
+    LWLock *lock;
+    TimestampTz stats_reset;
+    PgH3StatsCounters counters[PGH3_STATS_NUM_FUNCTIONS];
+} PgH3SharedStats;
+
+// the statistics of the backend not yet added to the shared statistics
+typedef struct {
+    int64 calls;
+    int64 rows;
+    instr_time total_time;
+    int64 peak_alloc;
+    int64 estimated_cells;
+    int64 generated_cells;
+} PgH3PendingStats;
+
+// the names in pg_stat_pgh3, in the order of PgH3StatsFunction
+static const char *const stats_function_names[PGH3_STATS_NUM_FUNCTIONS] = {
+    "h3_geo_to_cell",
+    "h3_geo_to_cells",
+    "h3_polyfill",
+    "h3_polyfill_compact",
+    "h3_kring",
+    "h3_to_children",
+    "h3_compact",
+    "h3_uncompact"
+};
+
+static PgH3SharedStats *shared_stats = NULL;
+
+// pgh3.track, collecting the statistics can be turned off without
+// restarting the server
+static bool stats_track = true;
+
+static PgH3PendingStats pending_stats[PGH3_STATS_NUM_FUNCTIONS];
+static bool has_pending_stats = false;
+static bool xact_callback_registered = false;
+
+// the function of the running timer, -1 for none. Allocations are
+// counted for this function.
+static int current_function = -1;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+
+static void
+stats_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+    if (prev_shmem_request_hook != NULL) {
+        prev_shmem_request_hook();
+    }
+#endif
+
+    RequestAddinShmemSpace(MAXALIGN(sizeof(PgH3SharedStats)));
+    RequestNamedLWLockTranche(PGH3_STATS_TRANCHE_NAME, 1);
+}
+
+static void
+stats_shmem_startup(void)
+{
+    if (prev_shmem_startup_hook != NULL) {
+        prev_shmem_startup_hook();
+    }
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    bool found;
+    shared_stats = ShmemInitStruct("pgh3 statistics", sizeof(PgH3SharedStats), &found);
+    if (!found) {
+        memset(shared_stats->counters, 0, sizeof(shared_stats->counters));
+        shared_stats->lock = &(GetNamedLWLockTranche(PGH3_STATS_TRANCHE_NAME))->lock;
+        shared_stats->stats_reset = GetCurrentTimestamp();
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Registers pgh3.track and requests the shared memory for the statistics.
+ * The shared memory is only requested while the shared_preload_libraries
+ * are loaded.
+ */
+void
+__h3_stats_init(void)
+{
+    DefineCustomBoolVariable(PGH3_TRACK_SETTING_NAME,
+            "Collects the statistics of the function calls shown by pg_stat_pgh3.",
+            "Only has an effect when pgh3 is loaded by shared_preload_libraries.",
+            &stats_track,
+            true,
+            PGC_SUSET, 0,
+            NULL, NULL, NULL);
+
+    if (!process_shared_preload_libraries_in_progress) {
+        return;
+    }
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = stats_shmem_request;
+#else
+    stats_shmem_request();
+#endif
+
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = stats_shmem_startup;
+}
+
+/*
+ * add the pending statistics of the backend to the shared statistics
+ */
+static void
+stats_flush(void)
+{
+    if (!has_pending_stats || shared_stats == NULL) {
+        return;
+    }
+
+    LWLockAcquire(shared_stats->lock, LW_EXCLUSIVE);
+    for (int i = 0; i < PGH3_STATS_NUM_FUNCTIONS; i++) {
+        PgH3StatsCounters *counters = &shared_stats->counters[i];
+        PgH3PendingStats *pending = &pending_stats[i];
+
+        counters->calls += pending->calls;
+        counters->rows += pending->rows;
+        counters->total_time += INSTR_TIME_GET_MILLISEC(pending->total_time);
+        counters->peak_alloc = Max(counters->peak_alloc, pending->peak_alloc);
+        counters->estimated_cells += pending->estimated_cells;
+        counters->generated_cells += pending->generated_cells;
+    }
+    LWLockRelease(shared_stats->lock);
+
+    memset(pending_stats, 0, sizeof(pending_stats));
+    has_pending_stats = false;
+}
+
+static void
+stats_xact_callback(XactEvent event, void *arg)
+{
+    switch (event) {
+        case XACT_EVENT_COMMIT:
+        case XACT_EVENT_PARALLEL_COMMIT:
+        case XACT_EVENT_ABORT:
+        case XACT_EVENT_PARALLEL_ABORT:
+            // the work of aborted transactions was done as well
+            stats_flush();
+            // a timer may have been left running by an error
+            current_function = -1;
+            break;
+        default:
+            break;
+    }
+}
+
+static PgH3PendingStats *
+stats_pending(PgH3StatsFunction function)
+{
+    if (!xact_callback_registered) {
+        RegisterXactCallback(stats_xact_callback, NULL);
+        xact_callback_registered = true;
+    }
+    has_pending_stats = true;
+    return &pending_stats[function];
+}
+
+/*
+ * Starts measuring an invocation of the function. Does nothing when the
+ * statistics are not collected or pgh3.track is off.
+ */
+void
+__h3_stats_start(PgH3StatsTimer *timer, PgH3StatsFunction function)
+{
+    timer->function = function;
+    timer->active = shared_stats != NULL && stats_track;
+    if (!timer->active) {
+        return;
+    }
+
+    timer->previous = current_function;
+    current_function = function;
+    INSTR_TIME_SET_CURRENT(timer->start);
+}
+
+/*
+ * Stops measuring an invocation and counts the calls and rows of it.
+ * A set returning function is invoked once per row, its call is counted
+ * with the first invocation.
+ */
+void
+__h3_stats_stop(PgH3StatsTimer *timer, int64 calls, int64 rows)
+{
+    if (!timer->active) {
+        return;
+    }
+
+    instr_time end;
+    INSTR_TIME_SET_CURRENT(end);
+
+    PgH3PendingStats *pending = stats_pending(timer->function);
+    INSTR_TIME_ACCUM_DIFF(pending->total_time, end, timer->start);
+    pending->calls += calls;
+    pending->rows += rows;
+
+    current_function = timer->previous;
+    timer->active = false;
+}
+
+/*
+ * Counts an allocation of __h3_polyfill_palloc0 for the function
+ * currently measured, or for the polyfill when there is none.
+ */
+void
+__h3_stats_alloc(size_t size)
+{
+    if (shared_stats == NULL || !stats_track) {
+        return;
+    }
+
+    PgH3PendingStats *pending = stats_pending(
+                current_function >= 0 ? (PgH3StatsFunction) current_function : PGH3_STATS_POLYFILL);
+    pending->peak_alloc = Max(pending->peak_alloc, (int64) size);
+}
+
+/*
+ * Counts the H3 estimate and the actual number of cells of the polyfill
+ * of a polygon.
+ */
+void
+__h3_stats_polyfill(int64 estimated_cells, int64 generated_cells)
+{
+    if (shared_stats == NULL || !stats_track) {
+        return;
+    }
+
+    PgH3PendingStats *pending = stats_pending(PGH3_STATS_POLYFILL);
+    pending->estimated_cells += estimated_cells;
+    pending->generated_cells += generated_cells;
+}
+
+
+typedef struct {
+    PgH3StatsCounters counters[PGH3_STATS_NUM_FUNCTIONS];
+    TimestampTz stats_reset;
+} PgH3StatsSnapshot;
+
+PG_FUNCTION_INFO_V1(pg_stat_pgh3);
+
+/*
+ * One row per function with the statistics of all backends. Includes
+ * the statistics of the current transaction of the backend itself.
+ */
+Datum
+pg_stat_pgh3(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    MemoryContext oldcontext;
+    PgH3StatsSnapshot *snapshot;
+
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        TupleDesc tupdesc;
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            fail_and_report_with_code(ERRCODE_FEATURE_NOT_SUPPORTED,
+                    "function returning record called in context that cannot accept type record");
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        snapshot = NULL;
+        if (shared_stats != NULL) {
+            stats_flush();
+
+            snapshot = palloc(sizeof(PgH3StatsSnapshot));
+            LWLockAcquire(shared_stats->lock, LW_SHARED);
+            memcpy(snapshot->counters, shared_stats->counters, sizeof(snapshot->counters));
+            snapshot->stats_reset = shared_stats->stats_reset;
+            LWLockRelease(shared_stats->lock);
+
+            funcctx->max_calls = PGH3_STATS_NUM_FUNCTIONS;
+        }
+        else {
+            // not loaded by shared_preload_libraries
+            funcctx->max_calls = 0;
+        }
+        funcctx->user_fctx = snapshot;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    // stuff done on every call of the function
+    funcctx = SRF_PERCALL_SETUP();
+    snapshot = funcctx->user_fctx;
+
+    if (funcctx->call_cntr >= funcctx->max_calls) {
+        SRF_RETURN_DONE(funcctx);
+    }
+
+    int i = (int) funcctx->call_cntr;
+    const PgH3StatsCounters *counters = &snapshot->counters[i];
+
+    Datum values[8];
+    bool nulls[8] = {false, false, false, false, false, false, false, false};
+    values[0] = CStringGetTextDatum(stats_function_names[i]);
+    values[1] = Int64GetDatum(counters->calls);
+    values[2] = Int64GetDatum(counters->rows);
+    values[3] = Float8GetDatum(counters->total_time);
+    values[4] = Int64GetDatum(counters->peak_alloc);
+    values[5] = Int64GetDatum(counters->estimated_cells);
+    values[6] = Int64GetDatum(counters->generated_cells);
+    values[7] = TimestampTzGetDatum(snapshot->stats_reset);
+
+    HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
+
+
+PG_FUNCTION_INFO_V1(pg_stat_pgh3_reset);
+
+/*
+ * Resets the statistics of all backends. The statistics of running
+ * transactions are added when they end.
+ */
+Datum
+pg_stat_pgh3_reset(PG_FUNCTION_ARGS)
+{
+    if (shared_stats != NULL) {
+        LWLockAcquire(shared_stats->lock, LW_EXCLUSIVE);
+        memset(shared_stats->counters, 0, sizeof(shared_stats->counters));
+        shared_stats->stats_reset = GetCurrentTimestamp();
+        LWLockRelease(shared_stats->lock);
+    }
+
+    // discard the statistics of the current transaction as well
+    memset(pending_stats, 0, sizeof(pending_stats));
+    has_pending_stats = false;
+
+    PG_RETURN_VOID();
+}
@@ -0,0 +1,392 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#if PG_VERSION_NUM >= 120000
+
+#include "access/stratnum.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_type.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/optimizer.h"
+#include "parser/parse_func.h"
+#include "utils/array.h"
+#include "utils/lsyscache.h"
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#include <h3/h3api.h>
+
+
+/*
+ * Planner support functions for the set returning functions.
+ *
+ * Without them the planner assumes 1000 rows for every call, whatever
+ * the arguments are. The number of returned cells is computed from the
+ * arguments when they are constants, otherwise the default estimate
+ * is kept.
+ *
+ * The costs are given in multiples of cpu_operator_cost per returned
+ * cell, for one call of the function.
+ */
+
+#define PGH3_CHILD_COST     1.0
+#define PGH3_KRING_COST     2.0
+
+/*
+ * Estimates the number of cells returned for the arguments of a call
+ * and the cost of each of them. Returns false when there is no estimate.
+ */
+typedef bool (*SupportEstimateFunc)(PlannerInfo *root, List *args, double *rows, double *cell_cost);
+
+/*
+ * The value of the nth argument, when it is a constant or, with bound
+ * parameters, can be estimated as one.
+ */
+static bool
+support_const_arg(PlannerInfo *root, List *args, int n, Datum *value)
+{
+    if (list_length(args) <= n) {
+        return false;
+    }
+
+    Node *arg = (Node *) list_nth(args, n);
+    if (root != NULL) {
+        arg = estimate_expression_value(root, arg);
+    }
+    if (!IsA(arg, Const) || ((Const *) arg)->constisnull) {
+        return false;
+    }
+    *value = ((Const *) arg)->constvalue;
+    return true;
+}
+
+static Node *
+support_handle_request(Node *rawreq, SupportEstimateFunc estimate)
+{
+    double rows;
+    double cell_cost;
+
+    if (IsA(rawreq, SupportRequestRows)) {
+        SupportRequestRows *req = (SupportRequestRows *) rawreq;
+
+        if (req->node != NULL && IsA(req->node, FuncExpr)
+                && estimate(req->root, ((FuncExpr *) req->node)->args, &rows, &cell_cost)) {
+            req->rows = rows;
+            return (Node *) req;
+        }
+    }
+    else if (IsA(rawreq, SupportRequestCost)) {
+        SupportRequestCost *req = (SupportRequestCost *) rawreq;
+
+        // the node is missing when the function is not called from an expression
+        if (req->node != NULL && IsA(req->node, FuncExpr)
+                && estimate(req->root, ((FuncExpr *) req->node)->args, &rows, &cell_cost)) {
+            req->startup = 0;
+            req->per_tuple = Max(rows, 1.0) * cell_cost * cpu_operator_cost;
+            return (Node *) req;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * h3_to_children(h3index, resolution)
+ */
+static bool
+children_estimate(PlannerInfo *root, List *args, double *rows, double *cell_cost)
+{
+    Datum parent;
+    Datum resolution;
+
+    // the count depends on the resolution of the parent
+    if (!support_const_arg(root, args, 0, &parent)
+            || !support_const_arg(root, args, 1, &resolution)) {
+        return false;
+    }
+
+    // exact, including the missing children of pentagons
+    *rows = (double) __h3_child_count(DatumGetH3Index(parent), DatumGetInt32(resolution));
+    *cell_cost = PGH3_CHILD_COST;
+    return true;
+}
+
+/*
+ * h3_kring(h3index, distance) and h3_kring_distances(h3index, distance)
+ *
+ * The number of cells does not depend on the origin, except for the
+ * few distorted by pentagons.
+ */
+static bool
+kring_estimate(PlannerInfo *root, List *args, double *rows, double *cell_cost)
+{
+    Datum distance;
+
+    if (!support_const_arg(root, args, 1, &distance) || DatumGetInt32(distance) < 0) {
+        return false;
+    }
+    double k = DatumGetInt32(distance);
+
+    // maxKringSize, without the integer overflow for large distances
+    *rows = 3.0 * k * (k + 1.0) + 1.0;
+    *cell_cost = PGH3_KRING_COST;
+    return true;
+}
+
+/*
+ * h3_hex_ring(h3index, distance)
+ */
+static bool
+hex_ring_estimate(PlannerInfo *root, List *args, double *rows, double *cell_cost)
+{
+    Datum distance;
+
+    if (!support_const_arg(root, args, 1, &distance) || DatumGetInt32(distance) < 0) {
+        return false;
+    }
+    int k = DatumGetInt32(distance);
+
+    *rows = k == 0 ? 1.0 : 6.0 * k;
+    *cell_cost = PGH3_KRING_COST;
+    return true;
+}
+
+/*
+ * h3_kring_distances(h3index[], distance)
+ *
+ * The rings of the indexes are merged, so this is an upper bound
+ * reached when the indexes are far apart.
+ */
+static bool
+kring_multi_estimate(PlannerInfo *root, List *args, double *rows, double *cell_cost)
+{
+    Datum indexes;
+
+    if (!kring_estimate(root, args, rows, cell_cost)
+            || !support_const_arg(root, args, 0, &indexes)) {
+        return false;
+    }
+    ArrayType *array = DatumGetArrayTypeP(indexes);
+    int num_indexes = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+
+    *rows *= num_indexes;
+    return true;
+}
+
+/*
+ * _h3_polyfill_wkb(wkb, resolution)
+ *
+ * The number of cells is estimated from the area of the bounding boxes of
+ * the polygons, holes are ignored. H3 tests every cell of the box against
+ * the polygon, so each cell costs in the order of the number of vertices.
+ */
+static bool
+polyfill_estimate(PlannerInfo *root, List *args, double *rows, double *cell_cost)
+{
+    Datum wkb_datum;
+    Datum resolution;
+
+    if (!support_const_arg(root, args, 1, &resolution)) {
+        return false;
+    }
+    int res = DatumGetInt32(resolution);
+    if (res < 0 || res > PGH3_MAX_RES || !support_const_arg(root, args, 0, &wkb_datum)) {
+        return false;
+    }
+
+    bytea *wkb = DatumGetByteaPP(wkb_datum);
+    GeoPolygon *polygons;
+    int num_polygons = __h3_wkb_to_geopolygons((const uint8 *) VARDATA_ANY(wkb),
+                VARSIZE_ANY_EXHDR(wkb), &polygons);
+
+    double num_cells = 0.0;
+    double num_verts = 0.0;
+    for (int i = 0; i < num_polygons; i++) {
+        num_cells += __h3_polyfill_area_estimate(&polygons[i], res);
+
+        num_verts += polygons[i].geofence.numVerts;
+        for (int h = 0; h < polygons[i].numHoles; h++) {
+            num_verts += polygons[i].holes[h].numVerts;
+        }
+    }
+
+    *rows = num_cells;
+    *cell_cost = Max(num_verts, 1.0);
+    return true;
+}
+
+PG_FUNCTION_INFO_V1(h3_to_children_support);
+
+Datum
+h3_to_children_support(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(support_handle_request((Node *) PG_GETARG_POINTER(0), children_estimate));
+}
+
+PG_FUNCTION_INFO_V1(h3_kring_support);
+
+Datum
+h3_kring_support(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(support_handle_request((Node *) PG_GETARG_POINTER(0), kring_estimate));
+}
+
+PG_FUNCTION_INFO_V1(h3_hex_ring_support);
+
+Datum
+h3_hex_ring_support(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(support_handle_request((Node *) PG_GETARG_POINTER(0), hex_ring_estimate));
+}
+
+PG_FUNCTION_INFO_V1(h3_kring_distances_multi_support);
+
+Datum
+h3_kring_distances_multi_support(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(support_handle_request((Node *) PG_GETARG_POINTER(0), kring_multi_estimate));
+}
+
+PG_FUNCTION_INFO_V1(h3_polyfill_support);
+
+Datum
+h3_polyfill_support(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(support_handle_request((Node *) PG_GETARG_POINTER(0), polyfill_estimate));
+}
+
+/*
+ * Index conditions for the containment operators.
+ *
+ * The btree order sorts the descendants of an index directly before the
+ * index itself, so "cell <@ parent" is the range between
+ * h3index_descendants_lower_bound(parent) and parent. The range holds
+ * exactly the parent and its descendants, the conditions are not lossy.
+ *
+ * containee_arg is the argument of the operator which is contained.
+ */
+static List *
+containment_index_conditions(SupportRequestIndexCondition *req, int containee_arg)
+{
+    // "cell @> parent" only matches the ancestors of parent
+    if (req->indexarg != containee_arg || req->index->relam != BTREE_AM_OID) {
+        return NIL;
+    }
+
+    List *args;
+    if (IsA(req->node, OpExpr)) {
+        args = ((OpExpr *) req->node)->args;
+    }
+    else if (IsA(req->node, FuncExpr)) {
+        args = ((FuncExpr *) req->node)->args;
+    }
+    else {
+        return NIL;
+    }
+    if (list_length(args) != 2) {
+        return NIL;
+    }
+    Expr *cell = (Expr *) list_nth(args, containee_arg);
+    Expr *parent = (Expr *) list_nth(args, 1 - containee_arg);
+
+    // the parent becomes part of the index conditions, so it must not refer
+    // to the indexed relation or be volatile
+    if (!is_pseudo_constant_for_index(req->root, (Node *) parent, req->index)) {
+        return NIL;
+    }
+
+    Oid type = exprType((Node *) cell);
+    Oid ge_operator = get_opfamily_member(req->opfamily, type, type, BTGreaterEqualStrategyNumber);
+    Oid le_operator = get_opfamily_member(req->opfamily, type, type, BTLessEqualStrategyNumber);
+    if (!OidIsValid(ge_operator) || !OidIsValid(le_operator)) {
+        return NIL;
+    }
+
+    Expr *lower_bound;
+    if (IsA(parent, Const)) {
+        // the operators are strict, a null parent never reaches the index
+        Const *parent_const = (Const *) parent;
+        if (parent_const->constisnull) {
+            return NIL;
+        }
+        lower_bound = (Expr *) makeConst(type, -1, InvalidOid, sizeof(H3Index),
+                    H3IndexGetDatum(__h3_index_descendants_lower_bound(DatumGetH3Index(parent_const->constvalue))),
+                    false, FLOAT8PASSBYVAL);
+    }
+    else {
+        // parameters and columns of other relations are bound at execution,
+        // use the function installed next to the operator
+        char *schema = get_namespace_name(get_func_namespace(req->funcid));
+        Oid lower_bound_func = LookupFuncName(
+                    list_make2(makeString(schema), makeString("h3index_descendants_lower_bound")),
+                    1, &type, true);
+        if (!OidIsValid(lower_bound_func)) {
+            return NIL;
+        }
+        lower_bound = (Expr *) makeFuncExpr(lower_bound_func, type, list_make1(copyObject(parent)),
+                    InvalidOid, InvalidOid, COERCE_EXPLICIT_CALL);
+    }
+
+    req->lossy = false;
+    return list_make2(
+                make_opclause(ge_operator, BOOLOID, false, copyObject(cell), lower_bound,
+                    InvalidOid, InvalidOid),
+                make_opclause(le_operator, BOOLOID, false, copyObject(cell), copyObject(parent),
+                    InvalidOid, InvalidOid));
+}
+
+PG_FUNCTION_INFO_V1(h3index_contains_support);
+
+Datum
+h3index_contains_support(PG_FUNCTION_ARGS)
+{
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+
+    if (IsA(rawreq, SupportRequestIndexCondition)) {
+        // parent @> cell
+        PG_RETURN_POINTER(containment_index_conditions((SupportRequestIndexCondition *) rawreq, 1));
+    }
+    PG_RETURN_POINTER(NULL);
+}
+
+PG_FUNCTION_INFO_V1(h3index_contained_by_support);
+
+Datum
+h3index_contained_by_support(PG_FUNCTION_ARGS)
+{
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+
+    if (IsA(rawreq, SupportRequestIndexCondition)) {
+        // cell <@ parent
+        PG_RETURN_POINTER(containment_index_conditions((SupportRequestIndexCondition *) rawreq, 0));
+    }
+    PG_RETURN_POINTER(NULL);
+}
+
+#endif // PG_VERSION_NUM >= 120000
@@ -19,10 +19,14 @@
 
 #include "util.h"
 
+#include <math.h>
+
 #include "utils/memutils.h"
 #include "utils/guc.h" // for GetConfigOption*
-
-#define H3_INDEX_STR_LEN 17
+#include "utils/lsyscache.h"
+#include "utils/tuplestore.h"
+#include "funcapi.h"
+#include "miscadmin.h"      // for work_mem
 
 
 /*
@@ -31,14 +35,520 @@
 text *
 __h3_index_to_text(H3Index index)
 {
-    char *outstr = (char *) palloc0(H3_INDEX_STR_LEN * sizeof(char));
-    SET_VARSIZE(outstr, H3_INDEX_STR_LEN * sizeof(char));
+    char outstr[H3_INDEX_STR_LEN];
 
     H3_EXPORT(h3ToString)(index, outstr, H3_INDEX_STR_LEN);
 
-    text *iout = cstring_to_text(outstr);
-    pfree(outstr);
-    return iout;
+    return cstring_to_text(outstr);
+}
+
+/*
+ * Compare two H3Indexes using the sort order of the h3index type.
+ *
+ * Indexes with the same key only differ in their resolution, this can only
+ * happen for invalid indexes. The raw value is used to order these.
+ */
+int
+__h3_index_cmp(H3Index a, H3Index b)
+{
+    uint64 key_a = PGH3_ORDER_KEY(a);
+    uint64 key_b = PGH3_ORDER_KEY(b);
+
+    if (key_a != key_b) {
+        return (key_a < key_b) ? -1 : 1;
+    }
+    if (a != b) {
+        return (a < b) ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Check if the child index is the parent itself or one of its descendants.
+ */
+bool
+__h3_index_contains(H3Index parent, H3Index child)
+{
+    int parent_res = H3_EXPORT(h3GetResolution)(parent);
+
+    if (H3_EXPORT(h3GetResolution)(child) < parent_res) {
+        return false;
+    }
+    return H3_EXPORT(h3ToParent)(child, parent_res) == parent;
+}
+
+/*
+ * The smallest value in the sort order of __h3_index_cmp which may be a
+ * descendant of the index. All descendants of the index are sorted
+ * between this value and the index itself.
+ */
+H3Index
+__h3_index_descendants_lower_bound(H3Index index)
+{
+    int res = H3_EXPORT(h3GetResolution)(index);
+    uint64 digits_mask = (UINT64CONST(1) << PGH3_DIGIT_OFFSET(res)) - 1;
+
+    return index & ~PGH3_RES_MASK & ~digits_mask;
+}
+
+/*
+ * Start the iteration over the children of parent at child_res. Yields
+ * the same children in the same order as h3ToChildren, but without
+ * the gaps H3 leaves for the deleted subsequence of pentagons.
+ *
+ * The children are enumerated by counting the digits below the resolution
+ * of the parent like an odometer, so the state has a constant size. There
+ * are no children when child_res is coarser than the parent or invalid.
+ */
+void
+__h3_child_iterator_init(H3ChildIterator *iter, H3Index parent, int child_res)
+{
+    int parent_res = H3_EXPORT(h3GetResolution)(parent);
+
+    iter->parent_res = parent_res;
+    iter->child_res = child_res;
+    iter->pentagon = false;
+    iter->current = 0;
+
+    if (child_res < parent_res || child_res > PGH3_MAX_RES) {
+        return;
+    }
+    iter->pentagon = H3_EXPORT(h3IsPentagon)(parent);
+
+    // the first child has all digits down to child_res set to 0
+    H3Index child = (parent & ~PGH3_RES_MASK) | ((uint64) child_res << PGH3_RES_OFFSET);
+    for (int res = parent_res + 1; res <= child_res; res++) {
+        child &= ~(PGH3_DIGIT_MASK << PGH3_DIGIT_OFFSET(res));
+    }
+    iter->current = child;
+}
+
+/*
+ * Return the next child, or 0 when all children have been returned.
+ */
+H3Index
+__h3_child_iterator_next(H3ChildIterator *iter)
+{
+    H3Index child = iter->current;
+    if (child == 0) {
+        return 0;
+    }
+
+    // increment the digits starting with the finest one
+    H3Index next = child;
+    int res;
+    for (res = iter->child_res; res > iter->parent_res; res--) {
+        int digit = (int) ((next >> PGH3_DIGIT_OFFSET(res)) & PGH3_DIGIT_MASK);
+        next &= ~(PGH3_DIGIT_MASK << PGH3_DIGIT_OFFSET(res));
+        if (digit < 6) {
+            next |= (uint64) (digit + 1) << PGH3_DIGIT_OFFSET(res);
+            break;
+        }
+    }
+
+    if (res == iter->parent_res) {
+        // all digits wrapped around
+        iter->current = 0;
+        return child;
+    }
+
+    // below a pentagon, all children whose first non-zero digit is 1 are
+    // deleted. Continue with the first child having a 2 in its place, the
+    // finer digits are all 0 as the increment has just carried over them.
+    if (iter->pentagon) {
+        for (res = iter->parent_res + 1; res <= iter->child_res; res++) {
+            int digit = (int) ((next >> PGH3_DIGIT_OFFSET(res)) & PGH3_DIGIT_MASK);
+            if (digit == 1) {
+                next &= ~(PGH3_DIGIT_MASK << PGH3_DIGIT_OFFSET(res));
+                next |= (uint64) 2 << PGH3_DIGIT_OFFSET(res);
+                break;
+            }
+            if (digit != 0) {
+                break;
+            }
+        }
+    }
+
+    iter->current = next;
+    return child;
+}
+
+/*
+ * The exact number of children of parent at child_res, 0 when child_res
+ * is coarser than the parent or invalid.
+ */
+int64
+__h3_child_count(H3Index parent, int child_res)
+{
+    int parent_res = H3_EXPORT(h3GetResolution)(parent);
+    if (child_res < parent_res || child_res > PGH3_MAX_RES) {
+        return 0;
+    }
+
+    int64 count = 1;
+    for (int res = parent_res; res < child_res; res++) {
+        count *= 7;
+    }
+
+    // a pentagon has one pentagon and five hexagons as children
+    if (H3_EXPORT(h3IsPentagon)(parent)) {
+        count = 1 + 5 * (count - 1) / 6;
+    }
+    return count;
+}
+
+/*
+ * The boundary of the index in degrees. Longitudes of cells crossing
+ * the antimeridian are shifted to the range 0 - 360.
+ *
+ * Returns true when the cell crosses the antimeridian.
+ */
+static bool
+h3_index_boundary_degs(H3Index index, GeoCoord *verts, int *num_verts)
+{
+    GeoBoundary gp;
+    H3_EXPORT(h3ToGeoBoundary)(index, &gp);
+
+    bool transmeridian = false;
+    for (int i = 0; i < gp.numVerts; i++) {
+        verts[i].lon = radsToDegs(gp.verts[i].lon);
+        verts[i].lat = radsToDegs(gp.verts[i].lat);
+
+        if (i > 0 && fabs(verts[i].lon - verts[i - 1].lon) > 180.0) {
+            transmeridian = true;
+        }
+    }
+
+    if (transmeridian) {
+        for (int i = 0; i < gp.numVerts; i++) {
+            if (verts[i].lon < 0.0) {
+                verts[i].lon += 360.0;
+            }
+        }
+    }
+    *num_verts = gp.numVerts;
+    return transmeridian;
+}
+
+/*
+ * Bounding box (in degrees) of the area covered by the index and all of its
+ * descendants.
+ *
+ * The descendants of a cell are not strictly contained in its boundary, so
+ * the box is enlarged by the edge length of the cell. Boxes of cells crossing
+ * the antimeridian or close to the poles span all longitudes.
+ */
+void
+__h3_index_descendants_bbox(H3Index index, BOX *box)
+{
+    GeoCoord verts[MAX_CELL_BNDRY_VERTS];
+    int num_verts = 0;
+    bool transmeridian = h3_index_boundary_degs(index, verts, &num_verts);
+
+    box->low.x = box->high.x = verts[0].lon;
+    box->low.y = box->high.y = verts[0].lat;
+    for (int i = 1; i < num_verts; i++) {
+        box->low.x = Min(box->low.x, verts[i].lon);
+        box->low.y = Min(box->low.y, verts[i].lat);
+        box->high.x = Max(box->high.x, verts[i].lon);
+        box->high.y = Max(box->high.y, verts[i].lat);
+    }
+
+    // one degree of latitude is approx. 111.2km
+    double margin = H3_EXPORT(edgeLengthKm)(H3_EXPORT(h3GetResolution)(index)) / 111.2;
+    box->low.y = Max(box->low.y - margin, -90.0);
+    box->high.y = Min(box->high.y + margin, 90.0);
+
+    double max_abs_lat = Max(fabs(box->low.y), fabs(box->high.y));
+    if (transmeridian || max_abs_lat > 89.0) {
+        box->low.x = -180.0;
+        box->high.x = 180.0;
+    }
+    else {
+        double margin_lon = margin / cos(degsToRads(max_abs_lat));
+        box->low.x = Max(box->low.x - margin_lon, -180.0);
+        box->high.x = Min(box->high.x + margin_lon, 180.0);
+    }
+}
+
+/*
+ * Liang-Barsky line clipping. Returns true when a part of the segment a-b
+ * is within the box or on its boundary.
+ *
+ * The box is given as west, east, south, north. The coordinates are
+ * treated as planar, so the segment and the box may use any unit as long
+ * as it is the same for both.
+ */
+bool
+__h3_segment_intersects_box(const GeoCoord *a, const GeoCoord *b, const double *box)
+{
+    double t0 = 0.0, t1 = 1.0;
+    double dx = b->lon - a->lon;
+    double dy = b->lat - a->lat;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {
+        a->lon - box[0], box[1] - a->lon,
+        a->lat - box[2], box[3] - a->lat
+    };
+
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0.0) {
+            if (q[i] < 0.0) {
+                return false;
+            }
+        }
+        else {
+            double t = q[i] / p[i];
+            if (p[i] < 0.0) {
+                t0 = Max(t0, t);
+            }
+            else {
+                t1 = Min(t1, t);
+            }
+            if (t0 > t1) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Point in ring test by ray casting, like the one of H3 for rings not
+ * crossing the antimeridian. Planar like __h3_segment_intersects_box.
+ */
+bool
+__h3_point_in_ring(const GeoCoord *verts, int num_verts, double lon, double lat)
+{
+    bool inside = false;
+    for (int i = 0, j = num_verts - 1; i < num_verts; j = i++) {
+        if (((verts[i].lat > lat) != (verts[j].lat > lat)) &&
+                (lon < (verts[j].lon - verts[i].lon) * (lat - verts[i].lat) /
+                            (verts[j].lat - verts[i].lat) + verts[i].lon)) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+static bool
+ring_overlaps_box(const GeoCoord *verts, int num_verts, const double *box)
+{
+    // an edge of the cell intersects the box or the cell is inside of it
+    for (int i = 0, j = num_verts - 1; i < num_verts; j = i++) {
+        if (__h3_segment_intersects_box(&verts[j], &verts[i], box)) {
+            return true;
+        }
+    }
+    // the box is completely inside the cell
+    return __h3_point_in_ring(verts, num_verts, box[0], box[2]);
+}
+
+/*
+ * Check if the boundary of the index and the box (in degrees) overlap.
+ */
+bool
+__h3_index_overlaps_box(H3Index index, const BOX *box)
+{
+    GeoCoord verts[MAX_CELL_BNDRY_VERTS];
+    int num_verts = 0;
+    bool transmeridian = h3_index_boundary_degs(index, verts, &num_verts);
+
+    double bounds[4] = {box->low.x, box->high.x, box->low.y, box->high.y};
+    if (ring_overlaps_box(verts, num_verts, bounds)) {
+        return true;
+    }
+    if (transmeridian) {
+        // test the box shifted into the 0 - 360 range of the longitudes of the cell
+        bounds[0] += 360.0;
+        bounds[1] += 360.0;
+        return ring_overlaps_box(verts, num_verts, bounds);
+    }
+    return false;
+}
+
+/**
+ * returns an allocated array of H3Indexes from a 1-dimensional
+ * postgresql h3index[] array.
+ */
+H3Index *
+__h3_index_array_from_pg(ArrayType *indexarray, int *num_indexes)
+{
+    *num_indexes = 0;
+    if (indexarray == NULL) {
+        return NULL;
+    }
+
+    int ndim = ARR_NDIM(indexarray);
+    if (ndim == 0) {
+        // empty array
+        return NULL;
+    }
+    if (ndim != 1) {
+        fail_and_report("The array of h3indexes must be an 1-dimensional array");
+    }
+
+    int nitems = ARR_DIMS(indexarray)[0];
+
+    if (ARR_HASNULL(indexarray)) {
+        bits8 *bitmap = ARR_NULLBITMAP(indexarray);
+        for (int i = 0; i < nitems; i++) {
+            if (!(bitmap[i / 8] & (1 << (i % 8)))) {
+                fail_and_report("h3 index at array position %d is null", i + 1);
+            }
+        }
+    }
+
+    // h3index is a fixed-length pass-by-value type, so without NULLs the
+    // array data is a plain vector of H3Indexes
+    H3Index *h3indexes = palloc(nitems * sizeof(H3Index));
+    memcpy(h3indexes, ARR_DATA_PTR(indexarray), nitems * sizeof(H3Index));
+
+    (*num_indexes) = nitems;
+    return h3indexes;
+}
+
+/*
+ * build a 1-dimensional h3index[] array. The element type is taken
+ * from the return type of the function.
+ *
+ * nulls may be NULL when the array contains no NULLs, the values of
+ * NULL elements are ignored.
+ */
+ArrayType *
+__h3_index_array_to_pg(FunctionCallInfo fcinfo, const H3Index *indexes, const bool *nulls, int num_indexes)
+{
+    Oid array_type = get_fn_expr_rettype(fcinfo->flinfo);
+    Oid element_type = get_element_type(array_type);
+    if (!OidIsValid(element_type)) {
+        fail_and_report("could not determine the element type of the returned array");
+    }
+
+    if (num_indexes == 0) {
+        return construct_empty_array(element_type);
+    }
+
+    int num_nonnull = num_indexes;
+    if (nulls != NULL) {
+        for (int i = 0; i < num_indexes; i++) {
+            if (nulls[i]) {
+                num_nonnull--;
+            }
+        }
+    }
+    bool has_nulls = (num_nonnull != num_indexes);
+
+    int32 data_offset = has_nulls ? ARR_OVERHEAD_WITHNULLS(1, num_indexes) : 0;
+    Size size = (has_nulls ? data_offset : ARR_OVERHEAD_NONULLS(1))
+                    + num_nonnull * sizeof(H3Index);
+    if (!AllocSizeIsValid(size)) {
+        fail_and_report_with_code(ERRCODE_PROGRAM_LIMIT_EXCEEDED,
+                "array size exceeds the maximum allowed (%d)", (int) MaxAllocSize);
+    }
+
+    ArrayType *result = palloc0(size);
+    SET_VARSIZE(result, size);
+    result->ndim = 1;
+    result->dataoffset = data_offset;
+    result->elemtype = element_type;
+    ARR_DIMS(result)[0] = num_indexes;
+    ARR_LBOUND(result)[0] = 1;
+
+    // h3index is a fixed-length pass-by-value type with double alignment,
+    // so the data is a plain vector of the non-null H3Indexes
+    H3Index *data = (H3Index *) ARR_DATA_PTR(result);
+    if (has_nulls) {
+        bits8 *bitmap = ARR_NULLBITMAP(result);
+        for (int i = 0; i < num_indexes; i++) {
+            if (!nulls[i]) {
+                bitmap[i / 8] |= (1 << (i % 8));
+                *data++ = indexes[i];
+            }
+        }
+    }
+    else {
+        memcpy(data, indexes, num_indexes * sizeof(H3Index));
+    }
+
+    return result;
+}
+
+/*
+ * fail when an array of num_indexes indexes would exceed the maximum
+ * size of a value
+ */
+void
+__h3_index_array_check_size(int64 num_indexes)
+{
+    if (num_indexes < 0 || num_indexes > PGH3_MAX_ARRAY_INDEXES) {
+        fail_and_report_with_code(ERRCODE_PROGRAM_LIMIT_EXCEEDED,
+                "array size exceeds the maximum allowed (%d)", (int) MaxAllocSize);
+    }
+}
+
+/*
+ * allocate the buffer for num_indexes indexes which are to be returned
+ * as an array. Fails before allocating when the array would be too large.
+ */
+H3Index *
+__h3_index_array_buffer(int64 num_indexes)
+{
+    __h3_index_array_check_size(num_indexes);
+    return palloc(Max(num_indexes, 1) * sizeof(H3Index));
+}
+
+/*
+ * Return the indexes of a set-returning function in materialize mode:
+ * all rows are written to a tuplestore at once instead of returning
+ * one row per call. Zeros are skipped.
+ *
+ * The function must return a set of a scalar type.
+ */
+void
+__h3_index_srf_materialize(FunctionCallInfo fcinfo, const H3Index *indexes, int64 num_indexes)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo)) {
+        fail_and_report_with_code(ERRCODE_FEATURE_NOT_SUPPORTED,
+                "set-valued function called in context that cannot accept a set");
+    }
+    if (!(rsinfo->allowedModes & SFRM_Materialize)) {
+        fail_and_report_with_code(ERRCODE_FEATURE_NOT_SUPPORTED,
+                "materialize mode required, but it is not allowed in this context");
+    }
+
+    Oid result_type;
+    if (get_call_result_type(fcinfo, &result_type, NULL) != TYPEFUNC_SCALAR) {
+        elog(ERROR, "return type must be a scalar type");
+    }
+
+    // the tuplestore and its descriptor must outlive the function call
+    MemoryContext oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+#if PG_VERSION_NUM >= 120000
+    TupleDesc tupdesc = CreateTemplateTupleDesc(1);
+#else
+    TupleDesc tupdesc = CreateTemplateTupleDesc(1, false);
+#endif
+    TupleDescInitEntry(tupdesc, (AttrNumber) 1, "h3index", result_type, -1, 0);
+
+    Tuplestorestate *tupstore = tuplestore_begin_heap(
+                (rsinfo->allowedModes & SFRM_Materialize_Random) != 0, false, work_mem);
+
+    MemoryContextSwitchTo(oldcontext);
+
+    for (int64 i = 0; i < num_indexes; i++) {
+        if (indexes[i] != 0) {
+            Datum value = H3IndexGetDatum(indexes[i]);
+            bool isnull = false;
+            tuplestore_putvalues(tupstore, tupdesc, &value, &isnull);
+        }
+    }
+
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
 }
 
 /**
@@ -48,7 +558,7 @@ bool
 __h3_index_from_cstring(const char *cstr, H3Index *index)
 {
     (*index) = stringToH3(cstr);
-    if ((*index) == 0) {
+    if (!PGH3_INDEX_IS_STORABLE(*index)) {
         fail_and_report("Could not convert the value '%s' to a H3 index", cstr);
         return false;
     }
@@ -169,5 +679,58 @@ __h3_polyfill_palloc0(size_t size)
     }
     flags |= MCXT_ALLOC_ZERO;
 
+    __h3_stats_alloc(size);
     return palloc_extended(size, flags);
 }
+
+
+/**
+ * The number of estimated hexagons above which a polyfill is performed
+ * tile by tile instead of preallocating the memory for the whole estimate.
+ *
+ * -1 disables the tiled polyfill.
+ */
+int
+__h3_polyfill_tile_threshold(void)
+{
+    int threshold = PGH3_POLYFILL_TILE_THRESHOLD_DEFAULT;
+
+#if PG_VERSION_NUM > 100000
+    const char * threshold_str = GetConfigOptionByName(PGH3_POLYFILL_TILE_THRESHOLD_SETTING_NAME, NULL, true);
+    if (threshold_str != NULL && threshold_str[0] != '\0') {
+        if (!parse_int(threshold_str, &threshold, 0, NULL) || threshold < -1) {
+            fail_and_report_with_code(
+                    ERRCODE_INVALID_PARAMETER_VALUE,
+                    PGH3_POLYFILL_TILE_THRESHOLD_SETTING_NAME ": could not parse value \"%s\"",
+                    threshold_str);
+        }
+    }
+#endif
+
+    return threshold;
+}
+
+
+/**
+ * The number of threads used to fill the tiles of a tiled polyfill.
+ */
+int
+__h3_polyfill_threads(void)
+{
+    int threads = 1;
+
+#if PG_VERSION_NUM > 100000
+    const char * threads_str = GetConfigOptionByName(PGH3_POLYFILL_THREADS_SETTING_NAME, NULL, true);
+    if (threads_str != NULL && threads_str[0] != '\0') {
+        if (!parse_int(threads_str, &threads, 0, NULL)
+                || threads < 1 || threads > PGH3_POLYFILL_MAX_THREADS) {
+            fail_and_report_with_code(
+                    ERRCODE_INVALID_PARAMETER_VALUE,
+                    PGH3_POLYFILL_THREADS_SETTING_NAME ": invalid value \"%s\", must be between 1 and %d",
+                    threads_str, PGH3_POLYFILL_MAX_THREADS);
+        }
+    }
+#endif
+
+    return threads;
+}
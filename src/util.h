@@ -24,11 +24,123 @@
 #include "fmgr.h"
 #include "utils/builtins.h"
 #include "utils/geo_decls.h"
+#include "utils/array.h"
+#include "portability/instr_time.h"
 
 #include <h3/h3api.h>
 
 #define ARRNELEMS(x)  ArrayGetNItems(ARR_NDIM(x), ARR_DIMS(x))
 
+// the h3index type is an 8 byte pass-by-value type sharing the in-memory
+// representation of bigint, so it requires 64bit Datums.
+#if SIZEOF_DATUM != 8
+#error "the h3index type requires a 64bit platform"
+#endif
+
+#define DatumGetH3Index(X)      ((H3Index) DatumGetInt64(X))
+#define H3IndexGetDatum(X)      Int64GetDatum((int64) (X))
+#define PG_GETARG_H3INDEX(n)    DatumGetH3Index(PG_GETARG_DATUM(n))
+#define PG_RETURN_H3INDEX(x)    return H3IndexGetDatum(x)
+
+// The h3set type: a compacted set of indexes, sorted in the order of the
+// btree operator class. The header is followed by a directory of chunks
+// and the delta encoded cells of the chunks, see h3set.c.
+typedef struct {
+    int32 vl_len_;              // varlena header, do not touch directly
+    int32 format;               // H3SET_FORMAT_*
+    int64 num_cells;
+    int32 num_chunks;
+    int32 chunk_cells;          // the number of cells of all chunks but the last one
+} H3Set;
+
+typedef struct {
+    H3Index first;              // the first cell of the chunk
+    uint32 offset;              // position of the encoded cells behind the directory
+    uint32 length;              // length of the encoded cells in bytes
+} H3SetChunk;
+
+#define H3SET_FORMAT_DELTA      1
+#define DatumGetH3SetP(X)       ((H3Set *) PG_DETOAST_DATUM(X))
+#define PG_GETARG_H3SET_P(n)    DatumGetH3SetP(PG_GETARG_DATUM(n))
+#define PG_RETURN_H3SET_P(x)    PG_RETURN_POINTER(x)
+
+// length of the string representation of an index including the
+// terminating NULL byte
+#define H3_INDEX_STR_LEN 17
+
+// bit layout of an index. see h3Index.h of the H3 library
+#define PGH3_RES_OFFSET         52
+#define PGH3_RES_MASK           ((uint64) 15 << PGH3_RES_OFFSET)
+#define PGH3_DIGIT_MASK         ((uint64) 7)
+#define PGH3_MAX_RES            15
+#define PGH3_DIGIT_OFFSET(res)  ((PGH3_MAX_RES - (res)) * 3)
+#define PGH3_MODE_OFFSET        59
+#define PGH3_CELL_MODE          1
+
+#define PGH3_NUM_BASECELLS      122
+// the resolution 0 index of a base cell: cell mode, all digits unused
+#define PGH3_BASECELL_INDEX(bc) (UINT64CONST(0x08001fffffffffff) | ((uint64) (bc) << 45))
+
+// The sort order of h3indexes ignores the resolution. As the unused digits of
+// an index are all set to 7, all descendants of a cell sort directly before
+// the cell itself and form a contiguous range.
+#define PGH3_ORDER_KEY(h)       ((uint64) (h) & ~PGH3_RES_MASK)
+
+// The values accepted by all inputs of the h3index type: the highest bit of
+// an index is reserved and always unset, 0 is no index.
+#define PGH3_INDEX_IS_STORABLE(h)   ((h) != 0 && ((uint64) (h) >> 63) == 0)
+
+/*
+ * The components of the path from the base cell to the index.
+ * level 0 is the base cell, level 1 - 15 the digits at that resolution.
+ */
+static inline int
+__h3_index_path_component(H3Index index, int level)
+{
+    if (level == 0) {
+        return H3_EXPORT(h3GetBaseCell)(index);
+    }
+    if (level > PGH3_MAX_RES) {
+        return 0;
+    }
+    return (int) ((index >> PGH3_DIGIT_OFFSET(level)) & PGH3_DIGIT_MASK);
+}
+
+/*
+ * Iteration over the descendants of an index at a finer resolution
+ * without materializing them. See __h3_child_iterator_init.
+ */
+typedef struct {
+    H3Index current;    // the next child, 0 when the iteration is done
+    int parent_res;
+    int child_res;
+    bool pentagon;      // the parent is a pentagon
+} H3ChildIterator;
+
+// the functions with statistics in pg_stat_pgh3, see stats.c
+typedef enum {
+    PGH3_STATS_GEO_TO_CELL = 0,
+    PGH3_STATS_GEO_TO_CELLS,
+    PGH3_STATS_POLYFILL,
+    PGH3_STATS_POLYFILL_COMPACT,
+    PGH3_STATS_KRING,
+    PGH3_STATS_TO_CHILDREN,
+    PGH3_STATS_COMPACT,
+    PGH3_STATS_UNCOMPACT,
+    PGH3_STATS_NUM_FUNCTIONS
+} PgH3StatsFunction;
+
+// measures one invocation of a function, see __h3_stats_start
+typedef struct {
+    PgH3StatsFunction function;
+    bool active;                // false when the statistics are not collected
+    int previous;               // the function measured before, -1 for none
+    instr_time start;
+} PgH3StatsTimer;
+
+// the maximum number of indexes in a h3index[]
+#define PGH3_MAX_ARRAY_INDEXES  ((int64) ((MaxAllocSize - ARR_OVERHEAD_NONULLS(1)) / sizeof(H3Index)))
+
 #define fail_and_report_with_code(code, msg, ...) \
              ereport(ERROR, \
                 (errcode(code), errmsg(msg, ##__VA_ARGS__)));
@@ -47,6 +159,13 @@
 // See https://www.postgresql.org/docs/9.2/runtime-config-custom.html for adding
 // custom options
 #define PGH3_POLYFILL_MEM_SETTING_NAME "pgh3.polyfill_mem"
+#define PGH3_POLYFILL_TILE_THRESHOLD_SETTING_NAME "pgh3.polyfill_tile_threshold"
+#define PGH3_POLYFILL_TILE_THRESHOLD_DEFAULT 1048576
+#define PGH3_POLYFILL_THREADS_SETTING_NAME "pgh3.polyfill_threads"
+#define PGH3_POLYFILL_MAX_THREADS 256
+#define PGH3_GEOMETRY_CACHE_SIZE_SETTING_NAME "pgh3.geometry_cache_size"
+#define PGH3_GEOMETRY_CACHE_SIZE_DEFAULT 16384
+#define PGH3_TRACK_SETTING_NAME "pgh3.track"
 
 // combined version number for H3, using the same method postgresql uses
 #ifdef H3_VERSION_MAJOR
@@ -57,8 +176,46 @@
 
 
 text * __h3_index_to_text(H3Index);
+int __h3_index_cmp(H3Index a, H3Index b);
+bool __h3_index_contains(H3Index parent, H3Index child);
+H3Index __h3_index_descendants_lower_bound(H3Index index);
+void __h3_child_iterator_init(H3ChildIterator *iter, H3Index parent, int child_res);
+H3Index __h3_child_iterator_next(H3ChildIterator *iter);
+int64 __h3_child_count(H3Index parent, int child_res);
+void __h3_index_descendants_bbox(H3Index index, BOX *box);
+bool __h3_index_overlaps_box(H3Index index, const BOX *box);
+bool __h3_segment_intersects_box(const GeoCoord *a, const GeoCoord *b, const double *box);
+bool __h3_point_in_ring(const GeoCoord *verts, int num_verts, double lon, double lat);
+H3Index * __h3_index_array_from_pg(ArrayType *indexarray, int *num_indexes);
+ArrayType * __h3_index_array_to_pg(FunctionCallInfo fcinfo, const H3Index *indexes, const bool *nulls, int num_indexes);
+void __h3_index_array_check_size(int64 num_indexes);
+H3Index * __h3_index_array_buffer(int64 num_indexes);
+void __h3_index_srf_materialize(FunctionCallInfo fcinfo, const H3Index *indexes, int64 num_indexes);
 void __h3_make_bound_box(POLYGON *poly);
 bool __h3_index_from_cstring(const char *str, H3Index *index);
 void * __h3_polyfill_palloc0(size_t size);
+int __h3_polyfill_tile_threshold(void);
+double __h3_polyfill_area_estimate(const GeoPolygon *polygon, int resolution);
+int64 __h3_compact_mixed(H3Index *indexes, int64 num_indexes);
+int64 __h3_compact_sorted(H3Index *indexes, int64 num_indexes);
+H3Set *__h3_set_from_sorted(const H3Index *cells, int64 num_cells);
+H3Index *__h3_set_decode(const H3Set *set, int64 *num_cells);
+int __h3_polyfill_threads(void);
+H3Index *__h3_polyfill_box(const BOX *box, int resolution, int64 *num_hexagons);
+void __h3_geometry_cache_init(void);
+int __h3_geometry_cache_size(void);
+void __h3_geometry_cache_count_hit(void);
+void __h3_cached_centroid(H3Index index, Point *centroid);
+int __h3_cached_boundary(H3Index index, Point *verts);
+void __h3_stats_init(void);
+void __h3_stats_start(PgH3StatsTimer *timer, PgH3StatsFunction function);
+void __h3_stats_stop(PgH3StatsTimer *timer, int64 calls, int64 rows);
+void __h3_stats_alloc(size_t size);
+void __h3_stats_polyfill(int64 estimated_cells, int64 generated_cells);
+int __h3_wkb_to_geopolygons(const uint8 *data, size_t length, GeoPolygon **polygons);
+int __h3_wkb_to_points(const uint8 *data, size_t length, double **lons, double **lats, bool *is_multi);
+bytea *__h3_wkb_point(const Point *point);
+bytea *__h3_wkb_polygon(const Point *verts, int num_verts);
+bytea *__h3_wkb_multipolygon(const Point *verts, const int *num_verts, int num_polygons);
 
 #endif // __PGH3_UTIL_H__
@@ -0,0 +1,452 @@
+/*
+ * Copyright 2018 Deutsches Zentrum für Luft- und Raumfahrt e.V.
+ *         (German Aerospace Center), Earth Observation Center
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util.h"
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "port/pg_bswap.h"
+#include "utils/memutils.h" // for AllocSizeIsValid
+
+#include <string.h>
+
+#include <h3/h3api.h>
+
+/*
+ * Reading of PostGIS geometries in the (extended) well-known binary
+ * format as returned by st_asbinary and st_asewkb.
+ *
+ * Using WKB avoids linking against PostGIS and depending on its internal
+ * serialization format, which differs between PostGIS versions.
+ */
+
+#define WKB_XDR             0   // big endian
+#define WKB_NDR             1   // little endian
+
+#define WKB_POINT           1
+#define WKB_POLYGON         3
+#define WKB_MULTIPOINT      4
+#define WKB_MULTIPOLYGON    6
+
+// flags of the extended WKB used by PostGIS
+#define EWKB_Z_FLAG         0x80000000
+#define EWKB_M_FLAG         0x40000000
+#define EWKB_SRID_FLAG      0x20000000
+
+typedef struct {
+    const uint8 *data;
+    size_t length;
+    size_t pos;
+    bool swap;          // byte order differs from the one of the machine
+} WkbReader;
+
+static inline void
+wkb_check_remaining(WkbReader *reader, size_t size)
+{
+    if (reader->length - reader->pos < size) {
+        fail_and_report_with_code(ERRCODE_INVALID_BINARY_REPRESENTATION,
+                "Invalid WKB: unexpected end of data at byte %zu", reader->pos);
+    }
+}
+
+static inline uint32
+wkb_read_uint32(WkbReader *reader)
+{
+    uint32 value;
+    wkb_check_remaining(reader, sizeof(value));
+    memcpy(&value, reader->data + reader->pos, sizeof(value));
+    reader->pos += sizeof(value);
+
+    if (reader->swap) {
+        value = pg_bswap32(value);
+    }
+    return value;
+}
+
+static inline double
+wkb_read_double(WkbReader *reader)
+{
+    uint64 bits;
+    double value;
+    wkb_check_remaining(reader, sizeof(bits));
+    memcpy(&bits, reader->data + reader->pos, sizeof(bits));
+    reader->pos += sizeof(bits);
+
+    if (reader->swap) {
+        bits = pg_bswap64(bits);
+    }
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/*
+ * read the byte order and the type of a geometry. Returns the
+ * type without flags and sets the number of coordinates per point.
+ */
+static uint32
+wkb_read_header(WkbReader *reader, int *num_dims)
+{
+    wkb_check_remaining(reader, 1);
+    uint8 byte_order = reader->data[reader->pos++];
+    if (byte_order != WKB_XDR && byte_order != WKB_NDR) {
+        fail_and_report_with_code(ERRCODE_INVALID_BINARY_REPRESENTATION,
+                "Invalid WKB: unknown byte order %d", byte_order);
+    }
+#ifdef WORDS_BIGENDIAN
+    reader->swap = (byte_order == WKB_NDR);
+#else
+    reader->swap = (byte_order == WKB_XDR);
+#endif
+
+    uint32 type = wkb_read_uint32(reader);
+    bool has_z = (type & EWKB_Z_FLAG) != 0;
+    bool has_m = (type & EWKB_M_FLAG) != 0;
+
+    if (type & EWKB_SRID_FLAG) {
+        // the srid is not used, the coordinates are expected to be WGS84
+        wkb_read_uint32(reader);
+    }
+    type &= 0x0fffffff;
+
+    // ISO WKB encodes the dimensions in the type
+    if (type >= 3000) {
+        has_z = has_m = true;
+        type -= 3000;
+    }
+    else if (type >= 2000) {
+        has_m = true;
+        type -= 2000;
+    }
+    else if (type >= 1000) {
+        has_z = true;
+        type -= 1000;
+    }
+
+    *num_dims = 2 + (has_z ? 1 : 0) + (has_m ? 1 : 0);
+    return type;
+}
+
+static void
+wkb_read_ring(WkbReader *reader, int num_dims, Geofence *geofence)
+{
+    uint32 num_points = wkb_read_uint32(reader);
+    wkb_check_remaining(reader, (size_t) num_points * num_dims * sizeof(double));
+
+    geofence->verts = palloc(Max(num_points, 1) * sizeof(GeoCoord));
+    geofence->numVerts = 0;
+
+    for (uint32 i = 0; i < num_points; i++) {
+        double x = wkb_read_double(reader);
+        double y = wkb_read_double(reader);
+        for (int d = 2; d < num_dims; d++) {
+            wkb_read_double(reader);
+        }
+        geofence->verts[geofence->numVerts].lat = degsToRads(y);
+        geofence->verts[geofence->numVerts].lon = degsToRads(x);
+        geofence->numVerts++;
+    }
+
+    // H3 closes the rings itself
+    if (geofence->numVerts > 1
+            && geofence->verts[0].lat == geofence->verts[geofence->numVerts - 1].lat
+            && geofence->verts[0].lon == geofence->verts[geofence->numVerts - 1].lon) {
+        geofence->numVerts--;
+    }
+}
+
+/*
+ * read the rings of a polygon. Empty polygons are skipped, returns
+ * true when the polygon was read.
+ */
+static bool
+wkb_read_polygon(WkbReader *reader, int num_dims, GeoPolygon *polygon)
+{
+    uint32 num_rings = wkb_read_uint32(reader);
+    // every ring requires at least its number of points
+    wkb_check_remaining(reader, (size_t) num_rings * sizeof(uint32));
+
+    polygon->numHoles = 0;
+    polygon->holes = NULL;
+    polygon->geofence.verts = NULL;
+    polygon->geofence.numVerts = 0;
+
+    if (num_rings == 0) {
+        return false;
+    }
+
+    wkb_read_ring(reader, num_dims, &polygon->geofence);
+    if (num_rings > 1) {
+        polygon->numHoles = num_rings - 1;
+        polygon->holes = palloc(polygon->numHoles * sizeof(Geofence));
+        for (int i = 0; i < polygon->numHoles; i++) {
+            wkb_read_ring(reader, num_dims, &polygon->holes[i]);
+        }
+    }
+    return polygon->geofence.numVerts > 0;
+}
+
+/*
+ * Read the polygons of a WKB or EWKB Polygon or MultiPolygon. The polygons
+ * are allocated in the current memory context, the coordinates converted
+ * to radians.
+ *
+ * Other geometry types contain no polygons.
+ *
+ * Returns the number of polygons.
+ */
+int
+__h3_wkb_to_geopolygons(const uint8 *data, size_t length, GeoPolygon **polygons)
+{
+    WkbReader reader = {data, length, 0, false};
+    int num_dims;
+
+    *polygons = NULL;
+
+    uint32 type = wkb_read_header(&reader, &num_dims);
+    if (type == WKB_POLYGON) {
+        *polygons = palloc(sizeof(GeoPolygon));
+        return wkb_read_polygon(&reader, num_dims, *polygons) ? 1 : 0;
+    }
+
+    if (type == WKB_MULTIPOLYGON) {
+        uint32 num_parts = wkb_read_uint32(&reader);
+        // every part requires at least its header and number of rings
+        wkb_check_remaining(&reader, (size_t) num_parts * 9);
+
+        *polygons = palloc(Max(num_parts, 1) * sizeof(GeoPolygon));
+        int num_polygons = 0;
+        for (uint32 i = 0; i < num_parts; i++) {
+            int part_dims;
+            if (wkb_read_header(&reader, &part_dims) != WKB_POLYGON) {
+                fail_and_report_with_code(ERRCODE_INVALID_BINARY_REPRESENTATION,
+                        "Invalid WKB: part %u of the multipolygon is not a polygon", i + 1);
+            }
+            if (wkb_read_polygon(&reader, part_dims, &(*polygons)[num_polygons])) {
+                num_polygons++;
+            }
+        }
+        return num_polygons;
+    }
+
+    return 0;
+}
+
+
+static void
+wkb_read_point(WkbReader *reader, int num_dims, double *lon, double *lat)
+{
+    *lon = wkb_read_double(reader);
+    *lat = wkb_read_double(reader);
+    for (int d = 2; d < num_dims; d++) {
+        wkb_read_double(reader);
+    }
+}
+
+/*
+ * Read the coordinates of a WKB or EWKB Point or MultiPoint into
+ * separate arrays of longitudes and latitudes in degrees. Empty points
+ * have NaN coordinates.
+ *
+ * Returns the number of points, or -1 when the geometry is of another type.
+ * is_multi is set for multipoints, it may be NULL.
+ */
+int
+__h3_wkb_to_points(const uint8 *data, size_t length, double **lons, double **lats, bool *is_multi)
+{
+    WkbReader reader = {data, length, 0, false};
+    int num_dims;
+
+    *lons = NULL;
+    *lats = NULL;
+
+    uint32 type = wkb_read_header(&reader, &num_dims);
+    if (is_multi != NULL) {
+        *is_multi = (type == WKB_MULTIPOINT);
+    }
+    if (type == WKB_POINT) {
+        *lons = palloc(sizeof(double));
+        *lats = palloc(sizeof(double));
+        wkb_read_point(&reader, num_dims, *lons, *lats);
+        return 1;
+    }
+
+    if (type == WKB_MULTIPOINT) {
+        uint32 num_points = wkb_read_uint32(&reader);
+        // every point requires at least its header and two coordinates
+        wkb_check_remaining(&reader, (size_t) num_points * 21);
+
+        *lons = palloc(Max(num_points, 1) * sizeof(double));
+        *lats = palloc(Max(num_points, 1) * sizeof(double));
+        for (uint32 i = 0; i < num_points; i++) {
+            int point_dims;
+            if (wkb_read_header(&reader, &point_dims) != WKB_POINT) {
+                fail_and_report_with_code(ERRCODE_INVALID_BINARY_REPRESENTATION,
+                        "Invalid WKB: part %u of the multipoint is not a point", i + 1);
+            }
+            wkb_read_point(&reader, point_dims, &(*lons)[i], &(*lats)[i]);
+        }
+        return (int) num_points;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Writing of EWKB as read by st_geomfromewkb. The geometries are
+ * written in the byte order of the machine and with the SRID 4326,
+ * as the coordinates of H3 are WGS84 longitudes and latitudes in degrees.
+ */
+
+#define WKB_SRID_WGS84      4326
+
+// byte order, type and srid
+#define EWKB_HEADER_SIZE    (1 + 4 + 4)
+// byte order and type of the parts of a multi geometry
+#define WKB_PART_HEADER_SIZE  (1 + 4)
+#define WKB_POINT_SIZE      (2 * sizeof(double))
+
+typedef struct {
+    uint8 *data;
+    size_t pos;
+} WkbWriter;
+
+static bytea *
+wkb_writer_start(WkbWriter *writer, size_t length)
+{
+    if (!AllocSizeIsValid(VARHDRSZ + length)) {
+        fail_and_report_with_code(ERRCODE_PROGRAM_LIMIT_EXCEEDED,
+                "The geometry would exceed the maximum size of a value");
+    }
+
+    bytea *result = palloc(VARHDRSZ + length);
+    SET_VARSIZE(result, VARHDRSZ + length);
+
+    writer->data = (uint8 *) VARDATA(result);
+    writer->pos = 0;
+    return result;
+}
+
+static inline void
+wkb_write_uint32(WkbWriter *writer, uint32 value)
+{
+    memcpy(writer->data + writer->pos, &value, sizeof(value));
+    writer->pos += sizeof(value);
+}
+
+static inline void
+wkb_write_point(WkbWriter *writer, const Point *point)
+{
+    memcpy(writer->data + writer->pos, &point->x, sizeof(double));
+    memcpy(writer->data + writer->pos + sizeof(double), &point->y, sizeof(double));
+    writer->pos += WKB_POINT_SIZE;
+}
+
+static void
+wkb_write_header(WkbWriter *writer, uint32 type, bool with_srid)
+{
+#ifdef WORDS_BIGENDIAN
+    writer->data[writer->pos++] = WKB_XDR;
+#else
+    writer->data[writer->pos++] = WKB_NDR;
+#endif
+    if (with_srid) {
+        wkb_write_uint32(writer, type | EWKB_SRID_FLAG);
+        wkb_write_uint32(writer, WKB_SRID_WGS84);
+    }
+    else {
+        wkb_write_uint32(writer, type);
+    }
+}
+
+static inline size_t
+wkb_polygon_body_size(int num_verts)
+{
+    // number of rings, number of points of the ring and the closed ring
+    return 4 + 4 + (num_verts + 1) * WKB_POINT_SIZE;
+}
+
+/*
+ * the polygon without its header: a single ring, closed by
+ * repeating the first vertex
+ */
+static void
+wkb_write_polygon_body(WkbWriter *writer, const Point *verts, int num_verts)
+{
+    wkb_write_uint32(writer, 1);
+    wkb_write_uint32(writer, num_verts + 1);
+    for (int i = 0; i < num_verts; i++) {
+        wkb_write_point(writer, &verts[i]);
+    }
+    wkb_write_point(writer, &verts[0]);
+}
+
+/*
+ * EWKB Point
+ */
+bytea *
+__h3_wkb_point(const Point *point)
+{
+    WkbWriter writer;
+    bytea *result = wkb_writer_start(&writer, EWKB_HEADER_SIZE + WKB_POINT_SIZE);
+
+    wkb_write_header(&writer, WKB_POINT, true);
+    wkb_write_point(&writer, point);
+    return result;
+}
+
+/*
+ * EWKB Polygon without holes. The ring is given without the closing vertex.
+ */
+bytea *
+__h3_wkb_polygon(const Point *verts, int num_verts)
+{
+    WkbWriter writer;
+    bytea *result = wkb_writer_start(&writer, EWKB_HEADER_SIZE + wkb_polygon_body_size(num_verts));
+
+    wkb_write_header(&writer, WKB_POLYGON, true);
+    wkb_write_polygon_body(&writer, verts, num_verts);
+    return result;
+}
+
+/*
+ * EWKB MultiPolygon of polygons without holes. The rings are stored one
+ * after the other in verts, polygon i has num_verts[i] vertices without
+ * the closing vertex.
+ */
+bytea *
+__h3_wkb_multipolygon(const Point *verts, const int *num_verts, int num_polygons)
+{
+    size_t length = EWKB_HEADER_SIZE + 4;
+    for (int i = 0; i < num_polygons; i++) {
+        length += WKB_PART_HEADER_SIZE + wkb_polygon_body_size(num_verts[i]);
+    }
+
+    WkbWriter writer;
+    bytea *result = wkb_writer_start(&writer, length);
+
+    wkb_write_header(&writer, WKB_MULTIPOLYGON, true);
+    wkb_write_uint32(&writer, num_polygons);
+    for (int i = 0; i < num_polygons; i++) {
+        wkb_write_header(&writer, WKB_POLYGON, false);
+        wkb_write_polygon_body(&writer, verts, num_verts[i]);
+        verts += num_verts[i];
+    }
+    return result;
+}